@@ -0,0 +1,246 @@
+/*
+ * fftgen.c - FFT codelet generator for PARC
+ *
+ * Emits a header with a forward complex FFT specialized for one power-of-two
+ * size: a fully unrolled 16-point leaf codelet with its twiddles folded into
+ * the code, radix-4 (plus at most one radix-2) stages whose loop bounds and
+ * strides are literals, and static bit-reversal and twiddle tables. Nothing
+ * is computed at run time before the first transform.
+ *
+ * The bit-reversal permutation is not a separate pass. The inputs of leaf g
+ * are x[rev(g) + rev4(j) * N/16] for j = 0..15, a constant stride, so each
+ * leaf gathers them straight from the input into its block of the output,
+ * and the stages then run in place on the output. Leaves run in order of
+ * their first input rather than of g, so neighbouring leaves share cache
+ * lines.
+ *
+ * The transform computes what Ooura's cdft(2 * N, -1, a, ...) does, out of
+ * place: interleaved re/im doubles, X[k] = sum x[j] * exp(-2 pi i j k / N).
+ * It keeps no state, so concurrent calls on different buffers are safe.
+ *
+ * Usage: fftgen N > fft_codelets.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define LEAF_SIZE 16
+#define MIN_SIZE 32
+#define MAX_SIZE 65536
+
+static int bit_reverse(int v, int bits) {
+    int r = 0;
+    for (int b = 0; b < bits; b++) {
+        if (v & (1 << b)) r |= 1 << (bits - 1 - b);
+    }
+    return r;
+}
+
+// Output block of the leaf whose first input is x[i]: rev(i) over
+// log2(N) - 4 bits, the same permutation in both directions.
+static void emit_leaf_table(int n, int log2n) {
+    int leaves = n / LEAF_SIZE;
+    printf("static const unsigned short fft_codelet_leaf_block[%d] = {\n", leaves);
+    for (int g = 0; g < leaves; g++) {
+        printf("%s%d,", g % 16 == 0 ? "    " : " ", bit_reverse(g, log2n - 4));
+        if (g % 16 == 15 || g == leaves - 1) printf("\n");
+    }
+    printf("};\n\n");
+}
+
+// Twiddle W_size^k = exp(-2 pi i k / size), exact for k = 0 and the
+// quarter turn.
+static void twiddle(int k, int size, double* re, double* im) {
+    if (k == 0) {
+        *re = 1.0;
+        *im = 0.0;
+    } else if (4 * k == size) {
+        *re = 0.0;
+        *im = -1.0;
+    } else {
+        *re = cos(2.0 * M_PI * k / size);
+        *im = -sin(2.0 * M_PI * k / size);
+    }
+}
+
+// Declares yr/yi = (r + i*im) * W_16^k for leaf local v, folding the
+// trivial and eighth-turn twiddles.
+static void emit_leaf_twiddle(const char* y, int v, int k) {
+    double wr, wi;
+    twiddle(k, LEAF_SIZE, &wr, &wi);
+    k %= LEAF_SIZE;
+    if (k == 0) {
+        printf("        double %sr = r%d, %si = i%d;\n", y, v, y, v);
+    } else if (k == 4) {
+        printf("        double %sr = i%d, %si = -r%d;\n", y, v, y, v);
+    } else if (k == 2) {
+        printf("        double %sr = %.17g * (r%d + i%d), %si = %.17g * (i%d - r%d);\n", y, wr, v, v, y, wr, v, v);
+    } else if (k == 6) {
+        printf("        double %sr = %.17g * (i%d - r%d), %si = %.17g * (r%d + i%d);\n", y, -wr, v, v, y, wr, v, v);
+    } else {
+        printf("        double %sr = r%d * %.17g - i%d * %.17g, %si = r%d * %.17g + i%d * %.17g;\n", y, v, wr, v, wi, y,
+               v, wi, v, wr);
+    }
+}
+
+// Radix-4 butterfly over leaf locals base + {0, q, 2q, 3q}, which hold the
+// residues 0, 2, 1, 3 of their group, with twiddle exponent step k.
+static void emit_leaf_radix4(int base, int q, int k) {
+    int v0 = base, v1 = base + q, v2 = base + 2 * q, v3 = base + 3 * q;
+    int scale = LEAF_SIZE / (4 * q);
+    printf("    {\n");
+    emit_leaf_twiddle("y0", v0, 0);
+    emit_leaf_twiddle("y1", v2, k * scale);
+    emit_leaf_twiddle("y2", v1, 2 * k * scale);
+    emit_leaf_twiddle("y3", v3, 3 * k * scale);
+    printf("        double s02r = y0r + y2r, s02i = y0i + y2i, d02r = y0r - y2r, d02i = y0i - y2i;\n");
+    printf("        double s13r = y1r + y3r, s13i = y1i + y3i, d13r = y1r - y3r, d13i = y1i - y3i;\n");
+    printf("        r%d = s02r + s13r; i%d = s02i + s13i;\n", v0, v0);
+    printf("        r%d = d02r + d13i; i%d = d02i - d13r;\n", v1, v1);
+    printf("        r%d = s02r - s13r; i%d = s02i - s13i;\n", v2, v2);
+    printf("        r%d = d02r - d13i; i%d = d02i + d13r;\n", v3, v3);
+    printf("    }\n");
+}
+
+static void emit_leaf(int n) {
+    int stride = n / LEAF_SIZE;
+    printf("// %d-point DIT DFT gathered from stride %d in bit-reversed order, fully unrolled\n", LEAF_SIZE, stride);
+    printf("// as two radix-4 passes.\n");
+    printf("static inline void fft_codelet_leaf(double* out, const double* in) {\n");
+    for (int j = 0; j < LEAF_SIZE; j++) {
+        int at = 2 * bit_reverse(j, 4) * stride;
+        printf("    double r%d = in[%d], i%d = in[%d];\n", j, at, j, at + 1);
+    }
+    for (int g = 0; g < LEAF_SIZE; g += 4) {
+        emit_leaf_radix4(g, 1, 0);
+    }
+    for (int k = 0; k < 4; k++) {
+        emit_leaf_radix4(k, 4, k);
+    }
+    for (int j = 0; j < LEAF_SIZE; j++) {
+        printf("    out[%d] = r%d; out[%d] = i%d;\n", 2 * j, j, 2 * j + 1, j);
+    }
+    printf("}\n\n");
+}
+
+// Merges pairs of q-point DFTs into 2q-point DFTs.
+static void emit_radix2_stage(int n, int q) {
+    printf("static const double fft_codelet_tw%d[%d] = {\n", q, 2 * q);
+    for (int k = 0; k < q; k++) {
+        double wr, wi;
+        twiddle(k, 2 * q, &wr, &wi);
+        printf("    %.17g, %.17g,\n", wr, wi);
+    }
+    printf("};\n\n");
+    printf("static inline void fft_codelet_stage%d(double* a) {\n", q);
+    printf("    for (int g = 0; g < %d; g += %d) {\n", 2 * n, 4 * q);
+    printf("        double* p0 = a + g;\n");
+    printf("        double* p1 = p0 + %d;\n", 2 * q);
+    printf("        for (int k = 0; k < %d; k += 2) {\n", 2 * q);
+    printf("            double wr = fft_codelet_tw%d[k], wi = fft_codelet_tw%d[k + 1];\n", q, q);
+    printf("            double tr = p1[k] * wr - p1[k + 1] * wi;\n");
+    printf("            double ti = p1[k] * wi + p1[k + 1] * wr;\n");
+    printf("            p1[k] = p0[k] - tr;\n");
+    printf("            p1[k + 1] = p0[k + 1] - ti;\n");
+    printf("            p0[k] += tr;\n");
+    printf("            p0[k + 1] += ti;\n");
+    printf("        }\n");
+    printf("    }\n");
+    printf("}\n\n");
+}
+
+// Merges groups of four q-point DFTs into 4q-point DFTs. With bit-reversed
+// input the four blocks hold the residues 0, 2, 1, 3 (mod 4) of the group.
+static void emit_radix4_stage(int n, int q) {
+    printf("static const double fft_codelet_tw%d[%d] = {\n", q, 6 * q);
+    for (int k = 0; k < q; k++) {
+        double w1r, w1i, w2r, w2i, w3r, w3i;
+        twiddle(k, 4 * q, &w1r, &w1i);
+        twiddle(2 * k, 4 * q, &w2r, &w2i);
+        twiddle(3 * k, 4 * q, &w3r, &w3i);
+        printf("    %.17g, %.17g, %.17g, %.17g, %.17g, %.17g,\n", w1r, w1i, w2r, w2i, w3r, w3i);
+    }
+    printf("};\n\n");
+    // Early stages have many small groups, so the twiddles are loaded once
+    // per k and the groups are walked inside; later stages walk k inside.
+    int k_outer = q < n / (4 * q);
+    printf("static inline void fft_codelet_stage%d(double* a) {\n", q);
+    if (k_outer) {
+        printf("    for (int k = 0; k < %d; k += 2) {\n", 2 * q);
+        printf("        const double* w = fft_codelet_tw%d + 3 * k;\n", q);
+        printf("        double w1r = w[0], w1i = w[1], w2r = w[2], w2i = w[3], w3r = w[4], w3i = w[5];\n");
+        printf("        for (int g = k; g < %d; g += %d) {\n", 2 * n, 8 * q);
+        printf("            double* p0 = a + g;\n");
+    } else {
+        printf("    for (int g = 0; g < %d; g += %d) {\n", 2 * n, 8 * q);
+        printf("        const double* w = fft_codelet_tw%d;\n", q);
+        printf("        for (int k = 0; k < %d; k += 2, w += 6) {\n", 2 * q);
+        printf("            double w1r = w[0], w1i = w[1], w2r = w[2], w2i = w[3], w3r = w[4], w3i = w[5];\n");
+        printf("            double* p0 = a + g + k;\n");
+    }
+    printf("            double* p1 = p0 + %d;\n", 2 * q);
+    printf("            double* p2 = p0 + %d;\n", 4 * q);
+    printf("            double* p3 = p0 + %d;\n", 6 * q);
+    printf("            double y0r = p0[0], y0i = p0[1];\n");
+    printf("            double y1r = p2[0] * w1r - p2[1] * w1i, y1i = p2[0] * w1i + p2[1] * w1r;\n");
+    printf("            double y2r = p1[0] * w2r - p1[1] * w2i, y2i = p1[0] * w2i + p1[1] * w2r;\n");
+    printf("            double y3r = p3[0] * w3r - p3[1] * w3i, y3i = p3[0] * w3i + p3[1] * w3r;\n");
+    printf("            double s02r = y0r + y2r, s02i = y0i + y2i, d02r = y0r - y2r, d02i = y0i - y2i;\n");
+    printf("            double s13r = y1r + y3r, s13i = y1i + y3i, d13r = y1r - y3r, d13i = y1i - y3i;\n");
+    printf("            p0[0] = s02r + s13r;\n");
+    printf("            p0[1] = s02i + s13i;\n");
+    printf("            p1[0] = d02r + d13i;\n");
+    printf("            p1[1] = d02i - d13r;\n");
+    printf("            p2[0] = s02r - s13r;\n");
+    printf("            p2[1] = s02i - s13i;\n");
+    printf("            p3[0] = d02r - d13i;\n");
+    printf("            p3[1] = d02i + d13r;\n");
+    printf("        }\n");
+    printf("    }\n");
+    printf("}\n\n");
+}
+
+int main(int argc, char* argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 0;
+    int log2n = 0;
+    while ((1 << log2n) < n) log2n++;
+    if (n < MIN_SIZE || n > MAX_SIZE || (1 << log2n) != n) {
+        fprintf(stderr, "Usage: %s N   (N a power of two, %d-%d)\n", argv[0], MIN_SIZE, MAX_SIZE);
+        return 1;
+    }
+
+    printf("// Generated by fftgen.c for a %d-point FFT. Do not edit.\n", n);
+    printf("#ifndef FFT_CODELETS_H\n#define FFT_CODELETS_H\n\n");
+    printf("#define FFT_CODELET_SIZE %d\n\n", n);
+    emit_leaf_table(n, log2n);
+    emit_leaf(n);
+
+    int stages[16];
+    int stage_count = 0;
+    int q = LEAF_SIZE;
+    if ((log2n - 4) % 2) {
+        emit_radix2_stage(n, q);
+        stages[stage_count++] = q;
+        q *= 2;
+    }
+    for (; q < n; q *= 4) {
+        emit_radix4_stage(n, q);
+        stages[stage_count++] = q;
+    }
+
+    printf("// out and in must not overlap.\n");
+    printf("static inline void fft_codelet_forward(double* out, const double* in) {\n");
+    printf("    for (int i = 0; i < %d; i++) {\n", n / LEAF_SIZE);
+    printf("        fft_codelet_leaf(out + fft_codelet_leaf_block[i] * %d, in + 2 * i);\n", 2 * LEAF_SIZE);
+    printf("    }\n");
+    for (int i = 0; i < stage_count; i++) {
+        printf("    fft_codelet_stage%d(out);\n", stages[i]);
+    }
+    printf("}\n\n#endif\n");
+    return 0;
+}
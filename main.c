@@ -18,6 +18,30 @@
 #include <math.h>
 #include <stdint.h>
 #include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET net_socket;
+#define NET_INVALID_SOCKET INVALID_SOCKET
+#define net_close closesocket
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+typedef int net_socket;
+#define NET_INVALID_SOCKET (-1)
+#define net_close close
+#endif
 
 // --- FFT Implementation (by Takuya OOURA, public domain) ---
 void cdft(int, int, double *, int *, double *);
@@ -30,6 +54,8 @@ void cdft(int, int, double *, int *, double *);
 #define MAX_LOG_ENTRIES 10
 #define EVENT_HISTORY_SIZE 50
 #define PATTERN_LENGTH 3
+#define MAX_BANDS 8 // Display band plus up to 7 from the config file
+#define BAND_NAME_SIZE 16
 #define PANEL_TOP (WATERFALL_HEIGHT + 15)
 #define LEFT_COL_X 15
 #define MID_COL_X 355
@@ -41,23 +67,695 @@ void cdft(int, int, double *, int *, double *);
 #define RIGHT_COL_WIDTH (SCREEN_WIDTH - RIGHT_COL_X - 10)
 
 // Audio processing constants
-#define SAMPLE_RATE 44100
-#define FFT_SIZE 4096
+#ifndef SAMPLE_RATE
+#define SAMPLE_RATE 44100 // Set through the Makefile
+#endif
+#ifndef FFT_SIZE
+#define FFT_SIZE 4096 // Set through the Makefile, which also generates fft_codelets.h
+#endif
 #define MIN_FREQ_TO_DISPLAY 18000
 #define MAX_FREQ_TO_DISPLAY 22000
-#define VOICE_THRESHOLD 0.02f
-#define SILENCE_HANG (SAMPLE_RATE / 2)
+
+// Voice activity detection constants
+#define VAD_MIN_HZ 300.0f
+#define VAD_MAX_HZ 3400.0f
+#define VAD_MIN_LEVEL_DB -55.0f    // Speech-band level, dB re full scale
+#define VAD_SNR_DB 10.0f           // Speech-band level above the tracked noise floor
+#define VAD_FLOOR_RISE_DB 1.0f     // Noise floor rise per second
+#define VAD_MIN_BAND_RATIO 0.4f    // Speech-band share of the power above the noise floor
+#define VAD_MAX_FLATNESS 0.3f      // White noise reads about 0.56, voiced speech well under 0.2
+#define VAD_MIN_ZCR 0.004f         // Zero crossings per sample
+#define VAD_MAX_ZCR 0.15f
+#define VAD_ONSET_MS 80.0f
+#define VAD_HANG_MS 500.0f
+#define VAD_LEVEL_TRIGGER 0.02f    // The former per-sample trigger, for comparison only
+#define VAD_EVAL_DEFAULT_CLIPS 200
+
+// Network export constants
+#define EXPORT_QUEUE_SIZE 256 // Per-producer ring, must be a power of two
+#define EXPORT_BATCH_MAX 32
+#define EXPORT_FLUSH_MS 250
+#define EXPORT_POLL_MS 10
+#define EXPORT_BACKOFF_MIN_MS 500
+#define EXPORT_BACKOFF_MAX_MS 10000
+#define EXPORT_CONNECT_TIMEOUT_MS 1000
+#define EXPORT_FRAME_MAGIC 0x43524150u // "PARC" little-endian
+#define EXPORT_FRAME_VERSION 1
+#define EXPORT_HEADER_SIZE 24
+#define EXPORT_RECORD_SIZE 16
+#define EXPORT_FRAME_MAX (EXPORT_HEADER_SIZE + EXPORT_BATCH_MAX * EXPORT_RECORD_SIZE)
+#define EXPORT_SPILL_FILE "parc_spill.bin"
+#define EXPORT_SPILL_MAX (8 * 1024 * 1024)
+
+// Peak tracking constants
+#define PEAK_TRACK_COUNT 4            // Top-K peaks kept per frame
+#define PEAK_MIN_SNR_DB 15.0f         // Peak height above the band's mean log magnitude
+#define PEAK_TRACK_MAX_JUMP_HZ 250.0f // Largest per-hop move that continues a track
+#define PEAK_TRACK_HOLD_HOPS 3        // Hops a track survives without a matching peak
+#define PEAK_TRACK_LOG_HOPS 3         // Tracks at least this long are logged when they end
+
+// Synthetic source and capacity search constants
+#define SYNTH_MAX_BLOCK_SAMPLES 4096 // Blocks follow the latency profile's device buffer
+#define SYNTH_RHYTHM_STEPS 12
+#define SYNTH_VOICE_GAIN 450.0f // Brings a voiced syllable's peaks to about the event amplitude
+#define PERF_SERIES_SIZE 4096
+#define CAPACITY_MAX_SPEED 1024.0f
+#define CAPACITY_BISECT_STEPS 4
+#define CAPACITY_SWEEP_BISECT_STEPS 2
+#define CAPACITY_MIN_HOPS 256 // Per trial, so its p99 rests on more than a few hops
+
+// Sliding-DFT burst detector constants
+#define SDFT_MAX_BINS 64
+#define SDFT_MIN_WINDOW 16
+#define SDFT_MAX_WINDOW 1024
+#define SDFT_DEFAULT_WINDOW 32      // 0.73 ms at 44.1 kHz
+#define SDFT_DAMPING 0.9999f        // Pole radius; keeps the float recursion from drifting
+#define SDFT_HYSTERESIS_DB 6.0f
+
+// Two-microphone localization constants
+#define TDOA_SPEED_OF_SOUND 343.0f  // m/s in air at 20 C
+#define TDOA_MAX_LAG 512            // Samples either side searched at most
+#define TDOA_COARSE_STEPS 4         // Lags per sample in the full search; the band's carrier spans ~2 samples
+#define TDOA_REFINE_STEPS 8         // Lags per coarse step around the best coarse lag
+#define TDOA_SYNTH_HISTORY 1024     // Synthetic second channel delay line, must be a power of two
+#define TDOA_TEST_TONES 48          // Random in-band tones making up a test noise burst
+#define TDOA_DEFAULT_SYNTH_DELAY_US 120.0f
+#define TDOA_TEST_DEFAULT_TRIALS 200
+
+// Long-term survey constants
+#define SURVEY_MAX_BINS 2048          // Larger transforms are summed down to this many bins
+#define SURVEY_HIST_MIN_DB -160.0f    // Level histogram range, 1 dB buckets
+#define SURVEY_HIST_BUCKETS 200
+#define SURVEY_HIST_HALVE (1u << 30)  // Hops after which the histograms are halved so they never overflow
+#define SURVEY_DEFAULT_PERIOD_S 60.0f
+#define SURVEY_DEFAULT_FILE "parc_survey.csv"
+
+// Fingerprint index constants
+#define FP_FFT_SIZE 1024
+#define FP_HOP 512              // 11.6 ms frames at 44.1 kHz
+#define FP_MIN_BIN 5            // ~215 Hz; hum makes poor landmarks
+#define FP_MAX_BIN (FP_FFT_SIZE / 2 - 1)
+#define FP_PEAK_DF 8            // A landmark is the largest point within this many bins
+#define FP_PEAK_MIN_DB 15.0f    // above the noise floor of its bin
+#define FP_PEAK_PROMINENCE_DB 12.0f // and above the mean of its neighbouring bins
+#define FP_QUIET_POWER 1e-4f    // Bin power of a -88 dBFS sine; digital silence reads as this
+#define FP_FLOOR_FALL 0.05f     // Noise floor smoothing per frame, falling and rising
+#define FP_FLOOR_RISE 0.005f
+#define FP_PEAKS_PER_FRAME 3
+#define FP_FANOUT 3             // Pairs per anchor landmark
+#define FP_TARGET_DT 63         // Frames; the gap takes 6 bits of the hash
+#define FP_TARGET_MIN_DF 3      // Bins; a steady tone paired with itself says little
+#define FP_TIME_BITS 14         // Anchor frame bits stored per hash; offsets are compared modulo
+#define FP_MAX_RECORDINGS ((1u << (32 - FP_TIME_BITS)) - 1)
+#define FP_HASH_BITS 24         // Anchor bin, target bin and frame gap: 9 + 9 + 6 bits
+#define FP_BUCKET_BITS 16       // Directory entries, on the top bits of the hash
+#define FP_MIN_SCORE 10         // Hashes agreeing on one offset to report a match
+#define FP_MAX_MATCHES 10
+#define FP_MERGE_RECORDINGS 32  // Log entries the background indexer lets build up
+#define FP_INDEX_MAGIC 0x58504650u // "PFPX"
+#define FP_LOG_MAGIC 0x52504650u   // "PFPR"
+#define FP_VERSION 1
+#define FP_HEADER_SIZE 32
+#define FP_LOG_HEADER_SIZE 20
+#define FP_NAME_SIZE 256
+#define FP_QUEUE_SIZE 16        // Must be a power of two
+#define FP_POLL_MS 100
+#define FP_DEFAULT_BASE "parc_fp"
+
+// Feature stream constants. The file format itself is in parc_features.h.
+#define FEATURE_QUEUE_SIZE 1024      // Records awaiting the writer; must be a power of two
+#define FEATURE_FILE_QUEUE_SIZE 4    // File starts awaiting the writer; must be a power of two
+#define FEATURE_POLL_MS 50
+#define FEATURE_FLUSH_MS 1000
+#define FEATURE_FILE_SECONDS 3600    // Audio time per file
+#define FEATURE_IO_BUFFER (256 * 1024)
+
+// Duration classification constants
+#define DURATION_MAX_CLASSES 4
+#define DURATION_SKETCH_BUCKETS 256     // Log-spaced; a power of two for the Fenwick tree search
+#define DURATION_SKETCH_MIN_S 0.01      // Upper edge of the first bucket
+#define DURATION_SKETCH_RATIO 1.06      // About 3% either side; 256 buckets reach ~8 h
+#define DURATION_RESCALE_HALF_LIVES 256 // Decayed weights are rescaled before they near overflow
+#define DURATION_DEFAULT_HALF_LIFE_S 3600.0f
+
+// Message bus constants
+#define BUS_SLOTS 256      // Must be a power of two
+#define BUS_TEXT_SIZE 100
+
+// Latency profile constants
+#define LATENCY_STATS_MS 1000   // Panel percentile refresh period
+#define LATENCY_MAX_UNSHOWN 32  // Frames analysed between two display frames
+
+// Ultrasonic monitor constants
+#define MONITOR_RING_SIZE 16384          // Capture -> playback, must be a power of two
+#define MONITOR_BLOCK_SAMPLES 256        // Playback device buffer and DSP block
+#define MONITOR_TARGET_QUEUE 512         // Ring fill kept after skipping ahead
+#define MONITOR_MAX_QUEUE 2048           // Ring fill that triggers a skip
+#define MONITOR_STAMP_QUEUE 64           // Must be a power of two
+#define MONITOR_DEFAULT_LO_HZ 18000
+#define MONITOR_MIN_LO_HZ 10000
+#define MONITOR_MAX_LO_HZ 21000
+#define MONITOR_LO_STEP_HZ 500
+#define MONITOR_AUDIO_BW_HZ 4000         // Heterodyne output bandwidth
+#define MONITOR_DEFAULT_DIVIDE 10
+#define MONITOR_DIVIDER_HYSTERESIS 0.001f // About -60 dBFS, keeps noise from clocking the divider
+#define MONITOR_RELEASE_S 0.005          // Divider envelope release
+#define EXPAND_DEFAULT_FACTOR 10
+
+// EVP recording constants
+#define RECORD_RING_SIZE 262144 // ~6 s of capture, must be a power of two
+#define RECORD_PREROLL (FFT_MAX_SIZE + SAMPLE_RATE / 2) // Kept back for recordings that start in the past
+#define RECORD_CMD_QUEUE_SIZE 16
+#define RECORD_POLL_MS 20
+#define EVPC_FILE_MAGIC 0x43505645u  // "EVPC"
+#define EVPC_BLOCK_MAGIC 0x42505645u // "EVPB"
+#define EVPC_VERSION 1
+#define EVPC_FILE_HEADER_SIZE 32
+#define EVPC_BLOCK_HEADER_SIZE 24
+#define EVPC_BLOCK_SIZE 4096
+#define EVPC_PARTITION_SIZE 256
+#define EVPC_MAX_ORDER 4
+#define EVPC_RICE_ESCAPE 32
+#define EVPC_FLUSH_BLOCKS 8 // fflush every ~0.75 s of audio
+// Worst case per sample is an escaped residual: EVPC_RICE_ESCAPE zeros + 32 raw bits.
+#define EVPC_BLOCK_MAX_BYTES (EVPC_BLOCK_HEADER_SIZE + EVPC_BLOCK_SIZE * 8 + 64)
+
+// Forward FFT specialized for FFT_SIZE by fftgen.c at build time.
+#include "fft_codelets.h"
+#if FFT_CODELET_SIZE != FFT_SIZE
+#error "fft_codelets.h was generated for a different FFT_SIZE; run make clean"
+#endif
+
+// Per-hop feature records, shared with offline readers.
+#include "parc_features.h"
+#if MAX_BANDS > FEATURE_BANDS || PEAK_TRACK_COUNT > FEATURE_PEAKS || BAND_NAME_SIZE != FEATURE_BAND_NAME_SIZE
+#error "parc_features.h does not fit the detector's bands and peaks"
+#endif
+
+#define FFT_BENCH_ROUNDS 25
+#define FFT_BENCH_DEFAULT_ITERATIONS 2000
+
+// Runtime FFT configuration. FFT_SIZE is the startup size and the one the
+// codelets serve; every other size runs through the generic Ooura path.
+#define FFT_MIN_SIZE 1024
+#define FFT_MAX_SIZE 65536
+#define FFT_MAX_OVERLAP 0.9375f
+#define FFT_HISTORY_SIZE FFT_MAX_SIZE // Capture history, must be a power of two
+#define FFT_PLAN_CACHE_SIZE 4
+#define FFT_FRAME_SLOTS 8 // Frames queued for analysis; hops can be shorter than a capture block
+#define FFT_BATCH_LANES 4 // Complex transforms interleaved in a batch, each carrying two real frames
+#define FFT_BATCH_FRAMES (2 * FFT_BATCH_LANES)
+#define FFT_BATCH_MIN 3   // Queued frames worth transforming as a batch
+#define FFT_BATCH_BENCH_ROUNDS 5
+#define CONFIG_FILE "parc.cfg"
+#define CONFIG_POLL_MS 1000
+#if FFT_SIZE < FFT_MIN_SIZE || FFT_SIZE > FFT_MAX_SIZE
+#error "FFT_SIZE must be between FFT_MIN_SIZE and FFT_MAX_SIZE"
+#endif
 
 // --- Structs and Enums ---
 typedef enum { STATE_QUIET, STATE_BURST } BurstState;
 typedef enum { EVENT_SILENCE, EVENT_BURST } EventType;
-typedef enum { DURATION_SHORT, DURATION_LONG } EventDurationClass;
 
 typedef struct {
     EventType type;
-    EventDurationClass duration_class;
+    int duration_class; // 0 is the shortest of the configured classes
 } ClassifiedEvent;
 
+// Streaming quantile sketch of one band's burst or silence durations.
+// Durations fall into log-spaced buckets whose weights are kept as a Fenwick
+// tree, so adding an event and ranking a duration each cost
+// O(log DURATION_SKETCH_BUCKETS) in fixed memory, however many events were
+// seen. With a half-life, each new event weighs 2^(t / half-life), which
+// decays the older ones relative to it without touching them.
+typedef struct {
+    double tree[DURATION_SKETCH_BUCKETS + 1]; // 1-based Fenwick tree of bucket weights
+    double total;
+    Uint32 base_ms; // Event time at which a new event weighs 1
+    int events;
+} DurationSketch;
+
+// Duration classes, as configured: an event's class is the number of cut
+// percentiles at or below its rank among earlier events of its type.
+typedef struct {
+    int classes;                                 // 2..DURATION_MAX_CLASSES
+    float cuts[DURATION_MAX_CLASSES - 1];        // Ascending percentiles, classes - 1 of them
+    float half_life_s;                           // 0 keeps every event at full weight
+} DurationConfig;
+
+// A frequency range to watch, as configured.
+typedef struct {
+    char name[BAND_NAME_SIZE];
+    float min_hz;
+    float max_hz;
+    float threshold_db;
+} BandSpec;
+
+// Independent burst detector over one band of the shared spectrum, with its
+// own event history and pattern analysis. Band 0 is the display band, whose
+// threshold the arrow keys set; the others come from the config file.
+typedef struct {
+    BandSpec spec;
+    float level_db;  // Mean log magnitude over the band, last hop
+    float peak_freq; // Strongest point of the current or last burst
+    float peak_db;
+    BurstState state;
+    Uint32 burst_start_time;
+    Uint32 quiet_start_time;
+    int bursts;
+    ClassifiedEvent history[EVENT_HISTORY_SIZE];
+    int history_count;
+    DurationSketch burst_durations;
+    DurationSketch silence_durations;
+    ClassifiedEvent pattern[PATTERN_LENGTH];
+    int pattern_reps;
+} DetectionBand;
+
+typedef enum { WINDOW_HANN, WINDOW_BLACKMAN_HARRIS, WINDOW_FLAT_TOP, WINDOW_COUNT } WindowType;
+
+// Analysis settings that can change while monitoring, from the keyboard or
+// CONFIG_FILE.
+typedef struct {
+    int size;          // Power of two, FFT_MIN_SIZE..FFT_MAX_SIZE
+    WindowType window;
+    float overlap;     // Share of each frame repeated in the next, 0..FFT_MAX_OVERLAP
+} FftConfig;
+
+// Everything one configuration needs at run time. Plans are built on the main
+// thread and kept in g_fft_plans, so switching back to a recent configuration
+// is free and the audio callback never allocates.
+typedef struct {
+    FftConfig config;
+    int hop;
+    float* window;       // config.size taps
+    float level_db;      // Brings a tone to the level it has at FFT_SIZE with Hann
+    double window_power; // Sum of squared taps, for absolute power levels
+    int* ip;             // Ooura tables, prebuilt; NULL when the codelets serve this size
+    double* w;
+    double* frame;       // FFT_FRAME_SLOTS windowed frames, filled by the audio callback
+    double* spectrum;
+    double* spectrum_b;  // Second microphone, config.size / 2 + 1 bins, with --tdoa
+    double* magnitudes;  // dB, config.size / 2 bins
+    double* prefix;      // Running sums of magnitudes, config.size / 2 + 1 entries
+    double* power;       // |X[k]|^2 of the frame being analysed, config.size / 2 + 1 bins
+    double* batch_re;    // FFT_BATCH_LANES transforms interleaved point by point
+    double* batch_im;
+    double* batch_twiddle; // exp(-2 pi j k / n) for k < n / 2, interleaved re/im
+    int* batch_bitrev;
+    double* batch_power;   // Power spectra a batch produced, per frame slot
+    int batched[FFT_FRAME_SLOTS]; // Slots whose power spectrum is already in batch_power
+    Uint64 batch_ticks;           // Share of the last batch's time per frame
+    Uint32 last_used;
+} FftPlan;
+
+// A frame queued by the audio callback, stamped with its capture hop number,
+// the sample clock and the record ring position at its last sample, when
+// that sample reached the device buffer and when the frame was queued.
+typedef struct {
+    FftPlan* plan;
+    Uint32 hop;
+    Uint64 end_sample;
+    Uint32 record_index;
+    Uint64 arrival_ticks;
+    Uint64 ticks;
+} FftFrame;
+
+typedef struct {
+    float level_db;   // Speech-band power, dB re full scale
+    float total_db;   // Whole-frame power
+    float band_ratio; // Speech-band share of the frame's power above the noise floors
+    float flatness;   // Speech-band spectral flatness, 0 tonal .. 1 white
+    float zcr;        // Zero crossings per sample, ignoring noise-level wiggles
+} VadFeatures;
+
+typedef enum { VAD_NONE, VAD_START, VAD_STOP } VadTransition;
+
+typedef struct {
+    VadFeatures last;
+    int primed;
+    int speech;           // Last hop was speech-like
+    int active;
+    float floor_db;       // Noise floor of level_db
+    float total_floor_db; // Noise floor of total_db
+    float speech_ms;      // Consecutive speech-like time before onset
+    float quiet_ms;       // Time since the last speech-like hop
+    Uint32 onset_index;
+    Uint32 hops;
+    Uint32 speech_hops;
+    Uint32 recordings;
+} VadState;
+
+typedef enum { TRANSPORT_UDP, TRANSPORT_TCP } ExportTransport;
+typedef enum {
+    RECORD_SILENCE = 1,
+    RECORD_BURST,
+    RECORD_PEAK,
+    RECORD_RECORDING_START,
+    RECORD_RECORDING_STOP,
+    RECORD_FAST_ONSET,
+    RECORD_FAST_OFFSET
+} ExportRecordType;
+
+// One exported item. Serialized little-endian as EXPORT_RECORD_SIZE bytes:
+// type(u8) class(u8) band(u8) classes(u8) timestamp_ms(u32) value(f32) freq_hz(f32).
+// value is a duration in seconds for events/recordings/fast offsets, a level in
+// dB for peaks and fast onsets. band indexes g_bands for silences, bursts and
+// peaks and is 0 otherwise. For silences and bursts, class is the duration
+// class, 0 being the shortest of classes; classes is 0 in other records and
+// from older senders, whose two classes were short (0) and long (1).
+typedef struct {
+    Uint8 type;
+    Uint8 duration_class;
+    Uint8 band;
+    Uint8 duration_classes;
+    Uint32 timestamp_ms;
+    float value;
+    float freq_hz;
+} ExportRecord;
+
+typedef enum { SYNTH_IDLE, SYNTH_TONE_BURST, SYNTH_RHYTHM, SYNTH_CHIRP, SYNTH_NOISE_BURST, SYNTH_VOICE } SynthEventKind;
+
+// Synthetic capture source used in place of the SDL audio device.
+typedef struct {
+    Uint32 seed;
+    float event_rate;        // Mean events per second of audio
+    float noise_db;          // Background noise level in dBFS
+    float speed;             // 1 = real time, N = N times faster, 0 = unthrottled
+    Uint32 duration_samples; // 0 = run until stopped
+} SynthConfig;
+
+typedef struct {
+    Uint32 rng;
+    SynthEventKind kind;
+    Uint32 remaining; // Samples left in the current segment
+    int segment_on;
+    int rhythm_step;
+    double phase;
+    double freq;
+    double freq_step;
+    float amp;
+    float noise_amp;
+    int syllables;         // Voice: syllables left after the current one
+    Uint32 segment_length;
+    double f0;             // Voice: glottal pulse rate and its glide per sample
+    double f0_step;
+    double glottal_phase;
+    float tilt;
+    float formant_b[3];    // Formant resonators, y = b*x + a1*y1 + a2*y2
+    float formant_a1[3];
+    float formant_a2[3];
+    float formant_y1[3];
+    float formant_y2[3];
+} SynthState;
+
+// State of the --vad-eval corpus run.
+typedef struct {
+    FftPlan plan;
+    float history[FFT_MAX_SIZE];
+    Uint64 samples;
+    int hop_fill;
+    VadState vad;
+    int vad_hit;   // The detector started a recording during this clip
+    int level_hit; // The former level trigger would have
+    Uint64 fft_ticks;
+    Uint64 vad_ticks;
+    Uint64 hops;
+} VadEval;
+
+// Rolling window of per-hop measurements for percentile reporting.
+typedef struct {
+    float values[PERF_SERIES_SIZE];
+    int count;
+    int pos;
+} PerfSeries;
+
+// Spectral peak refined to sub-bin precision.
+typedef struct {
+    float freq_hz;
+    float mag_db;
+} SpectralPeak;
+
+// A spectral peak followed from hop to hop. id is 0 for a free slot and
+// otherwise stays the same for the life of the track.
+typedef struct {
+    int id;
+    float freq_hz;
+    float mag_db;
+    float slope_hz_s;
+    Uint32 start_ms; // Sample clock
+    Uint32 last_ms;
+    int hops;
+    int missed;
+} PeakTrack;
+
+typedef enum { SDFT_ONSET, SDFT_OFFSET } SdftEventType;
+
+// Onset/offset reported by the sliding-DFT detector, stamped with the audio
+// sample clock of the transition.
+typedef struct {
+    SdftEventType type;
+    Uint64 sample;
+    float level_db;  // Band level in dBFS; the burst's peak level for offsets
+    float freq_hz;   // Strongest bin
+    float duration;  // Seconds, offsets only
+} SdftEvent;
+
+typedef enum { BUS_TEXT, BUS_SDFT, BUS_HOPS_DROPPED, BUS_EXPORT_CONNECTED, BUS_EXPORT_LOST } BusMessageType;
+
+// A message from any thread to the UI thread. Payloads are copied into a
+// preallocated slot, so posting never allocates.
+typedef struct {
+    BusMessageType type;
+    union {
+        char text[BUS_TEXT_SIZE]; // BUS_TEXT: a finished log line
+        SdftEvent sdft;           // BUS_SDFT
+        Uint32 count;             // BUS_HOPS_DROPPED: total so far; BUS_EXPORT_*: spilled frames
+    } data;
+} BusMessage;
+
+// A slot's sequence says whose turn it is: equal to the claiming position
+// when free for a producer, one past it once the message is published, and
+// BUS_SLOTS past it once the consumer has taken it.
+typedef struct {
+    SDL_atomic_t sequence;
+    BusMessage message;
+} BusSlot;
+
+// Damped sliding DFT over the bins of a short window that fall in the display
+// band. Each sample updates every bin with one complex multiply:
+//   S_k(n) = e^(j2pi k/M) * (r * S_k(n-1) + x(n) - r^M * x(n-M))
+// so the band energy is known per sample and onsets are resolved to one
+// sample with at most one window of detection delay.
+typedef struct {
+    int window;
+    int first_bin;
+    int num_bins;
+    float coeff_re[SDFT_MAX_BINS];
+    float coeff_im[SDFT_MAX_BINS];
+    float state_re[SDFT_MAX_BINS];
+    float state_im[SDFT_MAX_BINS];
+    float history[SDFT_MAX_WINDOW];
+    int history_pos;
+    float comb_gain;  // r^M
+    float on_energy;  // Thresholds in raw sum |S_k|^2 units
+    float off_energy;
+    float energy_to_dbfs; // Offset so a full-scale in-bin sine reads 0 dBFS
+    int active;
+    int hold;         // Samples spent below the offset level
+    Uint64 onset_sample;
+    float peak_energy;
+    int peak_bin;
+} SlidingDft;
+
+typedef enum { LATENCY_LOW, LATENCY_BALANCED, LATENCY_POWER_SAVE, LATENCY_PROFILE_COUNT } LatencyProfile;
+
+// How one latency profile trades CPU time and wake-ups for responsiveness.
+typedef struct {
+    const char* name;
+    int device_samples; // Capture buffer requested from the device
+    float overlap;      // Sets the hop at the current FFT size
+    int wake_ms;        // Analysis wake-up period; 0 wakes for every frame
+    int render_ms;      // Shortest time between display frames
+} LatencyProfileSpec;
+
+// Cross-spectrum of the two microphones summed over the hops of one burst,
+// over the primary band's bins.
+typedef struct {
+    double cross[FFT_MAX_SIZE + 2]; // A[k] B*[k], interleaved re/im, bins 0..n/2
+    int n;
+    int min_bin, max_bin;
+    int hops;
+} TdoaState;
+
+typedef struct {
+    float delay_samples; // Positive when the sound reached the first microphone first
+    float bearing_deg;   // From broadside, positive towards the first microphone
+    float coherence;     // Normalized correlation peak, 1 for a clean single path
+} TdoaResult;
+
+// A test burst defined in closed form, so it can be sampled at any delay.
+typedef struct {
+    int chirp;      // Linear chirp, otherwise a sum of random tones
+    int length;     // Samples
+    double f0, f1;  // Band edges used, Hz
+    double freq[TDOA_TEST_TONES];
+    double phase[TDOA_TEST_TONES];
+} TdoaTestBurst;
+
+// Long-term spectral survey over every analysed hop. Power is summed for the
+// Welch average; each bin also keeps a max-hold and a 1 dB level histogram,
+// which serves as its quantile sketch. The footprint is fixed, so a survey
+// can run for days.
+typedef struct {
+    int n;             // FFT size the survey started with
+    WindowType window; // Changing the size or window starts a new survey
+    int bins;          // n / 2 / group, at most SURVEY_MAX_BINS
+    int group;         // FFT bins summed into one survey bin
+    double level_db;   // The plan's level offset, so levels read as on the display
+    Uint64 hops;
+    Uint64 first_sample;
+    Uint64 last_sample;
+    Uint64 next_snapshot; // Sample clock of the next periodic export
+    Uint32 hist_hops;     // Hops since the histograms were last halved
+    time_t started;
+    double power[SURVEY_MAX_BINS];
+    float max_power[SURVEY_MAX_BINS];
+    Uint32 hist[SURVEY_MAX_BINS][SURVEY_HIST_BUCKETS];
+} SurveyState;
+
+typedef enum { MONITOR_OFF, MONITOR_HETERODYNE, MONITOR_DIVIDER, MONITOR_MODE_COUNT } MonitorMode;
+
+// Transposed direct form II biquad section.
+typedef struct {
+    float b0, b1, b2, a1, a2;
+    float z1, z2;
+} Biquad;
+
+// Monitor DSP state, owned by the playback callback and rebuilt there when
+// the mode or tuning changes.
+typedef struct {
+    MonitorMode mode;
+    int lo_hz;
+    Biquad highpass[2]; // Keeps audible input from folding into the output
+    Biquad lowpass[2];  // Removes the mixer's sum products, smooths the divider
+    double lo_re, lo_im;
+    double lo_step_re, lo_step_im;
+    int divide;
+    int crossings;
+    int armed;
+    float sign;
+    float envelope;
+    float release;
+} MonitorDsp;
+
+// Sample clock at the end of a capture block and when the block arrived.
+typedef struct {
+    Uint32 end_sample;
+    Uint64 ticks;
+} MonitorStamp;
+
+typedef enum { RECORD_FORMAT_EVPC, RECORD_FORMAT_WAV } RecordFormat;
+typedef enum { RECORD_CMD_START, RECORD_CMD_STOP } RecordCommandType;
+
+// Start/stop requests from the audio thread, tagged with the record ring
+// position of the first sample they apply to.
+typedef struct {
+    RecordCommandType type;
+    Uint32 sample_index;
+} RecordCommand;
+
+// Streaming state of the lossless EVP encoder. Samples are gathered into
+// EVPC_BLOCK_SIZE blocks; each block is predicted with the best of the fixed
+// polynomial predictors (orders 0-4), and the residuals are Rice coded in
+// EVPC_PARTITION_SIZE partitions. Every block carries a sync word, its first
+// sample index and a CRC32, and the file header has no length field, so a
+// file cut short by power loss decodes up to its last complete block.
+typedef struct {
+    FILE* file;
+    Sint16 block[EVPC_BLOCK_SIZE];
+    int block_fill;
+    Uint32 block_index;
+    Uint32 samples_written;
+    Uint64 bytes_written;
+    Uint64 encode_ticks;
+} EvpcEncoder;
+
+typedef struct {
+    Uint32 sample_rate;
+    Uint32 samples;
+    Uint32 blocks_ok;
+    Uint32 blocks_bad;
+    Uint32 samples_missing;
+    Uint64 bytes_in;
+} EvpcDecodeStats;
+
+// A recording being written by the writer thread.
+typedef struct {
+    FILE* file;
+    char filename[64];
+    EvpcEncoder enc;
+    Uint32 samples;
+    Uint32 overruns_at_start;
+} RecordingFile;
+
+// One landmark pair of a recording: the hash of (anchor bin, target bin,
+// frame gap) and the anchor's frame.
+typedef struct {
+    Uint32 hash;
+    Uint32 frame;
+} FpHash;
+
+// An index entry: hash and recording << FP_TIME_BITS | anchor frame.
+typedef struct {
+    Uint32 hash;
+    Uint32 ref;
+} FpPosting;
+
+// An indexed recording that shares landmarks with a query.
+typedef struct {
+    Uint32 recording;
+    int score;  // Hashes agreeing on one time offset
+    int offset; // Frames from the recording's start to the query's start
+} FpMatch;
+
+// A read-only file, memory-mapped where the platform allows.
+typedef struct {
+    const Uint8* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+} MappedFile;
+
+// The fingerprint index: BASE.idx, mapped and searched in place, and the
+// recordings appended to BASE.log since it was last merged, held in memory.
+typedef struct {
+    char base[FP_NAME_SIZE];
+    MappedFile map;
+    Uint32 recordings;          // In BASE.idx; log recordings follow on
+    Uint32 postings;
+    const Uint8* directory;     // (1 << FP_BUCKET_BITS) + 1 posting indices
+    const Uint8* entries;       // postings x (hash, ref), sorted by hash
+    const Uint8* name_offsets;  // recordings x offset into names
+    const Uint8* names;
+    Uint32 names_size;
+    FpPosting* log_postings;
+    int log_count;
+    int log_capacity;
+    int log_sorted;
+    char (*log_names)[FP_NAME_SIZE];
+    Uint32 log_recordings;
+    Uint32 log_names_capacity;
+} FpIndex;
+
+// Single-producer/single-consumer ring. The producer only advances head,
+// the exporter thread only advances tail, so neither side ever blocks.
+typedef struct {
+    ExportRecord records[EXPORT_QUEUE_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+} ExportQueue;
+
 // --- Globals ---
 SDL_Window* g_window = NULL;
 SDL_Renderer* g_renderer = NULL;
@@ -69,45 +767,231 @@ TTF_Font* g_font_small = NULL;
 SDL_Texture* g_waterfall_texture = NULL;
 SDL_Texture* g_temp_texture = NULL;
 
-// Audio & FFT
-float g_audio_buffer[FFT_SIZE];
-double g_fft_buffer[FFT_SIZE * 2];
-double g_fft_magnitudes[FFT_SIZE / 2];
-int g_audio_buffer_pos = 0;
-SDL_atomic_t g_fft_ready;
+// Audio & FFT. The callback keeps the last FFT_HISTORY_SIZE samples and cuts
+// a frame from them every hop of the plan it is running.
+float g_audio_history[FFT_HISTORY_SIZE];
+float g_audio_history_b[FFT_HISTORY_SIZE]; // Second microphone, with --tdoa
+int g_hop_fill = 0; // Samples since the last frame
+SDL_atomic_t g_fft_ready;     // Frames queued in g_fft_frames
+FftFrame g_fft_frames[FFT_FRAME_SLOTS];
+int g_fft_frame_head = 0;     // Audio callback
+int g_fft_frame_tail = 0;     // Analysis
+SDL_sem* g_fft_sem = NULL;   // Posted per frame in headless mode
+Uint64 g_samples_captured = 0; // Audio thread sample clock
+Uint32 g_hop_sequence = 0;   // Audio callback; every hop, queued or dropped, never reset
+SDL_atomic_t g_hops_total;
+SDL_atomic_t g_hops_dropped;
+int g_hops_batched = 0;      // Frames transformed by fft_catch_up()
+PerfSeries g_hop_cost_ms;
+PerfSeries g_hop_latency_ms;
 
+// FFT plans. The main thread owns g_fft_plans and hands the callback a plan
+// through g_pending_plan; the callback reports the one it switched to in
+// g_active_plan. A plan is only rebuilt once the callback has let go of it.
+FftConfig g_fft_config = {FFT_SIZE, WINDOW_HANN, 0.5f}; // Requested configuration
+int g_fft_config_dirty = 1;
+FftPlan g_fft_plans[FFT_PLAN_CACHE_SIZE];
+Uint32 g_fft_plan_clock = 0;
+void* g_pending_plan = NULL;
+void* g_active_plan = NULL;
+FftPlan* g_audio_plan = NULL;   // Audio callback's copy of g_pending_plan
+FftPlan* g_display_plan = NULL; // Plan of the last processed frame
+char g_config_path[256] = CONFIG_FILE;
+time_t g_config_mtime = 0;
+Uint32 g_config_checked = 0;
+
+// Sliding-DFT detector. g_sdft is owned by the audio callback once capture
+// starts; events and cost figures reach the main thread through atomics.
+int g_sdft_enabled = 0;
+int g_sdft_window = SDFT_DEFAULT_WINDOW;
+float g_sdft_threshold_db = -45.0f;
+SlidingDft g_sdft;
+SDL_atomic_t g_sdft_events_dropped;
+Uint64 g_sdft_window_ticks = 0;   // Audio thread accumulators, published
+Uint64 g_sdft_window_samples = 0; // about once per second of audio
+Uint64 g_sdft_window_worst = 0;   // Worst callback, ppm of its budget
+SDL_atomic_t g_sdft_ns_x100;      // Mean cost per sample, ns * 100
+SDL_atomic_t g_sdft_load_ppm;     // Mean share of the real-time budget
+SDL_atomic_t g_sdft_active;       // Published burst state for the panel
+SDL_atomic_t g_sdft_worst_ppm;    // Worst single callback share of its budget
+
+// Two-microphone localization. --tdoa opens the capture device in stereo.
+int g_tdoa_enabled = 0;
+int g_capture_channels = 1;
+float g_tdoa_spacing_m = 0.0f;
+float g_tdoa_synth_delay_us = TDOA_DEFAULT_SYNTH_DELAY_US;
+TdoaState g_tdoa;
+TdoaResult g_tdoa_last;
+int g_tdoa_located = 0;
+PerfSeries g_tdoa_cost_ms; // Channel separation and cross-spectrum sums per hop
+
+// Long-term survey, owned by the thread that runs process_fft().
+int g_survey_enabled = 0;
+float g_survey_period_s = SURVEY_DEFAULT_PERIOD_S;
+char g_survey_path[256] = SURVEY_DEFAULT_FILE;
+SurveyState g_survey;
+int g_survey_snapshots = 0;
+float g_survey_export_ms = 0.0f; // Cost of the last snapshot
+PerfSeries g_survey_cost_ms;
+
+// Message bus. Audio, writer and network threads post here instead of
+// touching the event log, which belongs to the UI thread.
+BusSlot g_bus_slots[BUS_SLOTS];
+SDL_atomic_t g_bus_head;   // Next position to claim, shared by producers
+Uint32 g_bus_tail = 0;     // UI thread
+SDL_atomic_t g_bus_dropped;
+int g_audio_dropping = 0;  // Audio thread; set while frames are being dropped
+
+// Latency profile and end-to-end latency measurement. A frame's latency runs
+// from the arrival of its newest sample (the callback's time less the
+// samples that followed it into the buffer) to the end of its analysis and
+// to the display frame that first shows it.
+const LatencyProfileSpec g_latency_profiles[LATENCY_PROFILE_COUNT] = {
+    {"low-latency", 128, 0.875f, 0, 8},
+    {"balanced", 512, 0.5f, 16, 16},
+    {"power-save", 2048, 0.0f, 100, 100},
+};
+LatencyProfile g_latency_profile = LATENCY_BALANCED;
+int g_capture_samples = 512; // Buffer size the device granted
+double g_capture_ticks_per_sample = 0.0;
+SDL_atomic_t g_wake_on_frame; // Audio callback posts g_fft_sem for every frame
+PerfSeries g_capture_wait_ms;    // Arrival -> frame queued
+PerfSeries g_detect_latency_ms;  // Arrival -> analysis done
+PerfSeries g_display_latency_ms; // Arrival -> presented
+Uint64 g_unshown_arrivals[LATENCY_MAX_UNSHOWN];
+int g_unshown_count = 0;
+float g_latency_stats[3]; // Display latency p50/p95/p99, refreshed every LATENCY_STATS_MS
+Uint32 g_latency_stats_time = 0;
+
+// Ultrasonic monitor. The audio callback fills g_monitor_ring and
+// g_monitor_stamps; everything else belongs to the playback callback, which
+// publishes its figures through atomics about once per second.
+SDL_AudioDeviceID g_playback_device_id = 0;
+int g_monitor_divide = MONITOR_DEFAULT_DIVIDE;
+SDL_atomic_t g_monitor_mode;
+SDL_atomic_t g_monitor_lo_hz;
+float g_monitor_ring[MONITOR_RING_SIZE];
+SDL_atomic_t g_monitor_ring_head;
+SDL_atomic_t g_monitor_ring_tail;
+SDL_atomic_t g_monitor_overruns;
+MonitorStamp g_monitor_stamps[MONITOR_STAMP_QUEUE];
+SDL_atomic_t g_monitor_stamp_head;
+MonitorDsp g_monitor_dsp;
+float g_monitor_block[MONITOR_BLOCK_SAMPLES];
+int g_monitor_device_samples = MONITOR_BLOCK_SAMPLES;
+Uint64 g_monitor_window_ticks = 0;
+Uint64 g_monitor_window_samples = 0;
+Uint64 g_monitor_latency_sum_us = 0;
+Uint32 g_monitor_latency_count = 0;
+Uint32 g_monitor_latency_peak_us = 0;
+SDL_atomic_t g_monitor_ns_x100;      // DSP cost per output sample, ns * 100
+SDL_atomic_t g_monitor_latency_us;   // Mean capture-to-output latency
+SDL_atomic_t g_monitor_latency_max_us;
+SDL_atomic_t g_monitor_underruns;
+SDL_atomic_t g_monitor_skips;
+
+// EVP Recording. The audio callback feeds every sample into g_record_ring,
+// the voice activity detector in process_fft decides when to record and the
+// writer thread owns the files.
 int g_is_recording = 0;
-Uint32 g_silence_counter = 0;
-FILE* g_record_file = NULL;
-unsigned int g_wav_data_size = 0;
-char g_current_filename[64];
+Uint32 g_record_start_index = 0;
+VadState g_vad;
+PerfSeries g_vad_cost_ms;
+RecordFormat g_record_format = RECORD_FORMAT_EVPC;
+int g_record_enabled = 1;
+Sint16 g_record_ring[RECORD_RING_SIZE];
+SDL_atomic_t g_record_ring_head;
+SDL_atomic_t g_record_ring_tail;
+SDL_atomic_t g_record_overruns;
+RecordCommand g_record_cmds[RECORD_CMD_QUEUE_SIZE];
+SDL_atomic_t g_record_cmd_head;
+SDL_atomic_t g_record_cmd_tail;
+SDL_Thread* g_writer_thread = NULL;
+SDL_atomic_t g_writer_running;
+
+// Fingerprint Index. The writer thread queues each finished recording and
+// the indexer thread fingerprints it, checks it against the index and adds it.
+int g_fp_enabled = 0;
+char g_fp_base[FP_NAME_SIZE] = FP_DEFAULT_BASE;
+char g_fp_queue[FP_QUEUE_SIZE][64];
+SDL_atomic_t g_fp_queue_head;
+SDL_atomic_t g_fp_queue_tail;
+SDL_Thread* g_fp_thread = NULL;
+SDL_atomic_t g_fp_running;
+FpIndex g_fp_index; // Indexer thread only
+
+// Feature stream. process_fft() fills records in g_feature_queue and the
+// feature writer thread appends them to the current file, starting a new one
+// when the next header in g_feature_files says so.
+int g_features_enabled = 0;
+FeatureRecord g_feature_queue[FEATURE_QUEUE_SIZE];
+SDL_atomic_t g_feature_head;
+SDL_atomic_t g_feature_tail;
+FeatureHeader g_feature_files[FEATURE_FILE_QUEUE_SIZE];
+SDL_atomic_t g_feature_file_head;
+SDL_atomic_t g_feature_file_tail;
+SDL_atomic_t g_feature_written;
+SDL_atomic_t g_feature_dropped;
+SDL_Thread* g_feature_thread = NULL;
+SDL_atomic_t g_feature_running;
+Uint64 g_feature_file_end = 0;   // Analysis thread only, as is the one below; end_sample at which the next file starts; 0 before the first
+FeatureHeader g_feature_layout;  // Header of the newest file
+PerfSeries g_feature_cost_ms;
+
+Uint32 g_crc_table[256];
 
 // Analysis & State
 float g_peak_freq = 0.0f;
 float g_peak_mag = -100.0f;
-BurstState g_burst_state = STATE_QUIET;
-Uint32 g_burst_start_time = 0;
-Uint32 g_quiet_start_time = 0;
+SpectralPeak g_peaks[PEAK_TRACK_COUNT]; // Strongest first
+int g_peak_count = 0;
+PeakTrack g_peak_tracks[PEAK_TRACK_COUNT];
+int g_next_track_id = 1;
+DetectionBand g_bands[MAX_BANDS] = {{.spec = {"Main", MIN_FREQ_TO_DISPLAY, MAX_FREQ_TO_DISPLAY, -40.0f}}};
+int g_band_count = 1;
+Uint32 g_analysis_time_ms = 0; // Sample clock of the last analysed frame
+DurationConfig g_duration_config = {2, {50.0f}, DURATION_DEFAULT_HALF_LIFE_S};
+Uint64 g_duration_ticks = 0; // Performance counter ticks spent classifying events
+Uint32 g_duration_events = 0;
 char g_event_log[MAX_LOG_ENTRIES][100];
 int g_event_log_pos = 0;
 
-// Pattern Analysis
-ClassifiedEvent g_event_history[EVENT_HISTORY_SIZE];
-int g_event_history_count = 0;
-float g_avg_burst_duration = 0;
-float g_avg_silence_duration = 0;
-int g_burst_count = 0;
-int g_silence_count = 0;
-ClassifiedEvent g_detected_pattern[PATTERN_LENGTH];
-int g_pattern_reps = 0;
-
 // Controls
-float g_input_gain_db = 0.0f;
-float g_burst_threshold_db = -40.0f;
+SDL_atomic_t g_input_gain_cdb; // Input gain in hundredths of a dB; set by the UI, read by the audio callback
 int g_is_fullscreen = 1;
 int g_is_paused = 0;
+int g_headless = 0;
+int g_quiet = 0; // Suppress headless event log output
+volatile sig_atomic_t g_quit_requested = 0;
+
+// Synthetic Source
+int g_synth_enabled = 0;
+SynthConfig g_synth_config = {1, 1.0f, -70.0f, 1.0f, 0};
+SDL_Thread* g_synth_thread = NULL;
+SDL_atomic_t g_synth_stop;
+SDL_atomic_t g_synth_done;
+SDL_atomic_t g_synth_paused;
 
-// FFT work arrays
+// Network Export
+int g_export_enabled = 0;
+ExportTransport g_export_transport = TRANSPORT_UDP;
+char g_export_host[128] = "127.0.0.1";
+int g_export_port = 9000;
+Uint64 g_export_session_start = 0;
+ExportQueue g_export_audio_queue;    // Producer: audio callback
+ExportQueue g_export_analysis_queue; // Producer: main thread analysis
+SDL_Thread* g_export_thread = NULL;
+SDL_atomic_t g_export_running;
+SDL_atomic_t g_export_connected;
+SDL_atomic_t g_export_dropped;
+SDL_atomic_t g_export_frames_sent;
+SDL_atomic_t g_export_frames_spilled;
+SDL_atomic_t g_export_spill_dropped;
+SDL_atomic_t g_export_frames_lost; // UDP datagrams whose send failed
+SDL_atomic_t g_export_reconnects;
+
+// Work arrays for the generic Ooura path, which --bench-fft compares the
+// generated codelets against.
 int g_fft_ip[FFT_SIZE + 2];
 // Ooura's FFT requires a work array of size n*5/4, where n is the value
 // passed to cdft(). We call cdft() with n = FFT_SIZE * 2, so allocate
@@ -116,23 +1000,186 @@ double g_fft_w[FFT_SIZE * 5 / 2];
 
 // --- Function Prototypes ---
 int init();
+int init_display();
 void cleanup();
+void report_error(const char* title, const char* message);
+int start_capture();
+int open_capture_device();
+void set_latency_profile(LatencyProfile profile);
+Uint32 analysis_wake_ms();
+void update_latency_stats();
+void stop_capture();
+void set_capture_paused(int paused);
+int start_synth();
+void stop_synth();
+int synth_thread(void* data);
+void synth_init(SynthState* st, const SynthConfig* cfg);
+void synth_start_event(SynthState* st, const SynthConfig* cfg, SynthEventKind kind);
+void synth_start_syllable(SynthState* st);
+Uint32 synth_ms(float ms);
+float synth_uniform(SynthState* st);
+float synth_next_sample(SynthState* st, const SynthConfig* cfg);
+void run_headless_loop();
+void reset_analysis_state();
+int run_capacity(int channels, float trial_seconds, float latency_budget_ms);
+void perf_series_add(PerfSeries* series, float value);
+int sdft_init(SlidingDft* d, int window, float threshold_db);
+void sdft_reset(SlidingDft* d);
+void sdft_process(SlidingDft* d, const Sint16* samples, int count, float linear_gain);
+float perf_series_percentile(const PerfSeries* series, float pct);
 void audio_callback(void* userdata, Uint8* stream, int len);
 void process_fft();
+void fft_plan_execute(FftPlan* plan, const double* frame);
+void fft_power(const double* spectrum, double* power, int n);
+void fft_batch_execute(FftPlan* plan, const double* const* frames, int count, int stride, const float* window,
+                       double* const* power);
+void fft_catch_up();
+int run_batch_benchmark(int frames);
+void vad_features(const VadState* vad, const FftPlan* plan, const double* frame, const double* power, VadFeatures* f);
+int vad_is_speech(const VadState* vad, const VadFeatures* f);
+VadTransition vad_update(VadState* vad, const VadFeatures* f, float hop_ms, Uint32 frame_start);
+void vad_reset(VadState* vad);
+void tdoa_separate(double* spectrum, double* spectrum_b, int n);
+void tdoa_accumulate(TdoaState* t, const double* a, const double* b, int n, int min_bin, int max_bin);
+double tdoa_correlation(const TdoaState* t, double lag);
+int tdoa_estimate(TdoaState* t, float spacing_m, TdoaResult* out);
+void tdoa_reset(TdoaState* t);
+double tdoa_test_signal(const TdoaTestBurst* burst, double t);
+int run_tdoa_test(int trials);
+float survey_fast_db(float power);
+void survey_reset(SurveyState* s, const FftPlan* plan, Uint64 end_sample);
+void survey_add(SurveyState* s, const FftPlan* plan, const double* power, Uint64 end_sample);
+float survey_quantile_db(const SurveyState* s, int bin, float q);
+int survey_export(const SurveyState* s, const char* path);
+void poll_survey();
+void vad_eval_sample(VadEval* ev, float v);
+int run_vad_eval(int clips);
+float interpolate_peak(const double* mag_db, int bin, float* peak_db);
+void find_spectral_peaks(const double* mag_db, int min_bin, int max_bin, float bin_size_hz, float floor_db);
+void update_peak_tracks(Uint32 now_ms);
+const char* window_name(WindowType type);
+int parse_config_setting(const char* key, const char* value, FftConfig* config, BandSpec* bands, int* band_count,
+                         DurationConfig* durations);
+double window_value(WindowType type, int j, int size);
+int fft_config_equal(const FftConfig* a, const FftConfig* b);
+int fft_plan_build(FftPlan* plan, const FftConfig* config);
+void fft_plan_free(FftPlan* plan);
+FftPlan* fft_plan_slot();
+void free_fft_plans();
+void apply_fft_config();
+void set_fft_config(const FftConfig* config);
+int load_config_file(const char* path, FftConfig* config, BandSpec* bands, int* band_count,
+                     DurationConfig* durations);
+int read_config_file(int required);
+void poll_config_file();
 void run_main_loop();
 void handle_input(SDL_Event* e, int* is_running);
 void render(int has_new_data);
 void render_text_clipped(const char* text, int x, int y, int max_width, TTF_Font* font, SDL_Color color);
 void add_log_entry(const char* entry);
-void add_classified_event(EventType type, float duration);
-void analyze_patterns();
-void start_recording();
-void stop_recording();
-void write_wav_header(FILE* file, unsigned int data_size);
+void bus_init();
+int bus_post(const BusMessage* message);
+void bus_post_text(const char* text);
+int bus_take(BusMessage* out);
+void bus_drain();
+float input_gain_db();
+void set_input_gain_db(float db);
+int duration_bucket(float duration_s);
+void duration_sketch_add(DurationSketch* s, float duration_s, Uint32 now_ms, float half_life_s);
+double duration_sketch_rank(const DurationSketch* s, float duration_s);
+float duration_sketch_quantile(const DurationSketch* s, float q);
+int classify_duration(const DurationSketch* s, float duration_s);
+char duration_class_char(int duration_class, int classes);
+void format_duration_cuts(const DurationSketch* s, char* out, size_t size);
+void set_duration_config(const DurationConfig* config);
+void add_classified_event(DetectionBand* band, EventType type, float duration, Uint32 now_ms);
+void analyze_patterns(DetectionBand* band);
+void band_bins(const BandSpec* spec, int fft_size, int* min_bin, int* max_bin);
+void update_band(int index, const double* mag_db, const double* prefix, int fft_size, Uint32 now_ms);
+void reset_band(DetectionBand* band);
+void set_extra_bands(const BandSpec* specs, int count);
+void format_pattern(const DetectionBand* band, const char* separator, char* out, size_t size);
+void start_recording(Uint32 index);
+void stop_recording(Uint32 index);
+void write_wav_header(FILE* file, unsigned int sample_rate, unsigned int data_size);
+void record_push_sample(Sint16 sample);
+int start_writer();
+void stop_writer();
+int writer_thread(void* data);
+void crc32_init();
+Uint32 crc32_update(Uint32 crc, const Uint8* data, size_t len);
+int evpc_begin(EvpcEncoder* enc, FILE* file, Uint32 sample_rate);
+void evpc_append(EvpcEncoder* enc, const Sint16* samples, int count);
+void evpc_finish(EvpcEncoder* enc);
+int evpc_encode_block(const Sint16* samples, int count, Uint32 block_index, Uint32 first_sample, Uint8* out);
+int evpc_decode_file(const char* path, FILE* wav_out, EvpcDecodeStats* stats);
+int read_wav_pcm16(const char* path, Sint16** samples, Uint32* count, Uint32* sample_rate);
+int read_wav_pcm16_file(FILE* in, Sint16** samples, Uint32* count, Uint32* sample_rate);
+int load_recording(const char* path, Sint16** samples, Uint32* count, Uint32* sample_rate);
+int map_file(const char* path, MappedFile* m);
+void unmap_file(MappedFile* m);
+int fp_extract(const Sint16* samples, Uint32 count, FpHash** hashes, int* hash_count);
+int fp_fingerprint_file(const char* path, FpHash** hashes, int* hash_count, double* seconds);
+int compare_fp_postings(const void* a, const void* b);
+int fp_log_add(FpIndex* index, const char* name, const FpHash* hashes, int count);
+int fp_index_open(FpIndex* index, const char* base);
+void fp_index_close(FpIndex* index);
+const char* fp_recording_name(const FpIndex* index, Uint32 recording);
+int fp_index_contains(const FpIndex* index, const char* name);
+int fp_index_append(FpIndex* index, const char* name, const FpHash* hashes, int count);
+int fp_index_merge(FpIndex* index);
+void fp_lookup(const FpIndex* index, Uint32 hash, Uint32* begin, Uint32* end, int* log_begin, int* log_end);
+Uint32 fp_vote_slot(const Uint32* keys, Uint32 slots, Uint32 key);
+int compare_fp_matches(const void* a, const void* b);
+int fp_index_query(FpIndex* index, const FpHash* hashes, int count, FpMatch* matches, int max_matches);
+void fp_queue_recording(const char* filename);
+int fp_indexer_thread(void* data);
+int start_indexer();
+void stop_indexer();
+void feature_spectrum(const FftPlan* plan, const double* power, float* centroid_hz, float* flatness);
+int feature_layout_changed();
+int feature_start_file(Uint64 end_sample, Uint32 sequence);
+void feature_push(const FftPlan* plan, const double* power, const VadFeatures* vad_f, Uint64 end_sample,
+                  Uint32 sequence);
+FILE* feature_open(const FeatureHeader* header, char* path, size_t path_size, char* buffer);
+int feature_writer_thread(void* data);
+int start_feature_writer();
+void stop_feature_writer();
+int run_features_stats(const char* path);
+int run_index_add(char** paths, int count);
+int run_index_query(const char* path);
+int run_encode_tool(const char* in_path, const char* out_path);
+int run_decode_tool(const char* in_path, const char* out_path);
+void put_le16(Uint8* p, Uint16 v);
+void put_le32(Uint8* p, Uint32 v);
+Uint16 get_le16(const Uint8* p);
+Uint32 get_le32(const Uint8* p);
+int parse_endpoint(const char* spec, ExportTransport* transport, char* host, size_t host_size, int* port);
+int net_startup();
+void net_shutdown();
+int start_exporter();
+void stop_exporter();
+void export_push(ExportQueue* q, ExportRecordType type, int band, int duration_class, float value, float freq_hz);
+int exporter_thread(void* data);
+int run_collector(ExportTransport transport, int port, int max_frames);
+const char* monitor_mode_name(MonitorMode mode);
+void biquad_design(Biquad* f, int highpass, float cutoff_hz, float q);
+void biquad_process(Biquad* f, float* x, int count);
+void monitor_configure(MonitorDsp* dsp, MonitorMode mode, int lo_hz);
+void monitor_process(MonitorDsp* dsp, float* x, int count);
+void playback_callback(void* userdata, Uint8* stream, int len);
+int start_monitor();
+void stop_monitor();
+void set_monitor_mode(MonitorMode mode);
+int run_expand_tool(const char* in_path, int factor, const char* out_path);
+void handle_sigint(int sig);
+int run_fft_benchmark(int iterations);
+void print_usage(const char* program);
 
 // --- FFT Function Prototypes ---
 void makewt(int nw, int *ip, double *w);
 void bitrv2(int n, int *ip, double *a);
+void bitrv2conj(int n, int *ip, double *a);
 void cftfsub(int n, double *a, double *w);
 void cftbsub(int n, double *a, double *w);
 void cft1st(int n, double *a, double *w);
@@ -141,6 +1188,222 @@ void cftmdl(int n, int l, double *a, double *w);
 
 // --- Main Function ---
 int main(int argc, char* argv[]) {
+    int collector_mode = 0;
+    ExportTransport collector_transport = TRANSPORT_UDP;
+    int collector_port = 0;
+    int collector_max_frames = 0;
+    int capacity_channels = 0;
+    float trial_seconds = 2.0f;
+    float latency_budget_ms = 20.0f;
+    int config_required = 0;
+    const char* expand_path = NULL;
+    const char* expand_out = NULL;
+    int expand_factor = EXPAND_DEFAULT_FACTOR;
+    int vad_eval_clips = 0;
+    int tdoa_test_trials = 0;
+    int fft_bench_iterations = 0;
+    int batch_bench_frames = 0;
+    char** index_add_paths = NULL;
+    int index_add_count = 0;
+    const char* index_query_path = NULL;
+    const char* features_stats_path = NULL;
+
+    crc32_init();
+    bus_init();
+    SDL_AtomicSet(&g_monitor_lo_hz, MONITOR_DEFAULT_LO_HZ);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--net") == 0 && i + 1 < argc) {
+            if (parse_endpoint(argv[++i], &g_export_transport, g_export_host, sizeof(g_export_host), &g_export_port) != 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            g_export_enabled = 1;
+        } else if (strcmp(argv[i], "--collector") == 0 && i + 1 < argc) {
+            if (parse_endpoint(argv[++i], &collector_transport, NULL, 0, &collector_port) != 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            collector_mode = 1;
+        } else if (strcmp(argv[i], "--max-frames") == 0 && i + 1 < argc) {
+            collector_max_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--wav") == 0) {
+            g_record_format = RECORD_FORMAT_WAV;
+        } else if (strcmp(argv[i], "--encode") == 0 && i + 2 < argc) {
+            return run_encode_tool(argv[i + 1], argv[i + 2]);
+        } else if (strcmp(argv[i], "--decode") == 0 && i + 2 < argc) {
+            return run_decode_tool(argv[i + 1], argv[i + 2]);
+        } else if (strcmp(argv[i], "--verify") == 0 && i + 1 < argc) {
+            return run_decode_tool(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            g_headless = 1;
+        } else if (strcmp(argv[i], "--no-record") == 0) {
+            g_record_enabled = 0;
+        } else if (strcmp(argv[i], "--synthetic") == 0) {
+            g_synth_enabled = 1;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            g_synth_config.seed = (Uint32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--synth-rate") == 0 && i + 1 < argc) {
+            g_synth_config.event_rate = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--synth-noise") == 0 && i + 1 < argc) {
+            g_synth_config.noise_db = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            g_synth_config.speed = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            g_synth_config.duration_samples = (Uint32)(atof(argv[++i]) * SAMPLE_RATE);
+        } else if (strcmp(argv[i], "--sdft") == 0) {
+            g_sdft_enabled = 1;
+        } else if (strcmp(argv[i], "--sdft-window") == 0 && i + 1 < argc) {
+            g_sdft_window = atoi(argv[++i]);
+            g_sdft_enabled = 1;
+        } else if (strcmp(argv[i], "--sdft-threshold") == 0 && i + 1 < argc) {
+            g_sdft_threshold_db = (float)atof(argv[++i]);
+            g_sdft_enabled = 1;
+        } else if (strcmp(argv[i], "--bench-fft") == 0) {
+            fft_bench_iterations =
+                i + 1 < argc && argv[i + 1][0] != '-' ? atoi(argv[++i]) : FFT_BENCH_DEFAULT_ITERATIONS;
+        } else if (strcmp(argv[i], "--bench-batch") == 0) {
+            batch_bench_frames = i + 1 < argc && argv[i + 1][0] != '-' ? atoi(argv[++i]) : 256;
+        } else if (strcmp(argv[i], "--monitor") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "het") == 0) {
+                SDL_AtomicSet(&g_monitor_mode, MONITOR_HETERODYNE);
+            } else if (strcmp(argv[i], "div") == 0) {
+                SDL_AtomicSet(&g_monitor_mode, MONITOR_DIVIDER);
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--monitor-lo") == 0 && i + 1 < argc) {
+            int lo_hz = atoi(argv[++i]);
+            if (lo_hz < MONITOR_MIN_LO_HZ || lo_hz > MONITOR_MAX_LO_HZ) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            SDL_AtomicSet(&g_monitor_lo_hz, lo_hz);
+        } else if (strcmp(argv[i], "--divide") == 0 && i + 1 < argc) {
+            g_monitor_divide = atoi(argv[++i]);
+            if (g_monitor_divide < 2 || g_monitor_divide % 2) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            i++;
+            int p;
+            for (p = 0; p < LATENCY_PROFILE_COUNT; p++) {
+                if (strcmp(argv[i], g_latency_profiles[p].name) == 0) break;
+            }
+            if (p == LATENCY_PROFILE_COUNT) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            g_latency_profile = (LatencyProfile)p;
+            g_fft_config.overlap = g_latency_profiles[p].overlap; // The config file may still override it
+        } else if (strcmp(argv[i], "--tdoa") == 0 && i + 1 < argc) {
+            g_tdoa_spacing_m = (float)atof(argv[++i]);
+            if (g_tdoa_spacing_m <= 0.0f || g_tdoa_spacing_m * SAMPLE_RATE / TDOA_SPEED_OF_SOUND >= TDOA_MAX_LAG) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            g_tdoa_enabled = 1;
+            g_capture_channels = 2;
+        } else if (strcmp(argv[i], "--synth-delay") == 0 && i + 1 < argc) {
+            g_tdoa_synth_delay_us = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--tdoa-test") == 0) {
+            tdoa_test_trials = i + 1 < argc && argv[i + 1][0] != '-' ? atoi(argv[++i]) : TDOA_TEST_DEFAULT_TRIALS;
+        } else if (strcmp(argv[i], "--survey") == 0) {
+            g_survey_enabled = 1;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                g_survey_period_s = (float)atof(argv[++i]);
+                if (g_survey_period_s <= 0.0f) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+            }
+        } else if (strcmp(argv[i], "--survey-out") == 0 && i + 1 < argc) {
+            snprintf(g_survey_path, sizeof(g_survey_path), "%s", argv[++i]);
+            g_survey_enabled = 1;
+        } else if (strcmp(argv[i], "--features") == 0) {
+            g_features_enabled = 1;
+        } else if (strcmp(argv[i], "--features-stats") == 0 && i + 1 < argc) {
+            features_stats_path = argv[++i];
+        } else if (strcmp(argv[i], "--index") == 0) {
+            g_fp_enabled = 1;
+        } else if (strcmp(argv[i], "--index-base") == 0 && i + 1 < argc) {
+            snprintf(g_fp_base, sizeof(g_fp_base), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--index-add") == 0 && i + 1 < argc) {
+            index_add_paths = argv + i + 1;
+            while (i + 1 < argc && argv[i + 1][0] != '-') {
+                i++;
+                index_add_count++;
+            }
+        } else if (strcmp(argv[i], "--index-query") == 0 && i + 1 < argc) {
+            index_query_path = argv[++i];
+        } else if (strcmp(argv[i], "--vad-eval") == 0) {
+            vad_eval_clips = i + 1 < argc && argv[i + 1][0] != '-' ? atoi(argv[++i]) : VAD_EVAL_DEFAULT_CLIPS;
+        } else if (strcmp(argv[i], "--expand") == 0 && i + 1 < argc) {
+            expand_path = argv[++i];
+        } else if (strcmp(argv[i], "--expand-factor") == 0 && i + 1 < argc) {
+            expand_factor = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--expand-out") == 0 && i + 1 < argc) {
+            expand_out = argv[++i];
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            snprintf(g_config_path, sizeof(g_config_path), "%s", argv[++i]);
+            config_required = 1;
+        } else if (strcmp(argv[i], "--capacity") == 0) {
+            capacity_channels = i + 1 < argc && argv[i + 1][0] != '-' ? atoi(argv[++i]) : 1;
+            if (capacity_channels < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--trial-seconds") == 0 && i + 1 < argc) {
+            trial_seconds = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--latency-budget") == 0 && i + 1 < argc) {
+            latency_budget_ms = (float)atof(argv[++i]);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (g_sdft_enabled && sdft_init(&g_sdft, g_sdft_window, g_sdft_threshold_db) != 0) {
+        fprintf(stderr, "--sdft-window must be %d-%d samples and span at most %d bins of the band\n",
+                SDFT_MIN_WINDOW, SDFT_MAX_WINDOW, SDFT_MAX_BINS);
+        return 1;
+    }
+    if (expand_path) {
+        return run_expand_tool(expand_path, expand_factor, expand_out);
+    }
+    if (index_add_count) {
+        return run_index_add(index_add_paths, index_add_count);
+    }
+    if (index_query_path) {
+        return run_index_query(index_query_path);
+    }
+    if (features_stats_path) {
+        return run_features_stats(features_stats_path);
+    }
+    if (fft_bench_iterations) {
+        return run_fft_benchmark(fft_bench_iterations);
+    }
+    if (read_config_file(config_required) != 0) {
+        return 1;
+    }
+    if (batch_bench_frames) {
+        return run_batch_benchmark(batch_bench_frames);
+    }
+    if (vad_eval_clips) {
+        return run_vad_eval(vad_eval_clips);
+    }
+    if (tdoa_test_trials) {
+        return run_tdoa_test(tdoa_test_trials);
+    }
+    if (collector_mode) {
+        return run_collector(collector_transport, collector_port, collector_max_frames);
+    }
+    if (capacity_channels) {
+        return run_capacity(capacity_channels, trial_seconds, latency_budget_ms);
+    }
+
     if (init() != 0) {
         cleanup();
         return 1;
@@ -150,14 +1413,106 @@ int main(int argc, char* argv[]) {
     return 0;
 }
 
+void print_usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  --net udp|tcp:HOST:PORT     stream detected events to a collector\n");
+    fprintf(stderr, "  --collector udp|tcp:PORT    run a local collector that prints received frames\n");
+    fprintf(stderr, "  --max-frames N              stop the collector after N frames\n");
+    fprintf(stderr, "  --wav                       record EVPs as raw WAV instead of compressed EVPC\n");
+    fprintf(stderr, "  --encode IN.wav OUT.evpc    compress an existing 16-bit mono recording\n");
+    fprintf(stderr, "  --decode IN.evpc OUT.wav    decompress a recording to WAV\n");
+    fprintf(stderr, "  --verify IN.evpc            check block integrity and report compression\n");
+    fprintf(stderr, "  --headless                  run without a window, logging events to stdout\n");
+    fprintf(stderr, "  --no-record                 detect EVPs but do not write recordings\n");
+    fprintf(stderr, "  --synthetic                 replace the capture device with a synthetic source\n");
+    fprintf(stderr, "  --seed N                    synthetic source random seed (default 1)\n");
+    fprintf(stderr, "  --synth-rate R              synthetic events per second (default 1.0)\n");
+    fprintf(stderr, "  --synth-noise DB            synthetic background noise in dBFS (default -70)\n");
+    fprintf(stderr, "  --speed X                   synthetic playback speed, 0 = unthrottled (default 1)\n");
+    fprintf(stderr, "  --duration S                stop after S seconds of synthetic audio\n");
+    fprintf(stderr, "  --sdft                      per-sample sliding-DFT burst detector for sub-ms onsets\n");
+    fprintf(stderr, "  --sdft-window N             sliding-DFT window in samples (default %d)\n", SDFT_DEFAULT_WINDOW);
+    fprintf(stderr, "  --sdft-threshold DB         sliding-DFT onset level in dBFS (default -45)\n");
+    fprintf(stderr, "  --bench-fft [N]             time N generated-codelet vs generic Ooura transforms (default %d)\n",
+            FFT_BENCH_DEFAULT_ITERATIONS);
+    fprintf(stderr, "  --bench-batch [N]           time N frames batched vs one transform each (default 256)\n");
+    fprintf(stderr, "  --monitor het|div           play the ultrasonic band audibly: heterodyne or frequency divider\n");
+    fprintf(stderr, "  --monitor-lo HZ             heterodyne LO / divider lower edge, %d-%d (default %d)\n",
+            MONITOR_MIN_LO_HZ, MONITOR_MAX_LO_HZ, MONITOR_DEFAULT_LO_HZ);
+    fprintf(stderr, "  --divide N                  frequency divider ratio, even (default %d)\n", MONITOR_DEFAULT_DIVIDE);
+    fprintf(stderr, "  --latency PROFILE           low-latency | balanced | power-save (default balanced)\n");
+    fprintf(stderr, "  --tdoa SPACING              capture two microphones SPACING metres apart and log burst bearings\n");
+    fprintf(stderr, "  --synth-delay US            delay of the synthetic second channel (default %.0f)\n",
+            TDOA_DEFAULT_SYNTH_DELAY_US);
+    fprintf(stderr, "  --tdoa-test [N]             score delay estimates on N synthetic delayed bursts (default %d)\n",
+            TDOA_TEST_DEFAULT_TRIALS);
+    fprintf(stderr, "  --survey [S]                average the spectrum over the whole run, snapshot every S s (default %.0f)\n",
+            SURVEY_DEFAULT_PERIOD_S);
+    fprintf(stderr, "  --survey-out FILE           survey snapshot CSV (default %s)\n", SURVEY_DEFAULT_FILE);
+    fprintf(stderr, "  --features                  write every hop's features to feat_*.pfs for offline analysis\n");
+    fprintf(stderr, "  --features-stats FILE       summarise a feature file read in place\n");
+    fprintf(stderr, "  --index                     fingerprint each saved recording in the background and report matches\n");
+    fprintf(stderr, "  --index-base BASE           fingerprint index files BASE.idx and BASE.log (default %s)\n", FP_DEFAULT_BASE);
+    fprintf(stderr, "  --index-add FILE...         add existing WAV/EVPC recordings to the fingerprint index\n");
+    fprintf(stderr, "  --index-query FILE          list indexed recordings that match FILE\n");
+    fprintf(stderr, "  --vad-eval [N]              score voice detection on N labelled synthetic clips (default %d)\n",
+            VAD_EVAL_DEFAULT_CLIPS);
+    fprintf(stderr, "  --expand IN                 play a WAV/EVPC recording time-expanded\n");
+    fprintf(stderr, "  --expand-factor N           time-expansion factor (default %d)\n", EXPAND_DEFAULT_FACTOR);
+    fprintf(stderr, "  --expand-out OUT.wav        write the time-expanded recording instead of playing it\n");
+    fprintf(stderr, "  --config FILE               FFT size/window/overlap settings, reloaded on change (default %s)\n", CONFIG_FILE);
+    fprintf(stderr, "  --capacity [N]              find the sustainable channels and the largest FFT size, overlap and\n");
+    fprintf(stderr, "                              band count for N channels (default 1)\n");
+    fprintf(stderr, "  --trial-seconds S           wall-clock seconds per capacity trial (default 2)\n");
+    fprintf(stderr, "  --latency-budget MS         p99 analysis latency allowed per hop (default 20)\n");
+}
+
 // --- Initialization and Cleanup ---
 
 int init() {
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0 || TTF_Init() == -1) {
-        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", "SDL or TTF could not initialize!", NULL);
+    Uint32 subsystems = (g_headless ? 0 : SDL_INIT_VIDEO) |
+                        (g_synth_enabled && !SDL_AtomicGet(&g_monitor_mode) ? 0 : SDL_INIT_AUDIO);
+    if (SDL_Init(subsystems) < 0 || (!g_headless && TTF_Init() == -1)) {
+        report_error("Error", "SDL or TTF could not initialize!");
+        return 1;
+    }
+    if (!g_headless && init_display() != 0) {
+        return 1;
+    }
+
+    g_fft_sem = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&g_wake_on_frame, g_headless || g_latency_profiles[g_latency_profile].wake_ms == 0);
+    g_capture_samples = g_latency_profiles[g_latency_profile].device_samples;
+    if (g_fp_enabled && g_record_enabled && start_indexer() != 0) {
+        g_fp_enabled = 0;
+        add_log_entry("Fingerprint index unavailable; not indexing.");
+    }
+    if (g_features_enabled && start_feature_writer() != 0) {
+        g_features_enabled = 0;
+        add_log_entry("Feature stream failed to start.");
+    }
+    if (!g_fft_sem || start_writer() != 0) {
+        report_error("Error", "Failed to start the EVP writer thread!");
+        return 1;
+    }
+    g_fft_ip[0] = 0;
+    SDL_AtomicSet(&g_fft_ready, 0);
+    apply_fft_config();
+    if (!SDL_AtomicGetPtr(&g_pending_plan)) {
+        report_error("Error", "Failed to allocate the FFT plan!");
         return 1;
     }
+    add_log_entry("System online. Monitoring...");
+    if (g_export_enabled && start_exporter() != 0) {
+        add_log_entry("Network export failed to start.");
+    }
+    if (SDL_AtomicGet(&g_monitor_mode) != MONITOR_OFF) {
+        set_monitor_mode((MonitorMode)SDL_AtomicGet(&g_monitor_mode));
+    }
+    return start_capture();
+}
 
+int init_display() {
     g_window = SDL_CreateWindow("Paranormal Audio Research Console", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
     g_renderer = SDL_CreateRenderer(g_window, -1, SDL_RENDERER_ACCELERATED);
     if (!g_window || !g_renderer) {
@@ -205,266 +1560,5207 @@ int init() {
         return 1;
     }
 
+    return 0;
+}
+
+void report_error(const char* title, const char* message) {
+    if (g_headless) {
+        fprintf(stderr, "%s: %s\n", title, message);
+    } else {
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, title, message, g_window);
+    }
+}
+
+int start_capture() {
+    if (g_synth_enabled) {
+        if (start_synth() != 0) {
+            report_error("Audio Error", "Failed to start the synthetic source!");
+            return 1;
+        }
+        add_log_entry("Synthetic source active.");
+        return 0;
+    }
+
+    if (open_capture_device() != 0) {
+        report_error("Audio Error", "Failed to open audio device!");
+        return 1;
+    }
+    SDL_PauseAudioDevice(g_audio_device_id, 0);
+    return 0;
+}
+
+// Opens the capture device with the latency profile's buffer size, paused.
+// SDL converts rate, format and channels for us, but the buffer is taken as
+// the device grants it, since that is the latency actually paid.
+int open_capture_device() {
     SDL_AudioSpec want, have;
     SDL_zero(want);
     want.freq = SAMPLE_RATE;
     want.format = AUDIO_S16SYS;
-    want.channels = 1;
-    want.samples = 512;
+    want.channels = (Uint8)g_capture_channels;
+    want.samples = (Uint16)g_latency_profiles[g_latency_profile].device_samples;
     want.callback = audio_callback;
 
-    g_audio_device_id = SDL_OpenAudioDevice(NULL, 1, &want, &have, 0);
+    g_audio_device_id = SDL_OpenAudioDevice(NULL, 1, &want, &have, SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
     if (g_audio_device_id == 0) {
-        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Audio Error", "Failed to open audio device!", g_window);
-        return 1;
+        SDL_Log("Failed to open capture device: %s", SDL_GetError());
+        return -1;
     }
-    g_fft_ip[0] = 0;
-    SDL_AtomicSet(&g_fft_ready, 0);
-    g_quiet_start_time = SDL_GetTicks();
-    add_log_entry("System online. Monitoring...");
-    SDL_PauseAudioDevice(g_audio_device_id, 0);
+    g_capture_samples = have.samples;
+    g_capture_ticks_per_sample = (double)SDL_GetPerformanceFrequency() / SAMPLE_RATE;
+    char log[100];
+    snprintf(log, sizeof(log), "Capture buffer %d samples (%.1f ms)%s", have.samples,
+             1000.0f * have.samples / SAMPLE_RATE, have.samples != want.samples ? ", adjusted by the device" : "");
+    add_log_entry(log);
     return 0;
 }
 
+// Switches profile: the hop through the FFT overlap, the capture buffer by
+// reopening the device, and the analysis and display wake-ups.
+void set_latency_profile(LatencyProfile profile) {
+    const LatencyProfileSpec* spec = &g_latency_profiles[profile];
+    g_latency_profile = profile;
+    SDL_AtomicSet(&g_wake_on_frame, g_headless || spec->wake_ms == 0);
+    FftConfig config = g_fft_config;
+    config.overlap = spec->overlap;
+    set_fft_config(&config);
+    if (g_synth_enabled) {
+        g_capture_samples = spec->device_samples;
+    } else if (g_audio_device_id != 0) {
+        SDL_CloseAudioDevice(g_audio_device_id);
+        g_audio_device_id = 0;
+        if (open_capture_device() != 0) {
+            add_log_entry("Capture device lost while changing latency profile!");
+            return;
+        }
+        SDL_PauseAudioDevice(g_audio_device_id, g_is_paused);
+    }
+    memset(&g_capture_wait_ms, 0, sizeof(g_capture_wait_ms));
+    memset(&g_detect_latency_ms, 0, sizeof(g_detect_latency_ms));
+    memset(&g_display_latency_ms, 0, sizeof(g_display_latency_ms));
+    g_latency_stats_time = 0;
+
+    char log[100];
+    snprintf(log, sizeof(log), "Latency profile: %s", spec->name);
+    add_log_entry(log);
+}
+
+// How long analysis may sleep: the profile's period, but never so long that
+// the frame queue could fill.
+Uint32 analysis_wake_ms() {
+    const LatencyProfileSpec* spec = &g_latency_profiles[g_latency_profile];
+    FftPlan* plan = (FftPlan*)SDL_AtomicGetPtr(&g_pending_plan);
+    Uint32 limit = plan ? (Uint32)(1000.0 * plan->hop * (FFT_FRAME_SLOTS / 2) / SAMPLE_RATE) : 100;
+    Uint32 wake = spec->wake_ms ? (Uint32)spec->wake_ms : 100;
+    return wake < limit ? wake : limit;
+}
+
+void update_latency_stats() {
+    Uint32 now = SDL_GetTicks();
+    if (g_latency_stats_time && now - g_latency_stats_time < LATENCY_STATS_MS) return;
+    g_latency_stats_time = now;
+    g_latency_stats[0] = perf_series_percentile(&g_display_latency_ms, 50.0f);
+    g_latency_stats[1] = perf_series_percentile(&g_display_latency_ms, 95.0f);
+    g_latency_stats[2] = perf_series_percentile(&g_display_latency_ms, 99.0f);
+}
+
+// Stops whichever source feeds audio_callback. Afterwards no other thread
+// produces into the record ring or the export queue.
+void stop_capture() {
+    if (g_audio_device_id != 0) {
+        SDL_CloseAudioDevice(g_audio_device_id);
+        g_audio_device_id = 0;
+    }
+    stop_synth();
+}
+
+void set_capture_paused(int paused) {
+    if (g_synth_enabled) {
+        SDL_AtomicSet(&g_synth_paused, paused);
+    } else {
+        SDL_PauseAudioDevice(g_audio_device_id, paused);
+    }
+    if (g_playback_device_id != 0) {
+        SDL_PauseAudioDevice(g_playback_device_id, paused || SDL_AtomicGet(&g_monitor_mode) == MONITOR_OFF);
+    }
+}
+
 void cleanup() {
-    stop_recording();
-    if (g_audio_device_id != 0) SDL_CloseAudioDevice(g_audio_device_id);
+    stop_capture();
+    stop_monitor();
+    stop_recording((Uint32)SDL_AtomicGet(&g_record_ring_head));
+    stop_writer();
+    stop_indexer();
+    stop_feature_writer();
+    stop_exporter();
+    bus_drain(); // The writer threads' and indexer's last messages
+    if (g_survey_enabled && g_survey.hops && survey_export(&g_survey, g_survey_path) == 0) {
+        SDL_Log("Survey of %.0f s written to %s", (double)(g_survey.last_sample - g_survey.first_sample) / SAMPLE_RATE,
+                g_survey_path);
+    }
     if (g_font_medium) TTF_CloseFont(g_font_medium);
     if (g_font_small) TTF_CloseFont(g_font_small);
     if (g_waterfall_texture) SDL_DestroyTexture(g_waterfall_texture);
     if (g_temp_texture) SDL_DestroyTexture(g_temp_texture);
     if (g_renderer) SDL_DestroyRenderer(g_renderer);
     if (g_window) SDL_DestroyWindow(g_window);
+    if (g_fft_sem) SDL_DestroySemaphore(g_fft_sem);
+    free_fft_plans();
     TTF_Quit();
     SDL_Quit();
 }
 
-// --- Audio, FFT, and Analysis Logic ---
-
-void audio_callback(void* userdata, Uint8* stream, int len) {
-    Sint16* samples = (Sint16*)stream;
-    int num_samples = len / sizeof(Sint16);
-    float linear_gain = powf(10.0f, g_input_gain_db / 20.0f);
-
-    for (int i = 0; i < num_samples; i++) {
-        if (g_audio_buffer_pos < FFT_SIZE) {
-            float sample_with_gain = (float)samples[i] * linear_gain;
-            sample_with_gain = fmaxf(-32767.0f, fminf(32767.0f, sample_with_gain));
-            float normalized = sample_with_gain / 32768.0f;
-
-            if (fabsf(normalized) > VOICE_THRESHOLD) {
-                if (!g_is_recording) {
-                    start_recording();
-                }
-                g_silence_counter = 0;
-            } else if (g_is_recording) {
-                g_silence_counter++;
-                if (g_silence_counter > SILENCE_HANG) {
-                    stop_recording();
-                }
-            }
+// --- Audio, FFT, and Analysis Logic ---
+
+void audio_callback(void* userdata, Uint8* stream, int len) {
+    Uint64 callback_ticks = SDL_GetPerformanceCounter();
+    Sint16* samples = (Sint16*)stream;
+    int num_samples = len / (int)(sizeof(Sint16) * g_capture_channels);
+    float linear_gain = powf(10.0f, SDL_AtomicGet(&g_input_gain_cdb) / 2000.0f);
+
+    if (g_capture_channels == 2) {
+        // The second microphone only feeds the localization frames; the
+        // first is packed down in place and takes the mono path below.
+        for (int i = 0; i < num_samples; i++) {
+            float b = fmaxf(-32767.0f, fminf(32767.0f, (float)samples[i * 2 + 1] * linear_gain));
+            g_audio_history_b[(g_samples_captured + i) & (FFT_HISTORY_SIZE - 1)] = b / 32768.0f;
+            samples[i] = samples[i * 2];
+        }
+    }
+
+    // Configuration changes take effect at a callback boundary.
+    FftPlan* plan = (FftPlan*)SDL_AtomicGetPtr(&g_pending_plan);
+    if (plan != g_audio_plan) {
+        g_audio_plan = plan;
+        SDL_AtomicSetPtr(&g_active_plan, plan);
+    }
+
+    if (g_sdft_enabled) {
+        sdft_process(&g_sdft, samples, num_samples, linear_gain);
+    }
+
+    int monitoring = SDL_AtomicGet(&g_monitor_mode) != MONITOR_OFF;
+    Uint32 monitor_head = (Uint32)SDL_AtomicGet(&g_monitor_ring_head);
+    Uint32 monitor_space = MONITOR_RING_SIZE - (monitor_head - (Uint32)SDL_AtomicGet(&g_monitor_ring_tail));
+
+    for (int i = 0; i < num_samples; i++) {
+        float sample_with_gain = (float)samples[i] * linear_gain;
+        sample_with_gain = fmaxf(-32767.0f, fminf(32767.0f, sample_with_gain));
+        float normalized = sample_with_gain / 32768.0f;
+
+        record_push_sample((Sint16)(normalized * 32767));
+        if (monitoring) {
+            if (monitor_space > 0) {
+                g_monitor_ring[monitor_head++ & (MONITOR_RING_SIZE - 1)] = normalized;
+                monitor_space--;
+            } else {
+                SDL_AtomicAdd(&g_monitor_overruns, 1);
+            }
+        }
+
+        g_audio_history[g_samples_captured & (FFT_HISTORY_SIZE - 1)] = normalized;
+        g_samples_captured++;
+        if (!plan || ++g_hop_fill < plan->hop || g_samples_captured < (Uint64)plan->config.size) continue;
+
+        g_hop_fill = 0;
+        Uint32 hop = g_hop_sequence++;
+        SDL_AtomicAdd(&g_hops_total, 1);
+        if (SDL_AtomicGet(&g_fft_ready) < FFT_FRAME_SLOTS) {
+            int n = plan->config.size;
+            int slot = g_fft_frame_head;
+            double* frame = plan->frame + (size_t)slot * n * 2;
+            Uint32 start = (Uint32)(g_samples_captured - n);
+            for (int j = 0; j < n; j++) {
+                frame[j * 2] = g_audio_history[(start + j) & (FFT_HISTORY_SIZE - 1)] * plan->window[j];
+                frame[j * 2 + 1] = 0.0;
+            }
+            if (g_capture_channels == 2) {
+                // Second microphone in the imaginary part; see tdoa_separate().
+                for (int j = 0; j < n; j++) {
+                    frame[j * 2 + 1] = g_audio_history_b[(start + j) & (FFT_HISTORY_SIZE - 1)] * plan->window[j];
+                }
+            }
+            g_fft_frames[slot].plan = plan;
+            g_fft_frames[slot].hop = hop;
+            g_fft_frames[slot].end_sample = g_samples_captured;
+            g_fft_frames[slot].record_index = (Uint32)SDL_AtomicGet(&g_record_ring_head);
+            g_fft_frames[slot].arrival_ticks =
+                callback_ticks - (Uint64)((num_samples - 1 - i) * g_capture_ticks_per_sample);
+            g_fft_frames[slot].ticks = SDL_GetPerformanceCounter();
+            g_fft_frame_head = (slot + 1) % FFT_FRAME_SLOTS;
+            SDL_AtomicAdd(&g_fft_ready, 1);
+            if (SDL_AtomicGet(&g_wake_on_frame)) SDL_SemPost(g_fft_sem);
+            g_audio_dropping = 0;
+        } else {
+            // Analysis has fallen FFT_FRAME_SLOTS frames behind. Reported
+            // once per run of drops.
+            int dropped = SDL_AtomicAdd(&g_hops_dropped, 1) + 1;
+            if (!g_audio_dropping) {
+                BusMessage message;
+                message.type = BUS_HOPS_DROPPED;
+                message.data.count = (Uint32)dropped;
+                bus_post(&message);
+                g_audio_dropping = 1;
+            }
+        }
+    }
+
+    if (monitoring) {
+        Uint32 stamp = (Uint32)SDL_AtomicGet(&g_monitor_stamp_head);
+        g_monitor_stamps[stamp % MONITOR_STAMP_QUEUE].end_sample = monitor_head;
+        g_monitor_stamps[stamp % MONITOR_STAMP_QUEUE].ticks = SDL_GetPerformanceCounter();
+        SDL_AtomicSet(&g_monitor_ring_head, (int)monitor_head);
+        SDL_AtomicAdd(&g_monitor_stamp_head, 1);
+    }
+}
+
+int record_post_command(RecordCommandType type, Uint32 sample_index) {
+    Uint32 head = (Uint32)SDL_AtomicGet(&g_record_cmd_head);
+    if (head - (Uint32)SDL_AtomicGet(&g_record_cmd_tail) >= RECORD_CMD_QUEUE_SIZE) return 0;
+    g_record_cmds[head % RECORD_CMD_QUEUE_SIZE].type = type;
+    g_record_cmds[head % RECORD_CMD_QUEUE_SIZE].sample_index = sample_index;
+    SDL_AtomicAdd(&g_record_cmd_head, 1);
+    return 1;
+}
+
+// Called from the audio callback for every captured sample. When the writer
+// falls more than RECORD_RING_SIZE samples behind the sample is dropped and
+// counted rather than waiting on the disk.
+void record_push_sample(Sint16 sample) {
+    Uint32 head = (Uint32)SDL_AtomicGet(&g_record_ring_head);
+    if (head - (Uint32)SDL_AtomicGet(&g_record_ring_tail) >= RECORD_RING_SIZE) {
+        SDL_AtomicAdd(&g_record_overruns, 1);
+        return;
+    }
+    g_record_ring[head & (RECORD_RING_SIZE - 1)] = sample;
+    SDL_AtomicAdd(&g_record_ring_head, 1);
+}
+
+// Starts a recording at the given record ring position, which may be up to
+// RECORD_PREROLL samples in the past. Called from analysis.
+void start_recording(Uint32 index) {
+    Uint32 head = (Uint32)SDL_AtomicGet(&g_record_ring_head);
+    if (head - index > RECORD_PREROLL) index = head - RECORD_PREROLL;
+    if (!record_post_command(RECORD_CMD_START, index)) {
+        return;
+    }
+    g_is_recording = 1;
+    g_record_start_index = index;
+    // With --no-record the writer opens no file, so there is nothing to announce.
+    if (g_record_enabled) export_push(&g_export_analysis_queue, RECORD_RECORDING_START, 0, 0, 0.0f, 0.0f);
+}
+
+void stop_recording(Uint32 index) {
+    if (!g_is_recording) {
+        return;
+    }
+    if (!record_post_command(RECORD_CMD_STOP, index)) {
+        return;
+    }
+    g_is_recording = 0;
+    if (g_record_enabled) {
+        export_push(&g_export_analysis_queue, RECORD_RECORDING_STOP, 0, 0,
+                    (float)(index - g_record_start_index) / SAMPLE_RATE, 0.0f);
+    }
+}
+
+void write_wav_header(FILE* file, unsigned int sample_rate, unsigned int data_size) {
+    unsigned short bits_per_sample = 16;
+    unsigned short channels = 1;
+    unsigned int byte_rate = sample_rate * channels * bits_per_sample / 8;
+    unsigned short block_align = channels * bits_per_sample / 8;
+    unsigned int chunk_size = 36 + data_size;
+
+    fwrite("RIFF", 1, 4, file);
+    fwrite(&chunk_size, 4, 1, file);
+    fwrite("WAVE", 1, 4, file);
+    fwrite("fmt ", 1, 4, file);
+    unsigned int subchunk1_size = 16;
+    unsigned short audio_format = 1;
+    fwrite(&subchunk1_size, 4, 1, file);
+    fwrite(&audio_format, 2, 1, file);
+    fwrite(&channels, 2, 1, file);
+    fwrite(&sample_rate, 4, 1, file);
+    fwrite(&byte_rate, 4, 1, file);
+    fwrite(&block_align, 2, 1, file);
+    fwrite(&bits_per_sample, 2, 1, file);
+    fwrite("data", 1, 4, file);
+    fwrite(&data_size, 4, 1, file);
+}
+
+// --- EVP Writer Thread ---
+
+int record_peek_command(RecordCommand* cmd) {
+    Uint32 tail = (Uint32)SDL_AtomicGet(&g_record_cmd_tail);
+    if ((Uint32)SDL_AtomicGet(&g_record_cmd_head) == tail) return 0;
+    *cmd = g_record_cmds[tail % RECORD_CMD_QUEUE_SIZE];
+    return 1;
+}
+
+void recording_open(RecordingFile* rec) {
+    if (!g_record_enabled) {
+        return;
+    }
+    time_t t = time(NULL);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "evp_%Y%m%d_%H%M%S", localtime(&t));
+    const char* extension = g_record_format == RECORD_FORMAT_WAV ? "wav" : "evpc";
+    snprintf(rec->filename, sizeof(rec->filename), "%s.%s", stamp, extension);
+    // Recordings can start within the same second; never overwrite one the
+    // indexer may still be reading.
+    struct stat st;
+    for (int n = 2; stat(rec->filename, &st) == 0 && n < 1000; n++) {
+        snprintf(rec->filename, sizeof(rec->filename), "%s_%d.%s", stamp, n, extension);
+    }
+    rec->file = fopen(rec->filename, "wb");
+    if (!rec->file) {
+        return;
+    }
+    rec->samples = 0;
+    rec->overruns_at_start = (Uint32)SDL_AtomicGet(&g_record_overruns);
+    if (g_record_format == RECORD_FORMAT_WAV) {
+        unsigned char header[44] = {0};
+        fwrite(header, sizeof(header), 1, rec->file);
+    } else if (evpc_begin(&rec->enc, rec->file, SAMPLE_RATE) != 0) {
+        fclose(rec->file);
+        rec->file = NULL;
+        return;
+    }
+
+    char log[BUS_TEXT_SIZE];
+    snprintf(log, sizeof(log), "Recording EVP: %s", rec->filename);
+    bus_post_text(log);
+}
+
+void recording_write(RecordingFile* rec, const Sint16* samples, int count) {
+    if (!rec->file) return;
+    if (g_record_format == RECORD_FORMAT_WAV) {
+        fwrite(samples, sizeof(Sint16), count, rec->file);
+    } else {
+        evpc_append(&rec->enc, samples, count);
+    }
+    rec->samples += count;
+}
+
+void recording_close(RecordingFile* rec) {
+    if (!rec->file) return;
+    char log[BUS_TEXT_SIZE];
+    if (g_record_format == RECORD_FORMAT_WAV) {
+        fseek(rec->file, 0, SEEK_SET);
+        write_wav_header(rec->file, SAMPLE_RATE, rec->samples * sizeof(Sint16));
+        snprintf(log, sizeof(log), "EVP saved: %s", rec->filename);
+    } else {
+        evpc_finish(&rec->enc);
+        double audio_seconds = (double)rec->samples / SAMPLE_RATE;
+        double raw_bytes = 44.0 + rec->samples * sizeof(Sint16);
+        double encode_ms = 1000.0 * rec->enc.encode_ticks / SDL_GetPerformanceFrequency();
+        snprintf(log, sizeof(log), "EVP saved: %s (%.2f:1, %.2f ms CPU/s)", rec->filename,
+                 raw_bytes / rec->enc.bytes_written, audio_seconds > 0 ? encode_ms / audio_seconds : 0.0);
+    }
+    fclose(rec->file);
+    rec->file = NULL;
+    bus_post_text(log);
+    if (g_fp_enabled) fp_queue_recording(rec->filename);
+
+    Uint32 lost = (Uint32)SDL_AtomicGet(&g_record_overruns) - rec->overruns_at_start;
+    if (lost > 0) {
+        snprintf(log, sizeof(log), "EVP writer overrun: %u samples lost", lost);
+        bus_post_text(log);
+    }
+}
+
+// Drains g_record_ring, applying each start/stop command exactly at the
+// sample it was issued for. Samples outside a recording are discarded, but
+// only once they are RECORD_PREROLL old, because the detector decides to
+// record a little after speech begins. A command for a sample that is
+// already gone applies at once.
+int writer_thread(void* data) {
+    static RecordingFile rec;
+    Sint16 chunk[1024];
+    int recording = 0;
+
+    for (;;) {
+        int running = SDL_AtomicGet(&g_writer_running);
+        Uint32 tail = (Uint32)SDL_AtomicGet(&g_record_ring_tail);
+        Uint32 head = (Uint32)SDL_AtomicGet(&g_record_ring_head);
+        RecordCommand cmd;
+        int has_cmd = record_peek_command(&cmd);
+
+        if (has_cmd && (Sint32)(cmd.sample_index - tail) <= 0) {
+            recording_close(&rec);
+            recording = cmd.type == RECORD_CMD_START;
+            if (recording) recording_open(&rec);
+            SDL_AtomicAdd(&g_record_cmd_tail, 1);
+            continue;
+        }
+
+        Uint32 available = head - tail;
+        if (has_cmd && cmd.sample_index - tail < available) {
+            available = cmd.sample_index - tail;
+        } else if (!has_cmd && !recording && running) {
+            available = available > RECORD_PREROLL ? available - RECORD_PREROLL : 0;
+        }
+        if (available > 0) {
+            int count = available < SDL_arraysize(chunk) ? (int)available : (int)SDL_arraysize(chunk);
+            for (int i = 0; i < count; i++) {
+                chunk[i] = g_record_ring[(tail + i) & (RECORD_RING_SIZE - 1)];
+            }
+            SDL_AtomicAdd(&g_record_ring_tail, count);
+            recording_write(&rec, chunk, count);
+            continue;
+        }
+
+        if (!running && !has_cmd) break;
+        SDL_Delay(RECORD_POLL_MS);
+    }
+    recording_close(&rec);
+    return 0;
+}
+
+int start_writer() {
+    SDL_AtomicSet(&g_writer_running, 1);
+    g_writer_thread = SDL_CreateThread(writer_thread, "evp_writer", NULL);
+    return g_writer_thread ? 0 : -1;
+}
+
+void stop_writer() {
+    if (!g_writer_thread) return;
+    SDL_AtomicSet(&g_writer_running, 0);
+    SDL_WaitThread(g_writer_thread, NULL);
+    g_writer_thread = NULL;
+}
+
+// --- Lossless EVP Codec (EVPC) ---
+//
+// File: EVPC_FILE_HEADER_SIZE bytes (magic, version, channels, sample rate,
+// block size, start time), then self-delimiting blocks:
+//   sync(u32) block_index(u32) first_sample(u32) count(u16) order(u8)
+//   reserved(u8) payload_bytes(u32) crc32(u32, over header and payload)
+// The payload is an MSB-first bitstream: `order` raw 16-bit warm-up samples,
+// then for each partition a 5-bit Rice parameter followed by the zigzagged
+// residuals. A quotient of EVPC_RICE_ESCAPE or more is written as
+// EVPC_RICE_ESCAPE zero bits followed by the raw 32-bit value.
+
+void crc32_init() {
+    for (Uint32 i = 0; i < 256; i++) {
+        Uint32 c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        g_crc_table[i] = c;
+    }
+}
+
+Uint32 crc32_update(Uint32 crc, const Uint8* data, size_t len) {
+    crc ^= 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) crc = g_crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+typedef struct {
+    Uint8* buf;
+    size_t pos;
+    Uint64 acc;
+    int bits;
+} BitWriter;
+
+typedef struct {
+    const Uint8* buf;
+    size_t len;
+    size_t pos;
+    Uint64 acc;
+    int bits;
+    int overrun;
+} BitReader;
+
+void bw_put(BitWriter* bw, Uint32 value, int nbits) {
+    if (nbits == 0) return;
+    bw->acc = (bw->acc << nbits) | ((Uint64)value & ((1ull << nbits) - 1));
+    bw->bits += nbits;
+    while (bw->bits >= 8) {
+        bw->bits -= 8;
+        bw->buf[bw->pos++] = (Uint8)(bw->acc >> bw->bits);
+    }
+}
+
+void bw_flush(BitWriter* bw) {
+    if (bw->bits > 0) {
+        bw->buf[bw->pos++] = (Uint8)(bw->acc << (8 - bw->bits));
+        bw->bits = 0;
+    }
+}
+
+Uint32 br_get(BitReader* br, int nbits) {
+    if (nbits == 0) return 0;
+    while (br->bits < nbits) {
+        Uint8 byte = 0;
+        if (br->pos < br->len) {
+            byte = br->buf[br->pos++];
+        } else {
+            br->overrun = 1;
+        }
+        br->acc = (br->acc << 8) | byte;
+        br->bits += 8;
+    }
+    br->bits -= nbits;
+    return (Uint32)((br->acc >> br->bits) & ((1ull << nbits) - 1));
+}
+
+void rice_put(BitWriter* bw, Uint32 u, int k) {
+    Uint32 q = u >> k;
+    if (q < EVPC_RICE_ESCAPE) {
+        bw_put(bw, 1, q + 1);
+        bw_put(bw, u, k);
+    } else {
+        bw_put(bw, 0, EVPC_RICE_ESCAPE);
+        bw_put(bw, u, 32);
+    }
+}
+
+Uint32 rice_get(BitReader* br, int k) {
+    Uint32 q = 0;
+    while (q < EVPC_RICE_ESCAPE && br_get(br, 1) == 0) {
+        if (br->overrun) return 0;
+        q++;
+    }
+    if (q == EVPC_RICE_ESCAPE) return br_get(br, 32);
+    return (q << k) | br_get(br, k);
+}
+
+Sint32 evpc_predict(const Sint16* x, int i, int order) {
+    switch (order) {
+        case 1: return x[i - 1];
+        case 2: return 2 * x[i - 1] - x[i - 2];
+        case 3: return 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+        case 4: return 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4];
+        default: return 0;
+    }
+}
+
+int evpc_rice_param(const Uint32* u, int count, Uint64 sum) {
+    int k = 0;
+    while (k < 20 && ((Uint64)count << (k + 1)) <= sum) k++;
+    int best_k = k;
+    Uint64 best_bits = ~0ull;
+    for (int c = (k > 0 ? k - 1 : 0); c <= k + 1 && c <= 20; c++) {
+        Uint64 bits = 0;
+        for (int i = 0; i < count; i++) {
+            Uint32 q = u[i] >> c;
+            bits += q < EVPC_RICE_ESCAPE ? q + 1 + c : EVPC_RICE_ESCAPE + 32;
+        }
+        if (bits < best_bits) {
+            best_bits = bits;
+            best_k = c;
+        }
+    }
+    return best_k;
+}
+
+int evpc_encode_block(const Sint16* samples, int count, Uint32 block_index, Uint32 first_sample, Uint8* out) {
+    // Pick the fixed predictor with the smallest total absolute residual.
+    int order = 0;
+    if (count > EVPC_MAX_ORDER) {
+        Uint64 err[EVPC_MAX_ORDER + 1] = {0};
+        for (int i = EVPC_MAX_ORDER; i < count; i++) {
+            for (int o = 0; o <= EVPC_MAX_ORDER; o++) {
+                Sint32 r = samples[i] - evpc_predict(samples, i, o);
+                err[o] += (Uint32)(r < 0 ? -r : r);
+            }
+        }
+        for (int o = 1; o <= EVPC_MAX_ORDER; o++) {
+            if (err[o] < err[order]) order = o;
+        }
+    }
+
+    BitWriter bw = {out + EVPC_BLOCK_HEADER_SIZE, 0, 0, 0};
+    for (int i = 0; i < order; i++) bw_put(&bw, (Uint16)samples[i], 16);
+
+    Uint32 u[EVPC_PARTITION_SIZE];
+    for (int start = order; start < count; start += EVPC_PARTITION_SIZE) {
+        int n = count - start < EVPC_PARTITION_SIZE ? count - start : EVPC_PARTITION_SIZE;
+        Uint64 sum = 0;
+        for (int j = 0; j < n; j++) {
+            Sint32 r = samples[start + j] - evpc_predict(samples, start + j, order);
+            u[j] = ((Uint32)r << 1) ^ (Uint32)(r >> 31);
+            sum += u[j];
+        }
+        int k = evpc_rice_param(u, n, sum);
+        bw_put(&bw, (Uint32)k, 5);
+        for (int j = 0; j < n; j++) rice_put(&bw, u[j], k);
+    }
+    bw_flush(&bw);
+
+    put_le32(out, EVPC_BLOCK_MAGIC);
+    put_le32(out + 4, block_index);
+    put_le32(out + 8, first_sample);
+    put_le16(out + 12, (Uint16)count);
+    out[14] = (Uint8)order;
+    out[15] = 0;
+    put_le32(out + 16, (Uint32)bw.pos);
+    Uint32 crc = crc32_update(0, out, 20);
+    crc = crc32_update(crc, out + EVPC_BLOCK_HEADER_SIZE, bw.pos);
+    put_le32(out + 20, crc);
+    return EVPC_BLOCK_HEADER_SIZE + (int)bw.pos;
+}
+
+// Decodes one block at blk (avail bytes available). Returns the block's total
+// size in bytes, or -1 if it is truncated or fails its CRC.
+int evpc_decode_block(const Uint8* blk, size_t avail, Sint16* samples, int* count, Uint32* first_sample) {
+    if (avail < EVPC_BLOCK_HEADER_SIZE || get_le32(blk) != EVPC_BLOCK_MAGIC) return -1;
+    int n = get_le16(blk + 12);
+    int order = blk[14];
+    Uint32 payload = get_le32(blk + 16);
+    if (n == 0 || n > EVPC_BLOCK_SIZE || order > EVPC_MAX_ORDER || payload > avail - EVPC_BLOCK_HEADER_SIZE) return -1;
+    Uint32 crc = crc32_update(0, blk, 20);
+    crc = crc32_update(crc, blk + EVPC_BLOCK_HEADER_SIZE, payload);
+    if (crc != get_le32(blk + 20)) return -1;
+
+    BitReader br = {blk + EVPC_BLOCK_HEADER_SIZE, payload, 0, 0, 0, 0};
+    if (order > n) order = n;
+    for (int i = 0; i < order; i++) samples[i] = (Sint16)br_get(&br, 16);
+    for (int start = order; start < n; start += EVPC_PARTITION_SIZE) {
+        int m = n - start < EVPC_PARTITION_SIZE ? n - start : EVPC_PARTITION_SIZE;
+        int k = (int)br_get(&br, 5);
+        for (int j = 0; j < m; j++) {
+            Uint32 u = rice_get(&br, k);
+            Sint32 r = (Sint32)(u >> 1) ^ -(Sint32)(u & 1);
+            samples[start + j] = (Sint16)(r + evpc_predict(samples, start + j, order));
+        }
+    }
+    if (br.overrun) return -1;
+    *count = n;
+    *first_sample = get_le32(blk + 8);
+    return EVPC_BLOCK_HEADER_SIZE + (int)payload;
+}
+
+int evpc_begin(EvpcEncoder* enc, FILE* file, Uint32 sample_rate) {
+    Uint8 header[EVPC_FILE_HEADER_SIZE] = {0};
+    Uint64 now = (Uint64)time(NULL);
+    put_le32(header, EVPC_FILE_MAGIC);
+    put_le16(header + 4, EVPC_VERSION);
+    put_le16(header + 6, 1);
+    put_le32(header + 8, sample_rate);
+    put_le32(header + 12, EVPC_BLOCK_SIZE);
+    put_le32(header + 16, (Uint32)now);
+    put_le32(header + 20, (Uint32)(now >> 32));
+    memset(enc, 0, sizeof(*enc));
+    enc->file = file;
+    if (fwrite(header, sizeof(header), 1, file) != 1) return -1;
+    enc->bytes_written = sizeof(header);
+    return 0;
+}
+
+void evpc_flush_block(EvpcEncoder* enc) {
+    static Uint8 out[EVPC_BLOCK_MAX_BYTES];
+    if (enc->block_fill == 0) return;
+    Uint64 start = SDL_GetPerformanceCounter();
+    int len = evpc_encode_block(enc->block, enc->block_fill, enc->block_index, enc->samples_written, out);
+    enc->encode_ticks += SDL_GetPerformanceCounter() - start;
+    fwrite(out, 1, len, enc->file);
+    enc->bytes_written += len;
+    enc->samples_written += enc->block_fill;
+    enc->block_index++;
+    enc->block_fill = 0;
+    if (enc->block_index % EVPC_FLUSH_BLOCKS == 0) fflush(enc->file);
+}
+
+void evpc_append(EvpcEncoder* enc, const Sint16* samples, int count) {
+    while (count > 0) {
+        int n = EVPC_BLOCK_SIZE - enc->block_fill;
+        if (n > count) n = count;
+        memcpy(enc->block + enc->block_fill, samples, n * sizeof(Sint16));
+        enc->block_fill += n;
+        samples += n;
+        count -= n;
+        if (enc->block_fill == EVPC_BLOCK_SIZE) evpc_flush_block(enc);
+    }
+}
+
+void evpc_finish(EvpcEncoder* enc) {
+    evpc_flush_block(enc);
+    fflush(enc->file);
+}
+
+// Decodes a whole EVPC file, optionally writing it out as WAV. Corrupt or
+// truncated blocks are skipped by scanning for the next sync word, and gaps
+// are filled with silence so the timeline is preserved.
+int evpc_decode_file(const char* path, FILE* wav_out, EvpcDecodeStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    FILE* in = fopen(path, "rb");
+    if (!in) return -1;
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    Uint8* data = size > 0 ? (Uint8*)malloc(size) : NULL;
+    if (!data || fread(data, 1, size, in) != (size_t)size) {
+        free(data);
+        fclose(in);
+        return -1;
+    }
+    fclose(in);
+    stats->bytes_in = (Uint64)size;
+    if (size < EVPC_FILE_HEADER_SIZE || get_le32(data) != EVPC_FILE_MAGIC || get_le16(data + 4) != EVPC_VERSION) {
+        free(data);
+        return -1;
+    }
+    stats->sample_rate = get_le32(data + 8);
+
+    static Sint16 samples[EVPC_BLOCK_SIZE];
+    static const Sint16 silence[EVPC_BLOCK_SIZE];
+    if (wav_out) {
+        unsigned char header[44] = {0};
+        fwrite(header, sizeof(header), 1, wav_out);
+    }
+    size_t pos = EVPC_FILE_HEADER_SIZE;
+    int in_garbage = 0;
+    while (pos + EVPC_BLOCK_HEADER_SIZE <= (size_t)size) {
+        int count = 0;
+        Uint32 first = 0;
+        int len = evpc_decode_block(data + pos, size - pos, samples, &count, &first);
+        if (len < 0) {
+            if (!in_garbage) stats->blocks_bad++;
+            in_garbage = 1;
+            pos++;
+            continue;
+        }
+        in_garbage = 0;
+        pos += len;
+        if (first < stats->samples) continue; // duplicate of data already decoded
+        while (first > stats->samples) {
+            Uint32 gap = first - stats->samples;
+            int n = gap > EVPC_BLOCK_SIZE ? EVPC_BLOCK_SIZE : (int)gap;
+            if (wav_out) fwrite(silence, sizeof(Sint16), n, wav_out);
+            stats->samples += n;
+            stats->samples_missing += n;
+        }
+        if (wav_out) fwrite(samples, sizeof(Sint16), count, wav_out);
+        stats->samples += count;
+        stats->blocks_ok++;
+    }
+    free(data);
+    if (wav_out) {
+        fseek(wav_out, 0, SEEK_SET);
+        write_wav_header(wav_out, stats->sample_rate, stats->samples * sizeof(Sint16));
+    }
+    return 0;
+}
+
+// Loads a 16-bit PCM mono WAV file into a newly allocated buffer.
+int read_wav_pcm16(const char* path, Sint16** samples, Uint32* count, Uint32* sample_rate) {
+    FILE* in = fopen(path, "rb");
+    if (!in) return -1;
+    int rc = read_wav_pcm16_file(in, samples, count, sample_rate);
+    fclose(in);
+    return rc;
+}
+
+int read_wav_pcm16_file(FILE* in, Sint16** samples, Uint32* count, Uint32* sample_rate) {
+    Uint8 hdr[12];
+    int ok = fread(hdr, 1, 12, in) == 12 && memcmp(hdr, "RIFF", 4) == 0 && memcmp(hdr + 8, "WAVE", 4) == 0;
+    int have_fmt = 0;
+    *samples = NULL;
+    while (ok) {
+        Uint8 chunk[8];
+        if (fread(chunk, 1, 8, in) != 8) {
+            ok = 0;
+            break;
+        }
+        Uint32 chunk_size = get_le32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16) {
+            Uint8 fmt[16];
+            if (fread(fmt, 1, 16, in) != 16) {
+                ok = 0;
+                break;
+            }
+            ok = get_le16(fmt) == 1 && get_le16(fmt + 2) == 1 && get_le16(fmt + 14) == 16;
+            *sample_rate = get_le32(fmt + 4);
+            have_fmt = 1;
+            fseek(in, chunk_size - 16 + (chunk_size & 1), SEEK_CUR);
+        } else if (memcmp(chunk, "data", 4) == 0 && have_fmt) {
+            *count = chunk_size / sizeof(Sint16);
+            *samples = (Sint16*)malloc((*count + 1) * sizeof(Sint16));
+            if (!*samples) {
+                ok = 0;
+                break;
+            }
+            // Files cut short mid-recording still load up to their last sample.
+            *count = (Uint32)fread(*samples, sizeof(Sint16), *count, in);
+            break;
+        } else {
+            fseek(in, chunk_size + (chunk_size & 1), SEEK_CUR);
+        }
+    }
+    if (!ok || !*samples) {
+        free(*samples);
+        *samples = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int run_encode_tool(const char* in_path, const char* out_path) {
+    Sint16* samples;
+    Uint32 count, sample_rate;
+    if (read_wav_pcm16(in_path, &samples, &count, &sample_rate) != 0) {
+        fprintf(stderr, "encode: %s is not a readable 16-bit mono WAV file\n", in_path);
+        return 1;
+    }
+    FILE* out = fopen(out_path, "wb");
+    if (!out) {
+        fprintf(stderr, "encode: cannot create %s\n", out_path);
+        free(samples);
+        return 1;
+    }
+    static EvpcEncoder enc;
+    evpc_begin(&enc, out, sample_rate);
+    evpc_append(&enc, samples, (int)count);
+    evpc_finish(&enc);
+    fclose(out);
+    free(samples);
+
+    double audio_seconds = (double)count / sample_rate;
+    double encode_ms = 1000.0 * enc.encode_ticks / SDL_GetPerformanceFrequency();
+    printf("%s: %u samples, %.2f s of audio\n", out_path, count, audio_seconds);
+    printf("  compression ratio: %.2f:1 (%llu bytes vs %llu raw)\n", (44.0 + count * 2.0) / enc.bytes_written,
+           (unsigned long long)enc.bytes_written, (unsigned long long)(44 + count * 2ull));
+    printf("  encoder CPU: %.3f ms per second of audio\n", audio_seconds > 0 ? encode_ms / audio_seconds : 0.0);
+    return 0;
+}
+
+// Decodes to out_path, or only verifies block integrity when out_path is NULL.
+int run_decode_tool(const char* in_path, const char* out_path) {
+    FILE* out = NULL;
+    if (out_path) {
+        out = fopen(out_path, "wb");
+        if (!out) {
+            fprintf(stderr, "decode: cannot create %s\n", out_path);
+            return 1;
+        }
+    }
+    EvpcDecodeStats stats;
+    Uint64 start = SDL_GetPerformanceCounter();
+    int rc = evpc_decode_file(in_path, out, &stats);
+    double decode_ms = 1000.0 * (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    if (out) fclose(out);
+    if (rc != 0) {
+        fprintf(stderr, "decode: %s is not a readable EVPC file\n", in_path);
+        return 1;
+    }
+    double audio_seconds = stats.sample_rate ? (double)stats.samples / stats.sample_rate : 0.0;
+    printf("%s: %u samples @ %u Hz, %.2f s of audio\n", in_path, stats.samples, stats.sample_rate, audio_seconds);
+    printf("  blocks: %u ok, %u corrupt or truncated, %u samples of silence filled\n", stats.blocks_ok,
+           stats.blocks_bad, stats.samples_missing);
+    printf("  compression ratio: %.2f:1\n", (44.0 + stats.samples * 2.0) / stats.bytes_in);
+    printf("  decode time: %.2f ms\n", decode_ms);
+    return stats.blocks_bad == 0 ? 0 : 2;
+}
+
+void add_classified_event(DetectionBand* band, EventType type, float duration, Uint32 now_ms) {
+    // Shift history
+    if (band->history_count >= EVENT_HISTORY_SIZE) {
+        memmove(band->history, band->history + 1, (EVENT_HISTORY_SIZE - 1) * sizeof(ClassifiedEvent));
+    } else {
+        band->history_count++;
+    }
+
+    // Add new event
+    ClassifiedEvent* new_event = &band->history[band->history_count - 1];
+    new_event->type = type;
+
+    // Classify duration against earlier events of the same type, then add it
+    Uint64 start = SDL_GetPerformanceCounter();
+    DurationSketch* sketch = type == EVENT_BURST ? &band->burst_durations : &band->silence_durations;
+    new_event->duration_class = classify_duration(sketch, duration);
+    duration_sketch_add(sketch, duration, now_ms, g_duration_config.half_life_s);
+    g_duration_ticks += SDL_GetPerformanceCounter() - start;
+    g_duration_events++;
+
+    analyze_patterns(band);
+}
+
+void analyze_patterns(DetectionBand* band) {
+    if (band->history_count < PATTERN_LENGTH) {
+        band->pattern_reps = 0;
+        return;
+    }
+
+    // Define the target pattern as the last N events
+    ClassifiedEvent target_pattern[PATTERN_LENGTH];
+    memcpy(target_pattern, &band->history[band->history_count - PATTERN_LENGTH], PATTERN_LENGTH * sizeof(ClassifiedEvent));
+    
+    int reps = 0;
+    // Scan the rest of the history for this pattern
+    for (int i = 0; i <= band->history_count - PATTERN_LENGTH; i++) {
+        if (memcmp(target_pattern, &band->history[i], PATTERN_LENGTH * sizeof(ClassifiedEvent)) == 0) {
+            reps++;
+        }
+    }
+
+    // If this pattern is found more than once, log it
+    if (reps > 1) {
+        memcpy(band->pattern, target_pattern, PATTERN_LENGTH * sizeof(ClassifiedEvent));
+        band->pattern_reps = reps;
+    } else {
+        band->pattern_reps = 0;
+    }
+}
+
+
+// Power of bins 0..n/2 of a transformed real frame.
+void fft_power(const double* spectrum, double* power, int n) {
+    for (int k = 0; k <= n / 2; k++) {
+        power[k] = spectrum[k * 2] * spectrum[k * 2] + spectrum[k * 2 + 1] * spectrum[k * 2 + 1];
+    }
+}
+
+// Transforms a windowed frame into plan->spectrum.
+void fft_plan_execute(FftPlan* plan, const double* frame) {
+    int n = plan->config.size;
+    if (plan->ip) {
+        memcpy(plan->spectrum, frame, n * 2 * sizeof(double));
+        cdft(n * 2, -1, plan->spectrum, plan->ip, plan->w);
+    } else {
+        fft_codelet_forward(plan->spectrum, frame);
+    }
+}
+
+// Analyses the oldest queued frame and hands its slot back to the callback.
+void process_fft() {
+    Uint64 start_ticks = SDL_GetPerformanceCounter();
+    const FftFrame* queued = &g_fft_frames[g_fft_frame_tail];
+    FftPlan* plan = queued->plan;
+    int n = plan->config.size;
+    const double* frame = plan->frame + (size_t)g_fft_frame_tail * n * 2;
+    const double* power = plan->power;
+    Uint64 tdoa_ticks = 0;
+    if (plan->batched[g_fft_frame_tail]) {
+        // fft_catch_up() already transformed this frame; count its share.
+        power = plan->batch_power + (size_t)g_fft_frame_tail * (n / 2 + 1);
+        plan->batched[g_fft_frame_tail] = 0;
+        start_ticks -= plan->batch_ticks;
+    } else {
+        fft_plan_execute(plan, frame);
+        tdoa_ticks = SDL_GetPerformanceCounter();
+        if (g_tdoa_enabled) tdoa_separate(plan->spectrum, plan->spectrum_b, n);
+        tdoa_ticks = SDL_GetPerformanceCounter() - tdoa_ticks;
+        fft_power(plan->spectrum, plan->power, n);
+    }
+    Uint64 vad_ticks = SDL_GetPerformanceCounter();
+    VadFeatures vad_f;
+    vad_features(&g_vad, plan, frame, power, &vad_f);
+    vad_ticks = SDL_GetPerformanceCounter() - vad_ticks;
+    Uint32 frame_hop = queued->hop;
+    Uint64 frame_end_sample = queued->end_sample;
+    Uint32 frame_record_index = queued->record_index;
+    Uint64 frame_arrival = queued->arrival_ticks;
+    Uint64 frame_ticks = queued->ticks;
+    g_fft_frame_tail = (g_fft_frame_tail + 1) % FFT_FRAME_SLOTS;
+    SDL_AtomicAdd(&g_fft_ready, -1);
+    g_display_plan = plan;
+    double* mag_db = plan->magnitudes;
+
+    float bin_size_hz = (float)SAMPLE_RATE / n;
+    int min_bin, max_bin;
+    band_bins(&g_bands[0].spec, n, &min_bin, &max_bin);
+
+    // Magnitudes are only computed over the bins the bands cover, plus one
+    // either side for peak interpolation. Running sums restart at each run of
+    // overlapping bands, which is enough for any band's mean in O(1).
+    int run_min[MAX_BANDS], run_max[MAX_BANDS], runs = 0;
+    for (int b = 0; b < g_band_count; b++) {
+        int band_min, band_max;
+        band_bins(&g_bands[b].spec, n, &band_min, &band_max);
+        int pos = runs++;
+        while (pos > 0 && run_min[pos - 1] > band_min) {
+            run_min[pos] = run_min[pos - 1];
+            run_max[pos] = run_max[pos - 1];
+            pos--;
+        }
+        run_min[pos] = band_min;
+        run_max[pos] = band_max;
+    }
+    double* prefix = plan->prefix;
+    for (int r = 0; r < runs; r++) {
+        int lo = run_min[r], hi = run_max[r];
+        while (r + 1 < runs && run_min[r + 1] <= hi + 1) {
+            if (run_max[++r] > hi) hi = run_max[r];
+        }
+        prefix[lo] = 0.0;
+        for (int i = lo - 1; i <= hi + 1; i++) {
+            mag_db[i] = 10 * log10(fmax(1e-12, power[i])) + plan->level_db;
+            if (i >= lo && i <= hi) prefix[i + 1] = prefix[i] + mag_db[i];
+        }
+    }
+
+    g_peak_mag = -200.0f;
+    int peak_bin = min_bin;
+    for (int i = min_bin; i <= max_bin; i++) {
+        if (mag_db[i] > g_peak_mag) {
+            g_peak_mag = mag_db[i];
+            peak_bin = i;
+        }
+    }
+    g_peak_freq = (peak_bin + interpolate_peak(mag_db, peak_bin, &g_peak_mag)) * bin_size_hz;
+
+    // Event timing follows the audio sample clock, so it stays correct when
+    // a synthetic source runs faster than real time.
+    Uint32 current_time = (Uint32)(frame_end_sample * 1000 / SAMPLE_RATE);
+    g_analysis_time_ms = current_time;
+    float avg_energy = (float)((prefix[max_bin + 1] - prefix[min_bin]) / (max_bin - min_bin + 1));
+    find_spectral_peaks(mag_db, min_bin, max_bin, bin_size_hz, avg_energy + PEAK_MIN_SNR_DB);
+    update_peak_tracks(current_time);
+    for (int b = 0; b < g_band_count; b++) {
+        update_band(b, mag_db, prefix, n, current_time);
+    }
+    if (g_tdoa_enabled) {
+        Uint64 accumulate_ticks = SDL_GetPerformanceCounter();
+        if (g_bands[0].state == STATE_BURST) {
+            tdoa_accumulate(&g_tdoa, plan->spectrum, plan->spectrum_b, n, min_bin, max_bin);
+        }
+        tdoa_ticks += SDL_GetPerformanceCounter() - accumulate_ticks;
+        perf_series_add(&g_tdoa_cost_ms, (float)(tdoa_ticks * 1000.0 / SDL_GetPerformanceFrequency()));
+    }
+    if (g_survey_enabled) {
+        Uint64 survey_ticks = SDL_GetPerformanceCounter();
+        survey_add(&g_survey, plan, power, frame_end_sample);
+        survey_ticks = SDL_GetPerformanceCounter() - survey_ticks;
+        perf_series_add(&g_survey_cost_ms, (float)(survey_ticks * 1000.0 / SDL_GetPerformanceFrequency()));
+    }
+
+    Uint64 update_ticks = SDL_GetPerformanceCounter();
+    VadTransition vad = vad_update(&g_vad, &vad_f, 1000.0f * plan->hop / SAMPLE_RATE, frame_record_index - n);
+    if (vad == VAD_START) {
+        g_vad.recordings++;
+        start_recording(g_vad.onset_index);
+        add_log_entry("Voice detected.");
+    } else if (vad == VAD_STOP) {
+        stop_recording(frame_record_index);
+    }
+    Uint64 vad_end_ticks = SDL_GetPerformanceCounter();
+    if (g_features_enabled) {
+        feature_push(plan, power, &vad_f, frame_end_sample, frame_hop);
+        perf_series_add(&g_feature_cost_ms, (float)((SDL_GetPerformanceCounter() - vad_end_ticks) * 1000.0 /
+                                                    SDL_GetPerformanceFrequency()));
+    }
+
+    Uint64 end_ticks = SDL_GetPerformanceCounter();
+    double ticks_per_ms = SDL_GetPerformanceFrequency() / 1000.0;
+    perf_series_add(&g_vad_cost_ms, (float)((vad_ticks + vad_end_ticks - update_ticks) / ticks_per_ms));
+    perf_series_add(&g_hop_cost_ms, (float)((end_ticks - start_ticks) / ticks_per_ms));
+    perf_series_add(&g_hop_latency_ms, (float)((end_ticks - frame_ticks) / ticks_per_ms));
+    perf_series_add(&g_capture_wait_ms, (float)((Sint64)(frame_ticks - frame_arrival) / ticks_per_ms));
+    perf_series_add(&g_detect_latency_ms, (float)((Sint64)(end_ticks - frame_arrival) / ticks_per_ms));
+    if (!g_headless && g_unshown_count < LATENCY_MAX_UNSHOWN) g_unshown_arrivals[g_unshown_count++] = frame_arrival;
+}
+
+// --- Voice Activity Detection ---
+//
+// EVP recordings are started by the spectrum of each hop rather than by any
+// single sample crossing a level, so clicks, handling noise and ultrasonic
+// bursts no longer open files. A hop counts as speech-like when the
+// 300-3400 Hz band is loud enough, both in absolute terms and above a slowly
+// tracked noise floor, holds most of the frame's power, is harmonic rather
+// than noise-like (low spectral flatness), and the waveform crosses zero at
+// a voice-like rate. Recording starts after VAD_ONSET_MS of consecutive
+// speech-like hops, from the start of the first one's frame, and stops after
+// VAD_HANG_MS without any.
+
+// Computes the hop's features. Reads the windowed frame, so it must run
+// before the frame slot is handed back to the audio callback.
+void vad_features(const VadState* vad, const FftPlan* plan, const double* frame, const double* power, VadFeatures* f) {
+    int n = plan->config.size;
+    float bin_size_hz = (float)SAMPLE_RATE / n;
+    int min_bin = (int)ceilf(VAD_MIN_HZ / bin_size_hz);
+    int max_bin = (int)(VAD_MAX_HZ / bin_size_hz);
+
+    double total = 0.0, band = 0.0, log_sum = 0.0;
+    for (int i = 1; i < n / 2; i++) {
+        total += power[i];
+        if (i >= min_bin && i <= max_bin) {
+            band += power[i];
+            log_sum += log(power[i] + 1e-20);
+        }
+    }
+    int bins = max_bin - min_bin + 1;
+    // Parseval: one-sided bin power over n * sum(w^2) is mean-square level.
+    double scale = 2.0 / (n * plan->window_power);
+    f->level_db = (float)(10.0 * log10(band * scale + 1e-12));
+    f->total_db = (float)(10.0 * log10(total * scale + 1e-12));
+    f->flatness = band > 0.0 ? (float)(exp(log_sum / bins) / (band / bins)) : 1.0f;
+
+    // Broadband noise would otherwise dilute both the band share and the
+    // crossing rate, so each looks only at what stands above the noise.
+    double band_excess = band * scale - pow(10.0, vad->floor_db / 10.0);
+    double total_excess = total * scale - pow(10.0, vad->total_floor_db / 10.0);
+    f->band_ratio = band_excess > 0.0 && total_excess > 0.0 ? (float)fmin(1.0, band_excess / total_excess) : 0.0f;
+
+    // Schmitt-trigger crossings over the middle half of the frame, where the
+    // window is above one half, with the deadband at the noise RMS scaled by
+    // the window so every sample is held to the same level.
+    double deadband = vad->primed ? pow(10.0, vad->total_floor_db / 20.0) : 0.0;
+    int crossings = 0, sign = 0;
+    for (int j = n / 4; j < n - n / 4; j++) {
+        double limit = deadband * plan->window[j];
+        int s = (frame[j * 2] > limit) - (frame[j * 2] < -limit);
+        int flip = s != 0 && s != sign;
+        crossings += flip && sign != 0;
+        sign = flip ? s : sign;
+    }
+    f->zcr = (float)crossings / (n - 2 * (n / 4));
+}
+
+int vad_is_speech(const VadState* vad, const VadFeatures* f) {
+    return f->level_db > VAD_MIN_LEVEL_DB && f->level_db > vad->floor_db + VAD_SNR_DB &&
+           f->band_ratio > VAD_MIN_BAND_RATIO && f->flatness < VAD_MAX_FLATNESS &&
+           f->zcr > VAD_MIN_ZCR && f->zcr < VAD_MAX_ZCR;
+}
+
+// Advances the detector by one hop. frame_start is the record ring index of
+// the frame's first sample, used as the recording's start.
+VadTransition vad_update(VadState* vad, const VadFeatures* f, float hop_ms, Uint32 frame_start) {
+    vad->last = *f;
+    if (!vad->primed) {
+        vad->floor_db = f->level_db;
+        vad->total_floor_db = f->total_db;
+        vad->primed = 1;
+    }
+    int speech = vad_is_speech(vad, f);
+    vad->speech = speech;
+    if (speech) vad->speech_hops++;
+    vad->hops++;
+
+    if (!vad->active) {
+        // The floor follows the quietest recent level down at once and up at
+        // VAD_FLOOR_RISE_DB per second, so a louder room is learned in
+        // seconds but speech does not drag it up.
+        float rise = VAD_FLOOR_RISE_DB * hop_ms / 1000.0f;
+        vad->floor_db = fminf(f->level_db, vad->floor_db + rise);
+        vad->total_floor_db = fminf(f->total_db, vad->total_floor_db + rise);
+        if (!speech) {
+            vad->speech_ms = 0.0f;
+            return VAD_NONE;
+        }
+        if (vad->speech_ms == 0.0f) vad->onset_index = frame_start;
+        vad->speech_ms += hop_ms;
+        if (vad->speech_ms < VAD_ONSET_MS) return VAD_NONE;
+        vad->active = 1;
+        vad->quiet_ms = 0.0f;
+        return VAD_START;
+    }
+
+    if (speech) {
+        vad->quiet_ms = 0.0f;
+        return VAD_NONE;
+    }
+    vad->quiet_ms += hop_ms;
+    if (vad->quiet_ms < VAD_HANG_MS) return VAD_NONE;
+    vad->active = 0;
+    vad->speech_ms = 0.0f;
+    return VAD_STOP;
+}
+
+void vad_reset(VadState* vad) {
+    memset(vad, 0, sizeof(*vad));
+}
+
+// --- Duration Classification ---
+//
+// Silences and bursts are classed by their percentile among earlier events
+// of the same type in the same band, read from a DurationSketch. Unlike a
+// running mean, the sketch is not pulled about by a single outlier, and with
+// a half-life it follows a change of regime within a few half-lives.
+
+// Bucket 0 holds everything up to DURATION_SKETCH_MIN_S and the last bucket
+// everything from about eight hours up.
+int duration_bucket(float duration_s) {
+    if (!(duration_s > DURATION_SKETCH_MIN_S)) return 0;
+    int b = 1 + (int)(log(duration_s / DURATION_SKETCH_MIN_S) / log(DURATION_SKETCH_RATIO));
+    return b < DURATION_SKETCH_BUCKETS ? b : DURATION_SKETCH_BUCKETS - 1;
+}
+
+void duration_sketch_add(DurationSketch* s, float duration_s, Uint32 now_ms, float half_life_s) {
+    double weight = 1.0;
+    if (s->events == 0 || half_life_s <= 0.0f) {
+        s->base_ms = now_ms;
+    } else {
+        Uint32 elapsed_ms = now_ms - s->base_ms;
+        double half_lives = elapsed_ms / (1000.0 * half_life_s);
+        if (half_lives > DURATION_RESCALE_HALF_LIVES || elapsed_ms > (1u << 30)) {
+            // Move the base up to now, before the weights overflow or the
+            // millisecond clock wraps.
+            double scale = exp2(-half_lives);
+            for (int i = 1; i <= DURATION_SKETCH_BUCKETS; i++) s->tree[i] *= scale;
+            s->total *= scale;
+            s->base_ms = now_ms;
+            half_lives = 0.0;
+        }
+        weight = exp2(half_lives);
+    }
+    for (int i = duration_bucket(duration_s) + 1; i <= DURATION_SKETCH_BUCKETS; i += i & -i) s->tree[i] += weight;
+    s->total += weight;
+    s->events++;
+}
+
+// Fraction of the weight below duration_s, counting its own bucket as half
+// below, so equal durations rank at 0.5.
+double duration_sketch_rank(const DurationSketch* s, float duration_s) {
+    if (s->total <= 0.0) return 0.5;
+    int b = duration_bucket(duration_s);
+    double below = 0.0, through = 0.0;
+    for (int i = b; i > 0; i -= i & -i) below += s->tree[i];
+    for (int i = b + 1; i > 0; i -= i & -i) through += s->tree[i];
+    return (below + through) * 0.5 / s->total;
+}
+
+// Duration at quantile q (0-1), as the geometric middle of its bucket.
+float duration_sketch_quantile(const DurationSketch* s, float q) {
+    if (s->total <= 0.0) return 0.0f;
+    double target = q * s->total;
+    int b = 0;
+    for (int step = DURATION_SKETCH_BUCKETS; step > 0; step >>= 1) {
+        if (b + step <= DURATION_SKETCH_BUCKETS && s->tree[b + step] < target) {
+            b += step;
+            target -= s->tree[b];
+        }
+    }
+    if (b >= DURATION_SKETCH_BUCKETS) b = DURATION_SKETCH_BUCKETS - 1;
+    return b == 0 ? (float)DURATION_SKETCH_MIN_S
+                  : (float)(DURATION_SKETCH_MIN_S * pow(DURATION_SKETCH_RATIO, b - 0.5));
+}
+
+// Class of a new event against the earlier ones. The first event of a type
+// has nothing to compare with and takes the middle class.
+int classify_duration(const DurationSketch* s, float duration_s) {
+    const DurationConfig* c = &g_duration_config;
+    if (s->total <= 0.0) return c->classes / 2;
+    double percentile = 100.0 * duration_sketch_rank(s, duration_s);
+    int duration_class = 0;
+    while (duration_class < c->classes - 1 && percentile >= c->cuts[duration_class]) duration_class++;
+    return duration_class;
+}
+
+// Letter for a class: s/L with two classes, s/m/L with three and t/s/m/L
+// with four.
+char duration_class_char(int duration_class, int classes) {
+    static const char* letters[DURATION_MAX_CLASSES + 1] = {"", "", "sL", "smL", "tsmL"};
+    if (classes < 2 || classes > DURATION_MAX_CLASSES || duration_class < 0 || duration_class >= classes) return '?';
+    return letters[classes][duration_class];
+}
+
+// Writes the durations at the configured cut percentiles, e.g. "0.12/0.45s".
+void format_duration_cuts(const DurationSketch* s, char* out, size_t size) {
+    if (s->events == 0) {
+        snprintf(out, size, "-");
+        return;
+    }
+    out[0] = '\0';
+    for (int i = 0; i < g_duration_config.classes - 1; i++) {
+        size_t len = strlen(out);
+        snprintf(out + len, size - len, "%s%.2f", i > 0 ? "/" : "",
+                 duration_sketch_quantile(s, g_duration_config.cuts[i] / 100.0f));
+    }
+    size_t len = strlen(out);
+    snprintf(out + len, size - len, "s");
+}
+
+// Installs new duration classes. Histories classed under the old cuts would
+// never match new patterns, so they are cleared; the sketches are kept.
+void set_duration_config(const DurationConfig* config) {
+    int changed = config->classes != g_duration_config.classes ||
+                  memcmp(config->cuts, g_duration_config.cuts, sizeof(config->cuts)) != 0;
+    g_duration_config = *config;
+    if (!changed) return;
+    for (int b = 0; b < g_band_count; b++) {
+        g_bands[b].history_count = 0;
+        g_bands[b].pattern_reps = 0;
+    }
+}
+
+// --- Multi-Band Detection ---
+//
+// Every band runs its own burst state machine, event history and pattern
+// analysis off the spectrum of the same hop. A band's level is the mean log
+// magnitude over its bins, read from the running sums process_fft builds, so
+// a quiet band costs a handful of operations per hop. Only a band that is in
+// a burst scans its bins, to find the burst's strongest frequency.
+
+// Bins of a band at the given FFT size, kept clear of DC and Nyquist so
+// peak interpolation has a neighbour on both sides.
+void band_bins(const BandSpec* spec, int fft_size, int* min_bin, int* max_bin) {
+    float bin_size_hz = (float)SAMPLE_RATE / fft_size;
+    *min_bin = (int)(spec->min_hz / bin_size_hz);
+    *max_bin = (int)(spec->max_hz / bin_size_hz);
+    if (*min_bin < 1) *min_bin = 1;
+    if (*max_bin > fft_size / 2 - 2) *max_bin = fft_size / 2 - 2;
+    if (*max_bin < *min_bin) *max_bin = *min_bin;
+}
+
+void update_band(int index, const double* mag_db, const double* prefix, int fft_size, Uint32 now_ms) {
+    DetectionBand* band = &g_bands[index];
+    int min_bin, max_bin;
+    band_bins(&band->spec, fft_size, &min_bin, &max_bin);
+    band->level_db = (float)((prefix[max_bin + 1] - prefix[min_bin]) / (max_bin - min_bin + 1));
+    int above = band->level_db > band->spec.threshold_db;
+
+    if (above) {
+        float peak_db = g_peak_mag, peak_freq = g_peak_freq;
+        if (index > 0) {
+            int peak_bin = min_bin;
+            for (int i = min_bin + 1; i <= max_bin; i++) {
+                if (mag_db[i] > mag_db[peak_bin]) peak_bin = i;
+            }
+            peak_freq = (peak_bin + interpolate_peak(mag_db, peak_bin, &peak_db)) * (float)SAMPLE_RATE / fft_size;
+        }
+        if (band->state == STATE_QUIET || peak_db > band->peak_db) {
+            band->peak_db = peak_db;
+            band->peak_freq = peak_freq;
+        }
+        export_push(&g_export_analysis_queue, RECORD_PEAK, index, 0, peak_db, peak_freq);
+    }
+
+    char prefix_name[BAND_NAME_SIZE + 4] = "";
+    if (index > 0) snprintf(prefix_name, sizeof(prefix_name), "[%s] ", band->spec.name);
+    char log[100];
+    if (band->state == STATE_QUIET && above) {
+        band->state = STATE_BURST;
+        if (index == 0) tdoa_reset(&g_tdoa);
+        float quiet_duration = (now_ms - band->quiet_start_time) / 1000.0f;
+        band->burst_start_time = now_ms;
+        add_classified_event(band, EVENT_SILENCE, quiet_duration, now_ms);
+        export_push(&g_export_analysis_queue, RECORD_SILENCE, index,
+                    band->history[band->history_count - 1].duration_class, quiet_duration, 0.0f);
+        snprintf(log, sizeof(log), "%sSilence: %.2fs", prefix_name, quiet_duration);
+        add_log_entry(log);
+    } else if (band->state == STATE_BURST && !above) {
+        band->state = STATE_QUIET;
+        float burst_duration = (now_ms - band->burst_start_time) / 1000.0f;
+        band->quiet_start_time = now_ms;
+        band->bursts++;
+        add_classified_event(band, EVENT_BURST, burst_duration, now_ms);
+        export_push(&g_export_analysis_queue, RECORD_BURST, index,
+                    band->history[band->history_count - 1].duration_class, burst_duration, band->peak_freq);
+        int len = snprintf(log, sizeof(log), "%s>> BURST: %.2fs @ %.0f Hz", prefix_name, burst_duration,
+                           band->peak_freq);
+        TdoaResult bearing;
+        if (index == 0 && g_tdoa_enabled && tdoa_estimate(&g_tdoa, g_tdoa_spacing_m, &bearing) == 0) {
+            g_tdoa_last = bearing;
+            g_tdoa_located++;
+            snprintf(log + len, sizeof(log) - len, ", bearing %+.0f deg (%+.1f us)", bearing.bearing_deg,
+                     bearing.delay_samples * 1e6f / SAMPLE_RATE);
+        }
+        add_log_entry(log);
+    }
+}
+
+// Clears a band's detector state, keeping its spec.
+void reset_band(DetectionBand* band) {
+    BandSpec spec = band->spec;
+    memset(band, 0, sizeof(*band));
+    band->spec = spec;
+    band->state = STATE_QUIET;
+    band->quiet_start_time = g_analysis_time_ms;
+}
+
+// Replaces bands 1.. with the given specs. Unchanged lists keep their state.
+void set_extra_bands(const BandSpec* specs, int count) {
+    int changed = count != g_band_count - 1;
+    for (int i = 0; i < count && !changed; i++) {
+        changed = memcmp(&specs[i], &g_bands[i + 1].spec, sizeof(BandSpec)) != 0;
+    }
+    if (!changed) return;
+    for (int i = 0; i < count; i++) {
+        g_bands[i + 1].spec = specs[i];
+        reset_band(&g_bands[i + 1]);
+    }
+    g_band_count = count + 1;
+}
+
+// Writes a band's repeating pattern as e.g. "Bs > SL > Bs".
+void format_pattern(const DetectionBand* band, const char* separator, char* out, size_t size) {
+    out[0] = '\0';
+    for (int i = 0; i < PATTERN_LENGTH; i++) {
+        char event_char[5];
+        snprintf(event_char, sizeof(event_char), "%c%c",
+            band->pattern[i].type == EVENT_BURST ? 'B' : 'S',
+            duration_class_char(band->pattern[i].duration_class, g_duration_config.classes));
+        if (i > 0) strncat(out, separator, size - strlen(out) - 1);
+        strncat(out, event_char, size - strlen(out) - 1);
+    }
+}
+
+// --- Peak Estimation and Tracking ---
+//
+// The raw spectral maximum is quantized to the bin spacing (about 10.8 Hz at
+// 4096 points). Rather than paying for a larger FFT, each peak is refined by
+// fitting a parabola to the log magnitudes around it, and the strongest
+// PEAK_TRACK_COUNT peaks of every hop are joined into frequency tracks.
+
+// Returns the fractional bin offset (-0.5..0.5) of the true peak near bin,
+// and writes the interpolated peak level. Quadratic interpolation on dB
+// values is exact for a Gaussian lobe and, on a Hann window, places a lone
+// sinusoid to within a few hundredths of a bin.
+float interpolate_peak(const double* mag_db, int bin, float* peak_db) {
+    double a = mag_db[bin - 1];
+    double b = mag_db[bin];
+    double c = mag_db[bin + 1];
+    double denom = a - 2.0 * b + c;
+    if (denom >= 0.0) {
+        *peak_db = (float)b;
+        return 0.0f;
+    }
+    double delta = 0.5 * (a - c) / denom;
+    if (delta > 0.5) delta = 0.5;
+    if (delta < -0.5) delta = -0.5;
+    *peak_db = (float)(b - 0.25 * (a - c) * delta);
+    return (float)delta;
+}
+
+// Collects the strongest local maxima above floor_db into g_peaks.
+void find_spectral_peaks(const double* mag_db, int min_bin, int max_bin, float bin_size_hz, float floor_db) {
+    g_peak_count = 0;
+    for (int i = min_bin; i <= max_bin; i++) {
+        double m = mag_db[i];
+        if (m < floor_db || m <= mag_db[i - 1] || m < mag_db[i + 1]) continue;
+        SpectralPeak peak;
+        peak.freq_hz = (i + interpolate_peak(mag_db, i, &peak.mag_db)) * bin_size_hz;
+        int pos = g_peak_count < PEAK_TRACK_COUNT ? g_peak_count++ : PEAK_TRACK_COUNT;
+        while (pos > 0 && g_peaks[pos - 1].mag_db < peak.mag_db) {
+            if (pos < PEAK_TRACK_COUNT) g_peaks[pos] = g_peaks[pos - 1];
+            pos--;
+        }
+        if (pos < PEAK_TRACK_COUNT) g_peaks[pos] = peak;
+    }
+}
+
+// Greedy nearest-frequency association, strongest peak first. A peak with
+// no live track within PEAK_TRACK_MAX_JUMP_HZ takes a free slot, or the slot
+// of the track that has gone longest without a match.
+void update_peak_tracks(Uint32 now_ms) {
+    int matched[PEAK_TRACK_COUNT] = {0};
+
+    for (int p = 0; p < g_peak_count; p++) {
+        const SpectralPeak* peak = &g_peaks[p];
+        int best = -1;
+        float best_dist = PEAK_TRACK_MAX_JUMP_HZ;
+        for (int t = 0; t < PEAK_TRACK_COUNT; t++) {
+            float dist = fabsf(g_peak_tracks[t].freq_hz - peak->freq_hz);
+            if (g_peak_tracks[t].id && !matched[t] && dist <= best_dist) {
+                best = t;
+                best_dist = dist;
+            }
+        }
+        if (best >= 0) {
+            PeakTrack* track = &g_peak_tracks[best];
+            if (now_ms > track->last_ms) {
+                track->slope_hz_s = (peak->freq_hz - track->freq_hz) * 1000.0f / (now_ms - track->last_ms);
+            }
+            track->freq_hz = peak->freq_hz;
+            track->mag_db = peak->mag_db;
+            track->last_ms = now_ms;
+            track->hops++;
+            track->missed = 0;
+            matched[best] = 1;
+            continue;
+        }
+
+        int slot = -1;
+        for (int t = 0; t < PEAK_TRACK_COUNT; t++) {
+            if (matched[t]) continue;
+            if (!g_peak_tracks[t].id) {
+                slot = t;
+                break;
+            }
+            if (g_peak_tracks[t].missed > 0 && (slot < 0 || g_peak_tracks[t].missed > g_peak_tracks[slot].missed)) {
+                slot = t;
+            }
+        }
+        if (slot < 0) continue;
+        PeakTrack* track = &g_peak_tracks[slot];
+        track->id = g_next_track_id++;
+        track->freq_hz = peak->freq_hz;
+        track->mag_db = peak->mag_db;
+        track->slope_hz_s = 0.0f;
+        track->start_ms = now_ms;
+        track->last_ms = now_ms;
+        track->hops = 1;
+        track->missed = 0;
+        matched[slot] = 1;
+    }
+
+    for (int t = 0; t < PEAK_TRACK_COUNT; t++) {
+        PeakTrack* track = &g_peak_tracks[t];
+        if (!track->id || matched[t]) continue;
+        if (++track->missed > PEAK_TRACK_HOLD_HOPS) {
+            if (track->hops >= PEAK_TRACK_LOG_HOPS) {
+                char log[100];
+                snprintf(log, sizeof(log), "Track %d: %.1f Hz, %.2fs, %+.0f Hz/s", track->id, track->freq_hz,
+                         (track->last_ms - track->start_ms) / 1000.0f, track->slope_hz_s);
+                add_log_entry(log);
+            }
+            track->id = 0;
+        }
+    }
+}
+
+// --- Runtime FFT Configuration ---
+//
+// Size, window and overlap can change while monitoring. Each configuration
+// gets an FftPlan holding its window table, prebuilt Ooura twiddle and
+// bit-reversal tables and its frame/spectrum buffers. Plans are allocated on
+// the main thread and the last FFT_PLAN_CACHE_SIZE are kept, so switching
+// back and forth is instant; the audio callback only swaps a pointer.
+
+const char* window_name(WindowType type) {
+    switch (type) {
+        case WINDOW_BLACKMAN_HARRIS: return "Blackman-Harris";
+        case WINDOW_FLAT_TOP: return "Flat-top";
+        default: return "Hann";
+    }
+}
+
+// Symmetric windows, matching the (size - 1) convention of the original Hann.
+// Blackman-Harris is the 4-term, -92 dB sidelobe form; the flat-top reads a
+// tone's level to within 0.01 dB wherever it falls in the bin.
+double window_value(WindowType type, int j, int size) {
+    double x = 2.0 * M_PI * j / (size - 1);
+    switch (type) {
+        case WINDOW_BLACKMAN_HARRIS:
+            return 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+        case WINDOW_FLAT_TOP:
+            return 0.21557895 - 0.41663158 * cos(x) + 0.277263158 * cos(2 * x) - 0.083578947 * cos(3 * x) +
+                   0.006947368 * cos(4 * x);
+        default:
+            return 0.5 * (1.0 - cos(x));
+    }
+}
+
+int fft_config_equal(const FftConfig* a, const FftConfig* b) {
+    return a->size == b->size && a->window == b->window && fabsf(a->overlap - b->overlap) < 1e-4f;
+}
+
+void fft_plan_free(FftPlan* plan) {
+    free(plan->window);
+    free(plan->ip);
+    free(plan->w);
+    free(plan->frame);
+    free(plan->spectrum);
+    free(plan->spectrum_b);
+    free(plan->magnitudes);
+    free(plan->prefix);
+    free(plan->power);
+    free(plan->batch_re);
+    free(plan->batch_im);
+    free(plan->batch_twiddle);
+    free(plan->batch_bitrev);
+    free(plan->batch_power);
+    memset(plan, 0, sizeof(*plan));
+}
+
+void free_fft_plans() {
+    SDL_AtomicSetPtr(&g_pending_plan, NULL);
+    SDL_AtomicSetPtr(&g_active_plan, NULL);
+    g_display_plan = NULL;
+    for (int i = 0; i < FFT_PLAN_CACHE_SIZE; i++) {
+        fft_plan_free(&g_fft_plans[i]);
+    }
+    g_fft_config_dirty = 1;
+}
+
+int fft_plan_build(FftPlan* plan, const FftConfig* config) {
+    int n = config->size;
+    memset(plan, 0, sizeof(*plan));
+    plan->config = *config;
+    plan->hop = (int)(n * (1.0f - config->overlap) + 0.5f);
+    if (plan->hop < 1) plan->hop = 1;
+    plan->window = (float*)malloc(n * sizeof(float));
+    plan->frame = (double*)malloc((size_t)n * 2 * FFT_FRAME_SLOTS * sizeof(double));
+    plan->spectrum = (double*)malloc(n * 2 * sizeof(double));
+    plan->spectrum_b = (double*)malloc((n / 2 + 1) * 2 * sizeof(double));
+    plan->magnitudes = (double*)calloc(n / 2, sizeof(double));
+    plan->prefix = (double*)malloc((n / 2 + 1) * sizeof(double));
+    plan->power = (double*)malloc((n / 2 + 1) * sizeof(double));
+    plan->batch_re = (double*)malloc((size_t)n * FFT_BATCH_LANES * sizeof(double));
+    plan->batch_im = (double*)malloc((size_t)n * FFT_BATCH_LANES * sizeof(double));
+    plan->batch_twiddle = (double*)malloc(n * sizeof(double));
+    plan->batch_bitrev = (int*)malloc(n * sizeof(int));
+    plan->batch_power = (double*)malloc((size_t)(n / 2 + 1) * FFT_FRAME_SLOTS * sizeof(double));
+    int ok = plan->window && plan->frame && plan->spectrum && plan->spectrum_b && plan->magnitudes && plan->prefix &&
+             plan->power && plan->batch_re && plan->batch_im && plan->batch_twiddle && plan->batch_bitrev &&
+             plan->batch_power;
+    if (ok && n != FFT_SIZE) {
+        // cdft(2n) needs 2 + sqrt(n) ints of ip and n/2 doubles of w. Building
+        // them here keeps cdft() from doing it lazily on the first frame.
+        plan->ip = (int*)malloc(((int)sqrt((double)n) + 4) * sizeof(int));
+        plan->w = (double*)malloc(n / 2 * sizeof(double));
+        ok = plan->ip && plan->w;
+        if (ok) makewt(n >> 1, plan->ip, plan->w);
+    }
+    if (!ok) {
+        fft_plan_free(plan);
+        return -1;
+    }
+    double sum = 0.0;
+    for (int j = 0; j < n; j++) {
+        plan->window[j] = (float)window_value(config->window, j, n);
+        sum += plan->window[j];
+        plan->window_power += (double)plan->window[j] * plan->window[j];
+    }
+    for (int k = 0; k < n / 2; k++) {
+        plan->batch_twiddle[k * 2] = cos(2.0 * M_PI * k / n);
+        plan->batch_twiddle[k * 2 + 1] = -sin(2.0 * M_PI * k / n);
+    }
+    for (int i = 0; i < n; i++) {
+        int r = 0;
+        for (int b = 1, m = n >> 1; b < n; b <<= 1, m >>= 1) r |= i & b ? m : 0;
+        plan->batch_bitrev[i] = r;
+    }
+    // A tone's peak scales with the window's sum; (FFT_SIZE - 1) / 2 is the
+    // sum of the startup Hann window, so thresholds mean the same at any size.
+    plan->level_db = (float)(20.0 * log10((FFT_SIZE - 1) / 2.0 / sum));
+    return 0;
+}
+
+// Picks the slot for a new plan: an empty one, or the least recently used
+// plan nothing refers to. Evicting waits until the callback has adopted the
+// pending plan, so it can only be holding g_active_plan. Returns NULL while
+// that has not happened yet.
+FftPlan* fft_plan_slot() {
+    void* active = SDL_AtomicGetPtr(&g_active_plan);
+    void* pending = SDL_AtomicGetPtr(&g_pending_plan);
+    int queued = SDL_AtomicGet(&g_fft_ready);
+    FftPlan* victim = NULL;
+    for (int i = 0; i < FFT_PLAN_CACHE_SIZE; i++) {
+        FftPlan* plan = &g_fft_plans[i];
+        if (!plan->config.size) return plan;
+        if (active != pending || plan == active || plan == g_display_plan) continue;
+        int in_flight = 0;
+        for (int k = 0; k < queued; k++) {
+            if (g_fft_frames[(g_fft_frame_tail + k) % FFT_FRAME_SLOTS].plan == plan) in_flight = 1;
+        }
+        if (in_flight) continue;
+        if (!victim || plan->last_used < victim->last_used) victim = plan;
+    }
+    if (victim) fft_plan_free(victim);
+    return victim;
+}
+
+// Hands the callback a plan for g_fft_config if it is not running it yet.
+// Called once per loop, so a switch deferred by fft_plan_slot() goes through
+// as soon as the callback catches up.
+void apply_fft_config() {
+    if (!g_fft_config_dirty) return;
+    FftPlan* plan = NULL;
+    for (int i = 0; i < FFT_PLAN_CACHE_SIZE && !plan; i++) {
+        if (g_fft_plans[i].config.size && fft_config_equal(&g_fft_plans[i].config, &g_fft_config)) {
+            plan = &g_fft_plans[i];
+        }
+    }
+    if (!plan) {
+        plan = fft_plan_slot();
+        if (!plan) return;
+        if (fft_plan_build(plan, &g_fft_config) != 0) {
+            SDL_Log("Out of memory building a %d-point FFT plan", g_fft_config.size);
+            add_log_entry("FFT change failed: out of memory.");
+            FftPlan* current = (FftPlan*)SDL_AtomicGetPtr(&g_pending_plan);
+            if (current) g_fft_config = current->config;
+            g_fft_config_dirty = 0;
+            return;
+        }
+    }
+    plan->last_used = ++g_fft_plan_clock;
+    g_fft_config_dirty = 0;
+    if (plan == SDL_AtomicGetPtr(&g_pending_plan)) return;
+    SDL_AtomicSetPtr(&g_pending_plan, plan);
+
+    char log[100];
+    snprintf(log, sizeof(log), "FFT %d, %s, %.1f%% overlap: hop %d, %.2f Hz bins", plan->config.size,
+             window_name(plan->config.window), plan->config.overlap * 100.0f, plan->hop,
+             (float)SAMPLE_RATE / plan->config.size);
+    add_log_entry(log);
+}
+
+void set_fft_config(const FftConfig* config) {
+    g_fft_config = *config;
+    g_fft_config_dirty = 1;
+    apply_fft_config();
+}
+
+// Applies one "key = value" setting. Returns -1 for an unknown key or a value
+// out of range.
+int parse_config_setting(const char* key, const char* value, FftConfig* config, BandSpec* bands, int* band_count,
+                         DurationConfig* durations) {
+    if (strcmp(key, "fft_size") == 0) {
+        int size = atoi(value);
+        if (size < FFT_MIN_SIZE || size > FFT_MAX_SIZE || (size & (size - 1))) return -1;
+        config->size = size;
+    } else if (strcmp(key, "window") == 0) {
+        int w;
+        for (w = 0; w < WINDOW_COUNT; w++) {
+            if (SDL_strcasecmp(value, window_name((WindowType)w)) == 0) break;
+        }
+        if (w == WINDOW_COUNT) return -1;
+        config->window = (WindowType)w;
+    } else if (strcmp(key, "overlap") == 0) {
+        float overlap = (float)atof(value) / 100.0f;
+        if (overlap < 0.0f || overlap > FFT_MAX_OVERLAP) return -1;
+        config->overlap = overlap;
+    } else if (strcmp(key, "band") == 0) {
+        BandSpec spec;
+        memset(&spec, 0, sizeof(spec));
+        if (*band_count >= MAX_BANDS - 1 ||
+            sscanf(value, "%15s %f %f %f", spec.name, &spec.min_hz, &spec.max_hz, &spec.threshold_db) != 4 ||
+            spec.min_hz < 0.0f || spec.max_hz <= spec.min_hz || spec.max_hz > SAMPLE_RATE / 2) {
+            return -1;
+        }
+        bands[(*band_count)++] = spec;
+    } else if (strcmp(key, "duration_classes") == 0) {
+        // Ascending cut percentiles, one fewer than the classes
+        DurationConfig parsed = *durations;
+        parsed.classes = 1;
+        const char* p = value;
+        char* end;
+        for (float cut = strtof(p, &end); end != p; cut = strtof(p, &end)) {
+            if (parsed.classes == DURATION_MAX_CLASSES || cut >= 100.0f ||
+                cut <= (parsed.classes > 1 ? parsed.cuts[parsed.classes - 2] : 0.0f)) {
+                return -1;
+            }
+            parsed.cuts[parsed.classes++ - 1] = cut;
+            p = end;
+        }
+        if (parsed.classes < 2 || p[strspn(p, " \t")] != '\0') return -1;
+        memset(parsed.cuts + parsed.classes - 1, 0, (DURATION_MAX_CLASSES - parsed.classes) * sizeof(float));
+        *durations = parsed;
+    } else if (strcmp(key, "duration_half_life") == 0) {
+        float half_life_s = (float)atof(value);
+        if (half_life_s < 0.0f) return -1;
+        durations->half_life_s = half_life_s;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Reads fft_size, window, overlap (percent), band and duration lines from a
+// "key = value" file; '#' starts a comment. Missing FFT and duration keys
+// keep their current value, while the band lines replace every band but the
+// display band. Nothing is changed unless every line is valid.
+int load_config_file(const char* path, FftConfig* config, BandSpec* bands, int* band_count,
+                     DurationConfig* durations) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+    FftConfig parsed = *config;
+    DurationConfig parsed_durations = *durations;
+    int parsed_bands = 0;
+    char line[256];
+    int line_no = 0, errors = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_no++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char key[64], value[128];
+        int fields = sscanf(line, " %63[^= \t\r\n] = %127[^\r\n]", key, value);
+        if (fields == EOF || (fields == 0 && strspn(line, " \t\r\n") == strlen(line))) continue;
+        if (fields == 2) {
+            size_t len = strlen(value);
+            while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) value[--len] = '\0';
+        }
+        if (fields != 2 || parse_config_setting(key, value, &parsed, bands, &parsed_bands, &parsed_durations) != 0) {
+            SDL_Log("%s:%d: invalid setting (fft_size 1024-65536 power of two, window Hann|Blackman-Harris|"
+                    "Flat-top, overlap 0-%.2f, band NAME MIN_HZ MAX_HZ THRESHOLD_DB, at most %d bands, "
+                    "duration_classes 1-%d ascending percentiles, duration_half_life SECONDS)",
+                    path, line_no, FFT_MAX_OVERLAP * 100.0f, MAX_BANDS - 1, DURATION_MAX_CLASSES - 1);
+            errors++;
+        }
+    }
+    fclose(file);
+    if (errors) return -1;
+    *config = parsed;
+    *band_count = parsed_bands;
+    *durations = parsed_durations;
+    return 0;
+}
+
+// Loads g_config_path into g_fft_config, the band list and the duration
+// classes. A missing file is
+// only an error when it was named on the command line.
+int read_config_file(int required) {
+    struct stat st;
+    if (stat(g_config_path, &st) != 0) {
+        if (required) SDL_Log("Cannot open config file %s", g_config_path);
+        return required ? -1 : 0;
+    }
+    g_config_mtime = st.st_mtime;
+    FftConfig config = g_fft_config;
+    BandSpec bands[MAX_BANDS - 1];
+    int band_count = 0;
+    DurationConfig durations = g_duration_config;
+    if (load_config_file(g_config_path, &config, bands, &band_count, &durations) != 0) return -1;
+    if (!fft_config_equal(&config, &g_fft_config)) {
+        g_fft_config = config;
+        g_fft_config_dirty = 1;
+    }
+    set_extra_bands(bands, band_count);
+    set_duration_config(&durations);
+    return 0;
+}
+
+// Re-reads the config file when its modification time changes, checking at
+// most once per CONFIG_POLL_MS.
+void poll_config_file() {
+    Uint32 now = SDL_GetTicks();
+    if (now - g_config_checked < CONFIG_POLL_MS) return;
+    g_config_checked = now;
+    struct stat st;
+    if (stat(g_config_path, &st) != 0 || st.st_mtime == g_config_mtime) return;
+    if (read_config_file(0) == 0) {
+        add_log_entry("Config reloaded.");
+        apply_fft_config();
+    } else {
+        add_log_entry("Config has errors; keeping current settings.");
+    }
+}
+
+// --- Batched FFT ---
+//
+// When analysis has fallen behind, frames are transformed as a batch rather
+// than with one cdft() or codelet call each. Two real frames share one
+// complex transform, one in the real and one in the imaginary part, and
+// FFT_BATCH_LANES such transforms are laid out point by point, so every
+// butterfly runs over a short vector of lanes with one twiddle. Bit reversal
+// and windowing happen while the frames are loaded, and the transforms are
+// separated straight into the power spectra the analysis reads.
+
+// One radix-2 butterfly on every lane. The lanes of a and b never overlap,
+// which restrict tells the compiler so it can vectorize across them.
+void fft_batch_butterfly(double* restrict a_re, double* restrict a_im, double* restrict b_re, double* restrict b_im,
+                         double wr, double wi) {
+    for (int l = 0; l < FFT_BATCH_LANES; l++) {
+        double t_re = wr * b_re[l] - wi * b_im[l];
+        double t_im = wr * b_im[l] + wi * b_re[l];
+        b_re[l] = a_re[l] - t_re;
+        b_im[l] = a_im[l] - t_im;
+        a_re[l] += t_re;
+        a_im[l] += t_im;
+    }
+}
+
+// Two radix-2 stages fused on every lane: points 0 and 1, and 2 and 3, are
+// combined with twiddle w1 = W(2h)^k, then 0 and 2 with w2 = W(4h)^k and 1
+// and 3 with W(4h)^(k+h) = -j w2, without storing in between.
+void fft_batch_radix4(double* restrict r0, double* restrict i0, double* restrict r1, double* restrict i1,
+                      double* restrict r2, double* restrict i2, double* restrict r3, double* restrict i3,
+                      const double* w1, const double* w2) {
+    double w1r = w1[0], w1i = w1[1], w2r = w2[0], w2i = w2[1];
+    for (int l = 0; l < FFT_BATCH_LANES; l++) {
+        double ar = w1r * r1[l] - w1i * i1[l], ai = w1r * i1[l] + w1i * r1[l];
+        double br = w1r * r3[l] - w1i * i3[l], bi = w1r * i3[l] + w1i * r3[l];
+        double y0r = r0[l] + ar, y0i = i0[l] + ai, y1r = r0[l] - ar, y1i = i0[l] - ai;
+        double y2r = r2[l] + br, y2i = i2[l] + bi, y3r = r2[l] - br, y3i = i2[l] - bi;
+        double ur = w2r * y2r - w2i * y2i, ui = w2r * y2i + w2i * y2r;
+        double vr = w2r * y3i + w2i * y3r, vi = w2i * y3i - w2r * y3r; // -j w2 y3
+        r0[l] = y0r + ur;
+        i0[l] = y0i + ui;
+        r2[l] = y0r - ur;
+        i2[l] = y0i - ui;
+        r1[l] = y1r + vr;
+        i1[l] = y1i + vi;
+        r3[l] = y1r - vr;
+        i3[l] = y1i - vi;
+    }
+}
+
+// Transforms count real frames, reading every stride-th double from each
+// and windowing them when window is set, into power spectra of n / 2 + 1
+// bins.
+void fft_batch_execute(FftPlan* plan, const double* const* frames, int count, int stride, const float* window,
+                       double* const* power) {
+    int n = plan->config.size;
+    double* re = plan->batch_re;
+    double* im = plan->batch_im;
+    const double* twiddle = plan->batch_twiddle;
+    const int* bitrev = plan->batch_bitrev;
+    for (int first = 0; first < count; first += FFT_BATCH_FRAMES) {
+        int here = count - first < FFT_BATCH_FRAMES ? count - first : FFT_BATCH_FRAMES;
+        // A short batch reads its first frame in place of the missing ones,
+        // scaled to zero, so the load loop has no branches.
+        const double* src[FFT_BATCH_FRAMES];
+        double scale[FFT_BATCH_FRAMES];
+        for (int f = 0; f < FFT_BATCH_FRAMES; f++) {
+            src[f] = frames[first + (f < here ? f : 0)];
+            scale[f] = f < here ? 1.0 : 0.0;
+        }
+        for (int i = 0; i < n; i++) {
+            int j = bitrev[i];
+            double w = window ? window[j] : 1.0;
+            for (int l = 0; l < FFT_BATCH_LANES; l++) {
+                re[i * FFT_BATCH_LANES + l] = src[l * 2][j * stride] * scale[l * 2] * w;
+                im[i * FFT_BATCH_LANES + l] = src[l * 2 + 1][j * stride] * scale[l * 2 + 1] * w;
+            }
+        }
+
+        // Decimation in time over all lanes at once, two radix-2 stages per
+        // pass, after a single one when log2(n) is odd.
+        int half = 1;
+        if (!(n & 0x55555555)) {
+            for (int a = 0; a < n * FFT_BATCH_LANES; a += 2 * FFT_BATCH_LANES) {
+                fft_batch_butterfly(re + a, im + a, re + a + FFT_BATCH_LANES, im + a + FFT_BATCH_LANES, 1.0, 0.0);
+            }
+            half = 2;
+        }
+        for (; half < n; half *= 4) {
+            int step = n / (half * 4);
+            int span = half * FFT_BATCH_LANES;
+            for (int start = 0; start < n; start += half * 4) {
+                for (int k = 0; k < half; k++) {
+                    const double* w1 = twiddle + k * step * 4; // W(2 half)^k
+                    const double* w2 = twiddle + k * step * 2; // W(4 half)^k
+                    int a = (start + k) * FFT_BATCH_LANES;
+                    fft_batch_radix4(re + a, im + a, re + a + span, im + a + span, re + a + span * 2,
+                                     im + a + span * 2, re + a + span * 3, im + a + span * 3, w1, w2);
+                }
+            }
+        }
+
+        // Split each transform into its two frames, as tdoa_separate() does,
+        // and keep only their power.
+        for (int k = 0; k <= n / 2; k++) {
+            int m = (n - k) & (n - 1);
+            for (int l = 0; l * 2 < here; l++) {
+                double zr = re[k * FFT_BATCH_LANES + l], zi = im[k * FFT_BATCH_LANES + l];
+                double wr = re[m * FFT_BATCH_LANES + l], wi = im[m * FFT_BATCH_LANES + l];
+                power[first + l * 2][k] = 0.25 * ((zr + wr) * (zr + wr) + (zi - wi) * (zi - wi));
+                if (l * 2 + 1 < here) {
+                    power[first + l * 2 + 1][k] = 0.25 * ((zi + wi) * (zi + wi) + (zr - wr) * (zr - wr));
+                }
+            }
+        }
+    }
+}
+
+// Once FFT_BATCH_MIN frames are queued, transforms those that share the
+// oldest frame's plan in one batch; process_fft() then finds their power
+// spectra ready. --tdoa frames carry the second microphone in their
+// imaginary part, so they are always transformed one at a time.
+void fft_catch_up() {
+    int queued = SDL_AtomicGet(&g_fft_ready);
+    if (g_tdoa_enabled || queued < FFT_BATCH_MIN) return;
+    FftPlan* plan = g_fft_frames[g_fft_frame_tail].plan;
+    int n = plan->config.size;
+    const double* frames[FFT_FRAME_SLOTS];
+    double* power[FFT_FRAME_SLOTS];
+    int slots[FFT_FRAME_SLOTS];
+    int count = 0;
+    for (int i = 0; i < queued; i++) {
+        int slot = (g_fft_frame_tail + i) % FFT_FRAME_SLOTS;
+        if (g_fft_frames[slot].plan != plan || plan->batched[slot]) break;
+        frames[count] = plan->frame + (size_t)slot * n * 2;
+        power[count] = plan->batch_power + (size_t)slot * (n / 2 + 1);
+        slots[count++] = slot;
+    }
+    if (count < FFT_BATCH_MIN) return;
+    Uint64 start_ticks = SDL_GetPerformanceCounter();
+    fft_batch_execute(plan, frames, count, 2, NULL, power);
+    plan->batch_ticks = (SDL_GetPerformanceCounter() - start_ticks) / count;
+    for (int i = 0; i < count; i++) plan->batched[slots[i]] = 1;
+    g_hops_batched += count;
+}
+
+// Times batched execution against one transform per frame, on the same
+// overlapping frames of noise at the current FFT configuration. Both paths
+// start from raw samples and end with power spectra: the per-frame path
+// windows into a complex frame as the audio callback does, then transforms
+// it with the codelets or cdft() and takes the power, as process_fft() does.
+int run_batch_benchmark(int frames) {
+    FftPlan plan;
+    if (frames < 1 || fft_plan_build(&plan, &g_fft_config) != 0) {
+        fprintf(stderr, "bench-batch: invalid frame count or out of memory\n");
+        return 1;
+    }
+    int n = plan.config.size;
+    int bins = n / 2 + 1;
+    size_t length = (size_t)plan.hop * (frames - 1) + n;
+    double* signal = (double*)malloc(length * sizeof(double));
+    double* single = (double*)malloc((size_t)frames * bins * sizeof(double));
+    double* batched = (double*)malloc((size_t)frames * bins * sizeof(double));
+    const double** inputs = (const double**)malloc(frames * sizeof(double*));
+    double** outputs = (double**)malloc(frames * sizeof(double*));
+    if (!signal || !single || !batched || !inputs || !outputs) {
+        fprintf(stderr, "bench-batch: out of memory\n");
+        free(signal);
+        free(single);
+        free(batched);
+        free(inputs);
+        free(outputs);
+        fft_plan_free(&plan);
+        return 1;
+    }
+    Uint32 rng = 1;
+    for (size_t i = 0; i < length; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        signal[i] = ((double)rng / 4294967295.0 - 0.5) * 0.5 + 0.25 * sin(2.0 * M_PI * 19000.0 * i / SAMPLE_RATE);
+    }
+    for (int f = 0; f < frames; f++) {
+        inputs[f] = signal + (size_t)f * plan.hop;
+        outputs[f] = batched + (size_t)f * bins;
+    }
+
+    double ticks_per_us = SDL_GetPerformanceFrequency() / 1e6;
+    double single_us = 1e30, batch_us = 1e30;
+    for (int round = 0; round < FFT_BATCH_BENCH_ROUNDS; round++) {
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        for (int f = 0; f < frames; f++) {
+            for (int j = 0; j < n; j++) {
+                plan.frame[j * 2] = inputs[f][j] * plan.window[j];
+                plan.frame[j * 2 + 1] = 0.0;
+            }
+            fft_plan_execute(&plan, plan.frame);
+            fft_power(plan.spectrum, single + (size_t)f * bins, n);
+        }
+        single_us = fmin(single_us, (SDL_GetPerformanceCounter() - t0) / ticks_per_us);
+
+        t0 = SDL_GetPerformanceCounter();
+        fft_batch_execute(&plan, inputs, frames, 1, plan.window, outputs);
+        batch_us = fmin(batch_us, (SDL_GetPerformanceCounter() - t0) / ticks_per_us);
+    }
+
+    double max_error = 0.0, peak = 0.0;
+    for (size_t i = 0; i < (size_t)frames * bins; i++) {
+        max_error = fmax(max_error, fabs(single[i] - batched[i]));
+        peak = fmax(peak, single[i]);
+    }
+    printf("FFT %d %s, hop %d: %d frames x %d rounds (best round), %s per frame\n", n, window_name(plan.config.window),
+           plan.hop, frames, FFT_BATCH_BENCH_ROUNDS, plan.ip ? "cdft()" : "codelets");
+    printf("  per frame: %10.0f frames/s (%.2f us each)\n", frames / single_us * 1e6, single_us / frames);
+    printf("  batched:   %10.0f frames/s (%.2f us each)\n", frames / batch_us * 1e6, batch_us / frames);
+    printf("  gain %.2fx, max power difference %.3g of peak\n", single_us / batch_us, max_error / peak);
+    free(signal);
+    free(single);
+    free(batched);
+    free(inputs);
+    free(outputs);
+    fft_plan_free(&plan);
+    return max_error / peak < 1e-9 ? 0 : 1;
+}
+
+// --- Sliding-DFT Burst Detector ---
+//
+// Runs inside the audio callback ahead of the FFT framing, so a burst is seen
+// within a window of SDFT_DEFAULT_WINDOW samples instead of a 2048-sample
+// hop. Cost is O(bins) per sample; it is timed per callback and published as
+// ns/sample and as a share of the callback's real-time budget.
+
+int sdft_init(SlidingDft* d, int window, float threshold_db) {
+    memset(d, 0, sizeof(*d));
+    if (window < SDFT_MIN_WINDOW || window > SDFT_MAX_WINDOW) return -1;
+    float bin_hz = (float)SAMPLE_RATE / window;
+    // Only bins whose centre lies inside the band, and never the Nyquist bin:
+    // at short windows rounding outward would add bins kilohertz away.
+    int first = (int)ceilf(MIN_FREQ_TO_DISPLAY / bin_hz);
+    int last = (int)floorf(MAX_FREQ_TO_DISPLAY / bin_hz);
+    if (last > window / 2 - 1) last = window / 2 - 1;
+    if (last < first || last - first + 1 > SDFT_MAX_BINS) return -1;
+
+    d->window = window;
+    d->first_bin = first;
+    d->num_bins = last - first + 1;
+    for (int k = 0; k < d->num_bins; k++) {
+        double angle = 2.0 * M_PI * (first + k) / window;
+        d->coeff_re[k] = (float)cos(angle);
+        d->coeff_im[k] = (float)sin(angle);
+    }
+    d->comb_gain = powf(SDFT_DAMPING, (float)window);
+    // An in-bin sine of amplitude A gives |S_k| = A*M/2, so 4/M^2 * |S|^2 = A^2.
+    float scale = (float)window * window / 4.0f;
+    d->on_energy = powf(10.0f, threshold_db / 10.0f) * scale;
+    d->off_energy = powf(10.0f, (threshold_db - SDFT_HYSTERESIS_DB) / 10.0f) * scale;
+    d->energy_to_dbfs = -10.0f * log10f(scale);
+    return 0;
+}
+
+void sdft_reset(SlidingDft* d) {
+    memset(d->state_re, 0, sizeof(d->state_re));
+    memset(d->state_im, 0, sizeof(d->state_im));
+    memset(d->history, 0, sizeof(d->history));
+    d->history_pos = 0;
+    d->active = 0;
+    SDL_AtomicSet(&g_sdft_active, 0);
+    d->hold = 0;
+}
+
+int sdft_strongest_bin(const SlidingDft* d) {
+    int best = 0;
+    float best_energy = -1.0f;
+    for (int k = 0; k < d->num_bins; k++) {
+        float e = d->state_re[k] * d->state_re[k] + d->state_im[k] * d->state_im[k];
+        if (e > best_energy) {
+            best_energy = e;
+            best = k;
+        }
+    }
+    return best;
+}
+
+void sdft_push_event(SdftEventType type, Uint64 sample, float level_db, float freq_hz, float duration) {
+    BusMessage message;
+    message.type = BUS_SDFT;
+    message.data.sdft.type = type;
+    message.data.sdft.sample = sample;
+    message.data.sdft.level_db = level_db;
+    message.data.sdft.freq_hz = freq_hz;
+    message.data.sdft.duration = duration;
+    if (!bus_post(&message)) SDL_AtomicAdd(&g_sdft_events_dropped, 1);
+}
+
+// Audio thread. Applies the same gain and clipping as the FFT path, then
+// advances every bin by one sample and runs the onset/offset state machine.
+// An offset needs a full window below the hysteresis level, and is stamped
+// at the first of those samples.
+void sdft_process(SlidingDft* d, const Sint16* samples, int count, float linear_gain) {
+    Uint64 start_ticks = SDL_GetPerformanceCounter();
+    float bin_hz = (float)SAMPLE_RATE / d->window;
+
+    for (int i = 0; i < count; i++) {
+        float x = fmaxf(-32767.0f, fminf(32767.0f, (float)samples[i] * linear_gain)) / 32768.0f;
+        float comb = x - d->comb_gain * d->history[d->history_pos];
+        d->history[d->history_pos] = x;
+        if (++d->history_pos == d->window) d->history_pos = 0;
+
+        float energy = 0.0f;
+        for (int k = 0; k < d->num_bins; k++) {
+            float re = SDFT_DAMPING * d->state_re[k] + comb;
+            float im = SDFT_DAMPING * d->state_im[k];
+            float out_re = re * d->coeff_re[k] - im * d->coeff_im[k];
+            float out_im = re * d->coeff_im[k] + im * d->coeff_re[k];
+            d->state_re[k] = out_re;
+            d->state_im[k] = out_im;
+            energy += out_re * out_re + out_im * out_im;
+        }
+
+        Uint64 n = g_samples_captured + i;
+        if (!d->active) {
+            if (energy > d->on_energy) {
+                d->active = 1;
+                SDL_AtomicSet(&g_sdft_active, 1);
+                d->hold = 0;
+                d->onset_sample = n;
+                d->peak_energy = energy;
+                d->peak_bin = sdft_strongest_bin(d);
+                float level = 10.0f * log10f(energy) + d->energy_to_dbfs;
+                float freq = (d->first_bin + d->peak_bin) * bin_hz;
+                sdft_push_event(SDFT_ONSET, n, level, freq, 0.0f);
+                export_push(&g_export_audio_queue, RECORD_FAST_ONSET, 0, 0, level, freq);
+            }
+        } else {
+            if (energy > d->peak_energy) {
+                d->peak_energy = energy;
+                d->peak_bin = sdft_strongest_bin(d);
+            }
+            if (energy < d->off_energy) {
+                if (++d->hold >= d->window) {
+                    Uint64 offset = n - d->hold + 1;
+                    float duration = (float)(offset - d->onset_sample) / SAMPLE_RATE;
+                    float level = 10.0f * log10f(d->peak_energy) + d->energy_to_dbfs;
+                    float freq = (d->first_bin + d->peak_bin) * bin_hz;
+                    d->active = 0;
+                    SDL_AtomicSet(&g_sdft_active, 0);
+                    sdft_push_event(SDFT_OFFSET, offset, level, freq, duration);
+                    export_push(&g_export_audio_queue, RECORD_FAST_OFFSET, 0, 0, duration, freq);
+                }
+            } else {
+                d->hold = 0;
+            }
+        }
+    }
+
+    Uint64 ticks = SDL_GetPerformanceCounter() - start_ticks;
+    double ticks_per_sample = (double)SDL_GetPerformanceFrequency() / SAMPLE_RATE;
+    Uint64 ppm = (Uint64)(ticks * 1e6 / (count * ticks_per_sample));
+    if (ppm > g_sdft_window_worst) g_sdft_window_worst = ppm;
+    g_sdft_window_ticks += ticks;
+    g_sdft_window_samples += count;
+    if (g_sdft_window_samples >= SAMPLE_RATE) {
+        double ns = g_sdft_window_ticks * 1e9 / SDL_GetPerformanceFrequency() / g_sdft_window_samples;
+        SDL_AtomicSet(&g_sdft_ns_x100, (int)(ns * 100.0));
+        SDL_AtomicSet(&g_sdft_load_ppm, (int)(g_sdft_window_ticks * 1e6 / (g_sdft_window_samples * ticks_per_sample)));
+        SDL_AtomicSet(&g_sdft_worst_ppm, (int)g_sdft_window_worst);
+        g_sdft_window_ticks = 0;
+        g_sdft_window_samples = 0;
+        g_sdft_window_worst = 0;
+    }
+}
+
+// --- Two-Microphone Localization ---
+//
+// With --tdoa the capture device is opened in stereo. Both channels share one
+// complex FFT per hop, the first microphone in the real part and the second
+// in the imaginary part; since both are real, their spectra separate again
+// from Z[k] and Z[n-k], so the second channel costs no extra transform. While
+// the primary band is in a burst, A[k] B*[k] is summed over its bins. When
+// the burst ends the sum is PHAT weighted (each bin reduced to its phase) and
+// the generalized cross-correlation is evaluated directly on a quarter-sample
+// grid over the lags the microphone spacing allows, then on a finer grid
+// around the best one, so the delay comes out to a fraction of a sample
+// without an inverse FFT.
+
+void tdoa_separate(double* spectrum, double* spectrum_b, int n) {
+    for (int k = 0; k <= n / 2; k++) {
+        int m = (n - k) & (n - 1);
+        double zr = spectrum[k * 2], zi = spectrum[k * 2 + 1];
+        double wr = spectrum[m * 2], wi = spectrum[m * 2 + 1];
+        // A = (Z[k] + Z*[n-k]) / 2, B = (Z[k] - Z*[n-k]) / 2j. Bins above
+        // n/2 are left holding Z and are not read again.
+        spectrum[k * 2] = 0.5 * (zr + wr);
+        spectrum[k * 2 + 1] = 0.5 * (zi - wi);
+        spectrum_b[k * 2] = 0.5 * (zi + wi);
+        spectrum_b[k * 2 + 1] = -0.5 * (zr - wr);
+    }
+}
+
+void tdoa_reset(TdoaState* t) {
+    if (t->hops) memset(t->cross, 0, (size_t)(t->n / 2 + 1) * 2 * sizeof(double));
+    t->hops = 0;
+}
+
+void tdoa_accumulate(TdoaState* t, const double* a, const double* b, int n, int min_bin, int max_bin) {
+    if (t->n != n || t->min_bin != min_bin || t->max_bin != max_bin) {
+        // The FFT size or band changed mid-burst; start over.
+        tdoa_reset(t);
+        t->n = n;
+        t->min_bin = min_bin;
+        t->max_bin = max_bin;
+    }
+    for (int k = min_bin; k <= max_bin; k++) {
+        double ar = a[k * 2], ai = a[k * 2 + 1], br = b[k * 2], bi = b[k * 2 + 1];
+        t->cross[k * 2] += ar * br + ai * bi;
+        t->cross[k * 2 + 1] += ai * br - ar * bi;
+    }
+    t->hops++;
+}
+
+// Sum over the band of Re(G[k] e^(-j 2pi k lag / n)) for the PHAT-weighted
+// cross-spectrum G, at any real lag.
+double tdoa_correlation(const TdoaState* t, double lag) {
+    double step = -2.0 * M_PI * lag / t->n;
+    double c = cos(step * t->min_bin), s = sin(step * t->min_bin);
+    double dc = cos(step), ds = sin(step);
+    double sum = 0.0;
+    for (int k = t->min_bin; k <= t->max_bin; k++) {
+        sum += t->cross[k * 2] * c - t->cross[k * 2 + 1] * s;
+        double next = c * dc - s * ds;
+        s = s * dc + c * ds;
+        c = next;
+    }
+    return sum;
+}
+
+// Estimates the delay of the second microphone behind the first from the
+// burst's summed cross-spectrum, then clears it. Returns -1 without data.
+int tdoa_estimate(TdoaState* t, float spacing_m, TdoaResult* out) {
+    if (t->hops == 0) return -1;
+    int bins = 0;
+    for (int k = t->min_bin; k <= t->max_bin; k++) {
+        double mag = hypot(t->cross[k * 2], t->cross[k * 2 + 1]);
+        if (mag > 0.0) {
+            t->cross[k * 2] /= mag;
+            t->cross[k * 2 + 1] /= mag;
+            bins++;
+        }
+    }
+    if (bins == 0) {
+        tdoa_reset(t);
+        return -1;
+    }
+
+    double max_delay = spacing_m / TDOA_SPEED_OF_SOUND * SAMPLE_RATE;
+    int max_step = (int)ceil(fmin(max_delay + 1.0, TDOA_MAX_LAG) * TDOA_COARSE_STEPS);
+    // The band is narrow next to its centre frequency, so the correlation
+    // oscillates at the carrier, about two samples per cycle near the top of
+    // the band at 44.1 kHz; whole-sample lags can all miss the peak. Search at
+    // a quarter sample, refine around the best, and fit a parabola to the
+    // best three fine points.
+    int best = 0;
+    double best_value = -1e300;
+    for (int step = -max_step; step <= max_step; step++) {
+        double v = tdoa_correlation(t, (double)step / TDOA_COARSE_STEPS);
+        if (v > best_value) {
+            best_value = v;
+            best = step;
+        }
+    }
+    double fine[TDOA_REFINE_STEPS * 2 + 1];
+    int fine_best = TDOA_REFINE_STEPS;
+    for (int i = 0; i <= TDOA_REFINE_STEPS * 2; i++) {
+        fine[i] = tdoa_correlation(
+            t, (best + (double)(i - TDOA_REFINE_STEPS) / TDOA_REFINE_STEPS) / TDOA_COARSE_STEPS);
+        if (fine[i] > fine[fine_best]) fine_best = i;
+    }
+    double offset = 0.0;
+    if (fine_best > 0 && fine_best < TDOA_REFINE_STEPS * 2) {
+        double l = fine[fine_best - 1], c = fine[fine_best], r = fine[fine_best + 1];
+        double denom = l - 2.0 * c + r;
+        if (denom < 0.0) offset = 0.5 * (l - r) / denom;
+    }
+    double delay = (best + (fine_best - TDOA_REFINE_STEPS + offset) / TDOA_REFINE_STEPS) / TDOA_COARSE_STEPS;
+    if (delay > max_delay) delay = max_delay;
+    if (delay < -max_delay) delay = -max_delay;
+
+    out->delay_samples = (float)delay;
+    out->bearing_deg = (float)(asin(delay / max_delay) * 180.0 / M_PI);
+    out->coherence = (float)(fine[fine_best] / bins);
+    tdoa_reset(t);
+    return 0;
+}
+
+double tdoa_test_signal(const TdoaTestBurst* burst, double t) {
+    if (t < 0.0 || t >= burst->length) return 0.0;
+    double env = sin(M_PI * t / burst->length);
+    double s = 0.0;
+    t /= SAMPLE_RATE;
+    if (burst->chirp) {
+        double rate = (burst->f1 - burst->f0) * SAMPLE_RATE / burst->length;
+        s = sin(2.0 * M_PI * (burst->f0 * t + 0.5 * rate * t * t));
+    } else {
+        for (int i = 0; i < TDOA_TEST_TONES; i++) {
+            s += sin(2.0 * M_PI * burst->freq[i] * t + burst->phase[i]);
+        }
+        s /= sqrt(TDOA_TEST_TONES / 2.0);
+    }
+    return 0.1 * env * s;
+}
+
+// Offline check against known delays: seeded chirps and noise-like bursts in
+// the primary band, defined in closed form so the second channel can be
+// delayed by an exact fraction of a sample (up to the largest delay the
+// spacing allows), each channel with its own noise. Frames go through the
+// same packing, separation and estimation as live capture.
+int run_tdoa_test(int trials) {
+    float spacing = g_tdoa_spacing_m > 0.0f ? g_tdoa_spacing_m : 0.1f;
+    FftPlan plan;
+    if (fft_plan_build(&plan, &g_fft_config) != 0) return 1;
+    int n = plan.config.size, hop = plan.hop;
+    int length = n * 2 + SAMPLE_RATE / 20;
+    float* a = (float*)malloc(length * sizeof(float));
+    float* b = (float*)malloc(length * sizeof(float));
+    TdoaState* t = (TdoaState*)calloc(1, sizeof(TdoaState));
+    TdoaTestBurst burst;
+    if (!a || !b || !t) return 1;
+
+    SynthConfig cfg = g_synth_config;
+    SynthState st;
+    synth_init(&st, &cfg);
+    int min_bin, max_bin;
+    band_bins(&g_bands[0].spec, n, &min_bin, &max_bin);
+    double max_delay = spacing / TDOA_SPEED_OF_SOUND * SAMPLE_RATE;
+    double ticks_per_us = SDL_GetPerformanceFrequency() / 1e6;
+    Uint64 fft_ticks = 0, tdoa_ticks = 0, estimate_ticks = 0;
+    int frames = 0, within_tenth = 0;
+    double sum_abs = 0.0, worst = 0.0, sum_bearing = 0.0;
+
+    printf("TDOA test: %d trials, %d Hz, FFT %d hop %d, %.2f m spacing (max delay %.2f samples), band %.0f-%.0f Hz, "
+           "noise %.0f dBFS\n",
+           trials, SAMPLE_RATE, n, hop, spacing, max_delay, g_bands[0].spec.min_hz, g_bands[0].spec.max_hz,
+           cfg.noise_db);
+    for (int trial = 0; trial < trials; trial++) {
+        double delay = (synth_uniform(&st) * 2.0 - 1.0) * 0.95 * max_delay;
+        burst.chirp = trial % 2 == 0;
+        burst.length = SAMPLE_RATE / 20 - (int)(synth_uniform(&st) * SAMPLE_RATE / 40); // 25-50 ms
+        burst.f0 = g_bands[0].spec.min_hz + 250.0;
+        burst.f1 = fmin(g_bands[0].spec.max_hz, SAMPLE_RATE / 2.0) - 250.0;
+        for (int i = 0; i < TDOA_TEST_TONES; i++) {
+            burst.freq[i] = burst.f0 + synth_uniform(&st) * (burst.f1 - burst.f0);
+            burst.phase[i] = synth_uniform(&st) * 2.0 * M_PI;
+        }
+        for (int i = 0; i < length; i++) {
+            a[i] = (float)tdoa_test_signal(&burst, i - n) + st.noise_amp * (synth_uniform(&st) * 2.0f - 1.0f);
+            b[i] = (float)tdoa_test_signal(&burst, i - n - delay) + st.noise_amp * (synth_uniform(&st) * 2.0f - 1.0f);
+        }
+
+        // Hops overlapping the burst, as the band detector would pass them.
+        tdoa_reset(t);
+        for (int start = 0; start + n <= length; start += hop) {
+            if (start + n <= n || start >= n + burst.length) continue;
+            for (int j = 0; j < n; j++) {
+                plan.frame[j * 2] = a[start + j] * plan.window[j];
+                plan.frame[j * 2 + 1] = b[start + j] * plan.window[j];
+            }
+            Uint64 t0 = SDL_GetPerformanceCounter();
+            fft_plan_execute(&plan, plan.frame);
+            Uint64 t1 = SDL_GetPerformanceCounter();
+            tdoa_separate(plan.spectrum, plan.spectrum_b, n);
+            tdoa_accumulate(t, plan.spectrum, plan.spectrum_b, n, min_bin, max_bin);
+            Uint64 t2 = SDL_GetPerformanceCounter();
+            fft_ticks += t1 - t0;
+            tdoa_ticks += t2 - t1;
+            frames++;
+        }
+        TdoaResult r;
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        int ok = tdoa_estimate(t, spacing, &r);
+        estimate_ticks += SDL_GetPerformanceCounter() - t0;
+        double error = ok == 0 ? fabs(r.delay_samples - delay) : 2.0 * max_delay;
+        double true_bearing = asin(delay / max_delay) * 180.0 / M_PI;
+        sum_abs += error;
+        sum_bearing += ok == 0 ? fabs(r.bearing_deg - true_bearing) : 180.0;
+        if (error > worst) worst = error;
+        if (error <= 0.1) within_tenth++;
+    }
+
+    double hop_us = 1e6 * hop / SAMPLE_RATE;
+    double fft_us = fft_ticks / ticks_per_us / frames, tdoa_us = tdoa_ticks / ticks_per_us / frames;
+    printf("delay error: mean %.3f samples (%.2f us), worst %.3f samples; %.1f%% within 0.1 sample; "
+           "mean bearing error %.2f deg\n",
+           sum_abs / trials, sum_abs / trials * 1e6 / SAMPLE_RATE, worst, 100.0 * within_tenth / trials,
+           sum_bearing / trials);
+    printf("cost per hop: FFT of both channels %.1f us + separation and cross-spectrum %.1f us = %.2f%% of the "
+           "%.0f us hop; estimate %.1f us per burst\n",
+           fft_us, tdoa_us, 100.0 * (fft_us + tdoa_us) / hop_us, hop_us, estimate_ticks / ticks_per_us / trials);
+    free(a);
+    free(b);
+    free(t);
+    fft_plan_free(&plan);
+    return 0;
+}
+
+// --- Long-Term Survey ---
+//
+// Site baselining: with --survey every hop's power spectrum is folded into
+// g_survey, and a snapshot of the mean (Welch) level, percentiles and
+// max-hold per bin is written to a CSV file every period of audio time and
+// at exit. The per-hop work is a pass over n / 2 bins with no allocation;
+// the percentile queries and file I/O only run when a snapshot is taken.
+
+// 10 log10(power) from the float's exponent and a quadratic fit of log2 over
+// its mantissa. Within 0.015 dB, which is plenty for 1 dB histogram buckets,
+// and much cheaper than log10() for every bin of every hop.
+float survey_fast_db(float power) {
+    union {
+        float f;
+        Uint32 i;
+    } u = {power};
+    float exponent = (float)((int)((u.i >> 23) & 255) - 128);
+    u.i = (u.i & 0x007FFFFF) | 0x3F800000;
+    float m = u.f;
+    return 3.01029996f * (exponent + (-0.34484843f * m + 2.02466578f) * m - 0.67487759f);
+}
+
+void survey_reset(SurveyState* s, const FftPlan* plan, Uint64 end_sample) {
+    int half = plan->config.size / 2;
+    s->n = plan->config.size;
+    s->window = plan->config.window;
+    s->group = half > SURVEY_MAX_BINS ? half / SURVEY_MAX_BINS : 1;
+    s->bins = half / s->group;
+    s->level_db = plan->level_db;
+    s->hops = 0;
+    s->first_sample = end_sample > (Uint64)s->n ? end_sample - s->n : 0;
+    s->last_sample = end_sample;
+    s->next_snapshot = end_sample + (Uint64)(g_survey_period_s * SAMPLE_RATE);
+    s->hist_hops = 0;
+    s->started = time(NULL);
+    memset(s->power, 0, sizeof(s->power));
+    memset(s->max_power, 0, sizeof(s->max_power));
+    memset(s->hist, 0, sizeof(s->hist));
+}
+
+// Folds one hop's spectrum into the survey. Survey bins wider than an FFT bin
+// sum their FFT bins' power, so a tone reads at the same level either way.
+void survey_add(SurveyState* s, const FftPlan* plan, const double* power, Uint64 end_sample) {
+    if (s->hops == 0 || s->n != plan->config.size || s->window != plan->config.window) {
+        if (s->hops) {
+            if (survey_export(s, g_survey_path) == 0) g_survey_snapshots++;
+            add_log_entry("Survey restarted for the new FFT settings.");
+        }
+        survey_reset(s, plan, end_sample);
+    }
+    // Split into passes so everything but the scattered histogram updates
+    // vectorizes.
+    float bin_power[SURVEY_MAX_BINS];
+    if (s->group == 1) {
+        for (int j = 0; j < s->bins; j++) bin_power[j] = (float)power[j];
+    } else {
+        for (int j = 0, k = 0; j < s->bins; j++) {
+            double sum = 0.0;
+            for (int g = 0; g < s->group; g++, k++) sum += power[k];
+            bin_power[j] = (float)sum;
+        }
+    }
+    for (int j = 0; j < s->bins; j++) {
+        s->power[j] += bin_power[j];
+        s->max_power[j] = bin_power[j] > s->max_power[j] ? bin_power[j] : s->max_power[j];
+    }
+    float offset = (float)(s->level_db - SURVEY_HIST_MIN_DB);
+    int bucket[SURVEY_MAX_BINS];
+    for (int j = 0; j < s->bins; j++) {
+        int b = (int)(survey_fast_db(bin_power[j] + 1e-12f) + offset);
+        b = b < 0 ? 0 : b;
+        bucket[j] = b < SURVEY_HIST_BUCKETS ? b : SURVEY_HIST_BUCKETS - 1;
+    }
+    for (int j = 0; j < s->bins; j++) s->hist[j][bucket[j]]++;
+    if (++s->hist_hops == SURVEY_HIST_HALVE) {
+        // Halving every bucket keeps the distribution, and its quantiles,
+        // while the counts stay far from overflowing.
+        for (int j = 0; j < s->bins; j++) {
+            for (int b = 0; b < SURVEY_HIST_BUCKETS; b++) s->hist[j][b] = (s->hist[j][b] + 1) / 2;
+        }
+        s->hist_hops /= 2;
+    }
+    s->hops++;
+    s->last_sample = end_sample;
+}
+
+// Level in dB below which a fraction q of the bin's hops fell, interpolated
+// within the 1 dB bucket it lands in.
+float survey_quantile_db(const SurveyState* s, int bin, float q) {
+    const Uint32* hist = s->hist[bin];
+    Uint64 total = 0;
+    for (int b = 0; b < SURVEY_HIST_BUCKETS; b++) total += hist[b];
+    double target = q * (double)total;
+    Uint64 below = 0;
+    for (int b = 0; b < SURVEY_HIST_BUCKETS; b++) {
+        if (hist[b] && below + hist[b] >= target) {
+            return SURVEY_HIST_MIN_DB + b + (float)((target - below) / hist[b]);
+        }
+        below += hist[b];
+    }
+    return SURVEY_HIST_MIN_DB + SURVEY_HIST_BUCKETS;
+}
+
+// Writes a snapshot to a temporary file and renames it over the previous
+// one, so a reader never sees a half-written survey.
+int survey_export(const SurveyState* s, const char* path) {
+    char temp_path[sizeof(g_survey_path) + 4];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* f = fopen(temp_path, "w");
+    if (!f) {
+        SDL_Log("Survey: cannot write %s", temp_path);
+        return -1;
+    }
+    char started[32];
+    strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", localtime(&s->started));
+    double bin_hz = (double)SAMPLE_RATE * s->group / s->n;
+    fprintf(f, "# survey started %s, %.1f s of audio, %llu hops\n", started,
+            (double)(s->last_sample - s->first_sample) / SAMPLE_RATE, (unsigned long long)s->hops);
+    fprintf(f, "# FFT %d %s, %d bins of %.2f Hz, levels in dB as displayed\n", s->n, window_name(s->window), s->bins,
+            bin_hz);
+    fprintf(f, "freq_hz,mean_db,p10_db,p50_db,p90_db,p99_db,max_db\n");
+    for (int j = 0; j < s->bins; j++) {
+        double mean_db = 10 * log10(fmax(1e-12, s->power[j] / s->hops)) + s->level_db;
+        double max_db = 10 * log10(fmax(1e-12, s->max_power[j])) + s->level_db;
+        fprintf(f, "%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n", (j + 0.5) * bin_hz - 0.5 * SAMPLE_RATE / s->n, mean_db,
+                survey_quantile_db(s, j, 0.10f), survey_quantile_db(s, j, 0.50f), survey_quantile_db(s, j, 0.90f),
+                survey_quantile_db(s, j, 0.99f), max_db);
+    }
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed) {
+        SDL_Log("Survey: error writing %s", temp_path);
+        remove(temp_path);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(path); // rename() does not replace an existing file here
+#endif
+    if (rename(temp_path, path) != 0) {
+        SDL_Log("Survey: cannot replace %s", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Takes the periodic snapshot once enough audio has been surveyed. Called
+// from the analysis loops, never from process_fft().
+void poll_survey() {
+    if (!g_survey_enabled || !g_survey.hops || g_survey.last_sample < g_survey.next_snapshot) return;
+    Uint64 start_ticks = SDL_GetPerformanceCounter();
+    if (survey_export(&g_survey, g_survey_path) == 0) {
+        g_survey_snapshots++;
+    } else {
+        add_log_entry("Survey snapshot failed.");
+    }
+    g_survey_export_ms = (float)((SDL_GetPerformanceCounter() - start_ticks) * 1000.0 / SDL_GetPerformanceFrequency());
+    g_survey.next_snapshot = g_survey.last_sample + (Uint64)(g_survey_period_s * SAMPLE_RATE);
+}
+
+// --- Ultrasonic Monitor ---
+//
+// Makes the 18-22 kHz band audible. The audio callback copies each gained
+// capture block into g_monitor_ring; the playback device's callback does
+// all of the DSP in fixed blocks with state allocated up front, so neither
+// the capture path nor analysis pay for it. Two live modes are offered:
+//   heterodyne: high-pass at the LO, mix with the LO, low-pass the
+//     difference, so LO + f is heard at f (tunable, like a bat detector);
+//   divider: clock a square wave off every N-th zero crossing and give it
+//     the input's envelope, so the whole band is heard at 1/N pitch.
+// Saved recordings can also be time-expanded by playing them at a fraction
+// of their sample rate (--expand).
+
+const char* monitor_mode_name(MonitorMode mode) {
+    switch (mode) {
+        case MONITOR_HETERODYNE: return "heterodyne";
+        case MONITOR_DIVIDER: return "divider";
+        default: return "off";
+    }
+}
+
+// Second-order Butterworth section (RBJ cookbook); q = 0.5412 and 1.3066
+// cascade to fourth order.
+void biquad_design(Biquad* f, int highpass, float cutoff_hz, float q) {
+    double w0 = 2.0 * M_PI * cutoff_hz / SAMPLE_RATE;
+    double cw = cos(w0), alpha = sin(w0) / (2.0 * q);
+    double a0 = 1.0 + alpha;
+    double b1 = highpass ? -(1.0 + cw) : 1.0 - cw;
+    f->b0 = (float)(fabs(b1) / 2.0 / a0);
+    f->b1 = (float)(b1 / a0);
+    f->b2 = f->b0;
+    f->a1 = (float)(-2.0 * cw / a0);
+    f->a2 = (float)((1.0 - alpha) / a0);
+    f->z1 = f->z2 = 0.0f;
+}
+
+// Transposed direct form II, in place over a block.
+void biquad_process(Biquad* f, float* x, int count) {
+    float z1 = f->z1, z2 = f->z2;
+    for (int i = 0; i < count; i++) {
+        float in = x[i];
+        float out = f->b0 * in + z1;
+        z1 = f->b1 * in - f->a1 * out + z2;
+        z2 = f->b2 * in - f->a2 * out;
+        x[i] = out;
+    }
+    f->z1 = z1;
+    f->z2 = z2;
+}
+
+void monitor_configure(MonitorDsp* dsp, MonitorMode mode, int lo_hz) {
+    memset(dsp, 0, sizeof(*dsp));
+    dsp->mode = mode;
+    dsp->lo_hz = lo_hz;
+    dsp->divide = g_monitor_divide;
+    dsp->sign = 1.0f;
+    dsp->release = (float)exp(-1.0 / (MONITOR_RELEASE_S * SAMPLE_RATE));
+    biquad_design(&dsp->highpass[0], 1, (float)lo_hz, 0.5412f);
+    biquad_design(&dsp->highpass[1], 1, (float)lo_hz, 1.3066f);
+    biquad_design(&dsp->lowpass[0], 0, MONITOR_AUDIO_BW_HZ, 0.5412f);
+    biquad_design(&dsp->lowpass[1], 0, MONITOR_AUDIO_BW_HZ, 1.3066f);
+    dsp->lo_re = 1.0;
+    dsp->lo_im = 0.0;
+    dsp->lo_step_re = cos(2.0 * M_PI * lo_hz / SAMPLE_RATE);
+    dsp->lo_step_im = sin(2.0 * M_PI * lo_hz / SAMPLE_RATE);
+}
+
+void monitor_process(MonitorDsp* dsp, float* x, int count) {
+    biquad_process(&dsp->highpass[0], x, count);
+    biquad_process(&dsp->highpass[1], x, count);
+    if (dsp->mode == MONITOR_HETERODYNE) {
+        double re = dsp->lo_re, im = dsp->lo_im;
+        for (int i = 0; i < count; i++) {
+            x[i] *= (float)(2.0 * re);
+            double next = re * dsp->lo_step_re - im * dsp->lo_step_im;
+            im = re * dsp->lo_step_im + im * dsp->lo_step_re;
+            re = next;
+        }
+        // Renormalize once per block so the phasor does not drift in level.
+        double mag = sqrt(re * re + im * im);
+        dsp->lo_re = re / mag;
+        dsp->lo_im = im / mag;
+    } else {
+        for (int i = 0; i < count; i++) {
+            float a = fabsf(x[i]);
+            dsp->envelope = a > dsp->envelope ? a : dsp->envelope * dsp->release;
+            if (x[i] < -MONITOR_DIVIDER_HYSTERESIS) {
+                dsp->armed = 1;
+            } else if (dsp->armed && x[i] > MONITOR_DIVIDER_HYSTERESIS) {
+                dsp->armed = 0;
+                if (++dsp->crossings >= dsp->divide / 2) {
+                    dsp->crossings = 0;
+                    dsp->sign = -dsp->sign;
+                }
+            }
+            x[i] = dsp->sign * dsp->envelope;
+        }
+    }
+    biquad_process(&dsp->lowpass[0], x, count);
+    biquad_process(&dsp->lowpass[1], x, count);
+}
+
+// Playback device callback. Drains g_monitor_ring through the DSP; when the
+// ring has backed up past MONITOR_MAX_QUEUE (the two devices' clocks differ
+// slightly) it skips ahead rather than let latency grow.
+void playback_callback(void* userdata, Uint8* stream, int len) {
+    Sint16* out = (Sint16*)stream;
+    int count = len / (int)sizeof(Sint16);
+    Uint64 start_ticks = SDL_GetPerformanceCounter();
+    MonitorDsp* dsp = &g_monitor_dsp;
+    MonitorMode mode = (MonitorMode)SDL_AtomicGet(&g_monitor_mode);
+    int lo_hz = SDL_AtomicGet(&g_monitor_lo_hz);
+    Uint32 head = (Uint32)SDL_AtomicGet(&g_monitor_ring_head);
+    Uint32 tail = (Uint32)SDL_AtomicGet(&g_monitor_ring_tail);
+    if (mode != dsp->mode || lo_hz != dsp->lo_hz) {
+        monitor_configure(dsp, mode, lo_hz);
+        tail = head;
+    }
+    if (head - tail > MONITOR_MAX_QUEUE) {
+        tail = head - MONITOR_TARGET_QUEUE;
+        SDL_AtomicAdd(&g_monitor_skips, 1);
+    }
+
+    // Capture-to-ear latency of the first sample written here: its age in
+    // the ring plus the time until the device plays it.
+    Uint32 stamp_head = (Uint32)SDL_AtomicGet(&g_monitor_stamp_head);
+    if (stamp_head > 0 && head != tail) {
+        const MonitorStamp* stamp = &g_monitor_stamps[(stamp_head - 1) % MONITOR_STAMP_QUEUE];
+        double age_s = (double)(start_ticks - stamp->ticks) / SDL_GetPerformanceFrequency() +
+                       (double)(Sint32)(stamp->end_sample - tail) / SAMPLE_RATE;
+        Uint32 latency_us = (Uint32)(1e6 * (age_s + (double)g_monitor_device_samples / SAMPLE_RATE));
+        g_monitor_latency_sum_us += latency_us;
+        g_monitor_latency_count++;
+        if (latency_us > g_monitor_latency_peak_us) g_monitor_latency_peak_us = latency_us;
+    }
+
+    for (int done = 0; done < count;) {
+        int n = count - done > MONITOR_BLOCK_SAMPLES ? MONITOR_BLOCK_SAMPLES : count - done;
+        int avail = (int)(head - tail) < n ? (int)(head - tail) : n;
+        for (int i = 0; i < avail; i++) {
+            g_monitor_block[i] = g_monitor_ring[(tail + i) & (MONITOR_RING_SIZE - 1)];
+        }
+        if (avail < n) {
+            memset(g_monitor_block + avail, 0, (n - avail) * sizeof(float));
+            if (mode != MONITOR_OFF) SDL_AtomicAdd(&g_monitor_underruns, 1);
+        }
+        tail += avail;
+        monitor_process(dsp, g_monitor_block, n);
+        for (int i = 0; i < n; i++) {
+            float v = fmaxf(-1.0f, fminf(1.0f, g_monitor_block[i]));
+            out[done + i] = (Sint16)(v * 32767.0f);
+        }
+        done += n;
+    }
+    SDL_AtomicSet(&g_monitor_ring_tail, (int)tail);
+
+    g_monitor_window_ticks += SDL_GetPerformanceCounter() - start_ticks;
+    g_monitor_window_samples += count;
+    if (g_monitor_window_samples >= SAMPLE_RATE) {
+        double ns = 1e9 * g_monitor_window_ticks / SDL_GetPerformanceFrequency() / g_monitor_window_samples;
+        SDL_AtomicSet(&g_monitor_ns_x100, (int)(ns * 100.0));
+        if (g_monitor_latency_count) {
+            SDL_AtomicSet(&g_monitor_latency_us, (int)(g_monitor_latency_sum_us / g_monitor_latency_count));
+            SDL_AtomicSet(&g_monitor_latency_max_us, (int)g_monitor_latency_peak_us);
+        }
+        g_monitor_window_ticks = 0;
+        g_monitor_window_samples = 0;
+        g_monitor_latency_sum_us = 0;
+        g_monitor_latency_count = 0;
+        g_monitor_latency_peak_us = 0;
+    }
+}
+
+// Opens the playback device on first use. Main thread only.
+int start_monitor() {
+    if (g_playback_device_id != 0) return 0;
+    if (!SDL_WasInit(SDL_INIT_AUDIO) && SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        SDL_Log("SDL audio could not initialize: %s", SDL_GetError());
+        return -1;
+    }
+    SDL_AudioSpec want, have;
+    SDL_zero(want);
+    want.freq = SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = MONITOR_BLOCK_SAMPLES;
+    want.callback = playback_callback;
+    g_playback_device_id = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (g_playback_device_id == 0) {
+        SDL_Log("Failed to open playback device: %s", SDL_GetError());
+        return -1;
+    }
+    g_monitor_device_samples = have.samples;
+    return 0;
+}
+
+void stop_monitor() {
+    if (g_playback_device_id != 0) {
+        SDL_CloseAudioDevice(g_playback_device_id);
+        g_playback_device_id = 0;
+    }
+}
+
+void set_monitor_mode(MonitorMode mode) {
+    if (mode != MONITOR_OFF && start_monitor() != 0) {
+        add_log_entry("Monitor: no playback device.");
+        mode = MONITOR_OFF;
+    }
+    SDL_AtomicSet(&g_monitor_mode, mode);
+    if (g_playback_device_id != 0) SDL_PauseAudioDevice(g_playback_device_id, mode == MONITOR_OFF || g_is_paused);
+
+    char log[100];
+    if (mode == MONITOR_HETERODYNE) {
+        snprintf(log, sizeof(log), "Monitor: heterodyne, %d-%d Hz heard as 0-%d Hz", SDL_AtomicGet(&g_monitor_lo_hz),
+                 SDL_AtomicGet(&g_monitor_lo_hz) + MONITOR_AUDIO_BW_HZ, MONITOR_AUDIO_BW_HZ);
+    } else if (mode == MONITOR_DIVIDER) {
+        snprintf(log, sizeof(log), "Monitor: frequency divider /%d above %d Hz", g_monitor_divide,
+                 SDL_AtomicGet(&g_monitor_lo_hz));
+    } else {
+        snprintf(log, sizeof(log), "Monitor: off");
+    }
+    add_log_entry(log);
+}
+
+// Loads a 16-bit mono WAV or an EVPC recording.
+int load_recording(const char* path, Sint16** samples, Uint32* count, Uint32* sample_rate) {
+    if (read_wav_pcm16(path, samples, count, sample_rate) == 0) return 0;
+    FILE* wav = tmpfile();
+    if (!wav) return -1;
+    EvpcDecodeStats stats;
+    int rc = evpc_decode_file(path, wav, &stats);
+    if (rc == 0) {
+        rewind(wav);
+        rc = read_wav_pcm16_file(wav, samples, count, sample_rate);
+    }
+    fclose(wav);
+    return rc;
+}
+
+// Time expansion: played at 1/factor of its sample rate a recording keeps
+// its waveform, and every frequency and duration scales by the same factor
+// (a 19.5 kHz, 30 ms chirp becomes 1.95 kHz over 300 ms). SDL resamples to
+// whatever the device supports. With out_path the result is written as a
+// WAV file at the reduced rate instead.
+int run_expand_tool(const char* in_path, int factor, const char* out_path) {
+    Sint16* samples;
+    Uint32 count, sample_rate;
+    if (factor < 2 || load_recording(in_path, &samples, &count, &sample_rate) != 0) {
+        fprintf(stderr, "expand: %s is not a readable WAV/EVPC recording (or factor < 2)\n", in_path);
+        return 1;
+    }
+    int rate = (int)sample_rate / factor;
+    double seconds = (double)count / rate;
+    if (out_path) {
+        FILE* out = fopen(out_path, "wb");
+        if (!out) {
+            fprintf(stderr, "expand: cannot create %s\n", out_path);
+            free(samples);
+            return 1;
+        }
+        write_wav_header(out, (unsigned int)rate, count * sizeof(Sint16));
+        fwrite(samples, sizeof(Sint16), count, out);
+        fclose(out);
+        printf("%s: %u samples at %d Hz, %.2f s (%dx expanded)\n", out_path, count, rate, seconds, factor);
+        free(samples);
+        return 0;
+    }
+
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+        fprintf(stderr, "expand: SDL audio could not initialize: %s\n", SDL_GetError());
+        free(samples);
+        return 1;
+    }
+    SDL_AudioSpec want, have;
+    SDL_zero(want);
+    want.freq = rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = 1024;
+    SDL_AudioDeviceID device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (device == 0 || SDL_QueueAudio(device, samples, count * sizeof(Sint16)) != 0) {
+        fprintf(stderr, "expand: cannot play audio: %s\n", SDL_GetError());
+        if (device) SDL_CloseAudioDevice(device);
+        free(samples);
+        SDL_Quit();
+        return 1;
+    }
+    free(samples);
+    signal(SIGINT, handle_sigint);
+    printf("Playing %s: %.2f s of audio %dx expanded to %.2f s (Ctrl-C stops)\n", in_path,
+           (double)count / sample_rate, factor, seconds);
+    fflush(stdout);
+    SDL_PauseAudioDevice(device, 0);
+    while (!g_quit_requested && SDL_GetQueuedAudioSize(device) > 0) {
+        SDL_Delay(50);
+    }
+    if (!g_quit_requested) SDL_Delay(1000 * have.samples / have.freq + 50); // Let the last buffer play
+    SDL_CloseAudioDevice(device);
+    SDL_Quit();
+    return 0;
+}
+
+// --- Fingerprint Index ---
+//
+// Each recording is reduced to landmark pairs: the few spectral peaks of each
+// frame that stand out from the bins around them, each paired with the
+// strongest of the peaks in the next FP_TARGET_DT frames. A pair hashes the two frequencies and the gap between
+// them, which survive noise, level changes and a different start point. Two
+// recordings of the same sound share many hashes at one constant time offset;
+// unrelated ones share a few, scattered over many offsets.
+//
+// BASE.idx holds a FP_HEADER_SIZE header (magic, version, bucket bits,
+// sample rate, recordings, postings, names size), a directory of where each
+// bucket of hashes starts, the postings sorted by hash, and the recording
+// names, all little-endian. It is searched in place through a memory map and
+// only ever replaced whole, by a merge. Recordings indexed since are appended
+// to BASE.log as self-checking records (magic, recording, hash count, name
+// length, CRC, then the name and the hashes), so adding one never rewrites the
+// index. A record cut short by a crash is dropped when the log is next read.
+
+int map_file(const char* path, MappedFile* m) {
+    memset(m, 0, sizeof(*m));
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return -1;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return -1;
+    }
+    m->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!m->mapping) return -1;
+    m->data = (const Uint8*)MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m->data) {
+        CloseHandle(m->mapping);
+        m->mapping = NULL;
+        return -1;
+    }
+    m->size = (size_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    m->data = (const Uint8*)data;
+    m->size = (size_t)st.st_size;
+#endif
+    return 0;
+}
+
+void unmap_file(MappedFile* m) {
+    if (!m->data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(m->data);
+    CloseHandle(m->mapping);
+#else
+    munmap((void*)m->data, m->size);
+#endif
+    memset(m, 0, sizeof(*m));
+}
+
+// Finds the landmarks of a mono recording at SAMPLE_RATE and pairs them into
+// hashes, in anchor order. *hashes is allocated; the caller frees it.
+int fp_extract(const Sint16* samples, Uint32 count, FpHash** hashes, int* hash_count) {
+    enum { BINS = FP_FFT_SIZE / 2 };
+    typedef struct {
+        int frame;
+        int bin;
+        float db;
+    } Landmark;
+    *hashes = NULL;
+    *hash_count = 0;
+    FftConfig config = {FP_FFT_SIZE, WINDOW_HANN, 0.5f};
+    FftPlan plan;
+    if (fft_plan_build(&plan, &config) != 0) return -1;
+    int frames = count >= FP_FFT_SIZE ? (int)((count - FP_FFT_SIZE) / FP_HOP) + 1 : 0;
+    Landmark* peaks = (Landmark*)malloc(((size_t)frames * FP_PEAKS_PER_FRAME + 1) * sizeof(Landmark));
+    if (!peaks) {
+        fft_plan_free(&plan);
+        return -1;
+    }
+
+    // The noise floor starts at silence, since a recording may well begin in
+    // the middle of a sound, and climbs to the noise from there.
+    float row[BINS], floor_db[BINS];
+    for (int k = 0; k < BINS; k++) floor_db[k] = survey_fast_db(FP_QUIET_POWER);
+    int peak_count = 0;
+    for (int t = 0; t < frames; t++) {
+        const Sint16* x = samples + (size_t)t * FP_HOP;
+        for (int j = 0; j < FP_FFT_SIZE; j++) {
+            plan.frame[j * 2] = x[j] * (plan.window[j] / 32768.0);
+            plan.frame[j * 2 + 1] = 0.0;
+        }
+        fft_plan_execute(&plan, plan.frame);
+        fft_power(plan.spectrum, plan.power, FP_FFT_SIZE);
+        for (int k = FP_MIN_BIN; k <= FP_MAX_BIN; k++) row[k] = survey_fast_db((float)plan.power[k] + FP_QUIET_POWER);
+        int first = peak_count;
+        for (int k = FP_MIN_BIN + 1; k < FP_MAX_BIN; k++) {
+            float v = row[k];
+            int lo = k - FP_PEAK_DF < FP_MIN_BIN ? FP_MIN_BIN : k - FP_PEAK_DF;
+            int hi = k + FP_PEAK_DF > FP_MAX_BIN ? FP_MAX_BIN : k + FP_PEAK_DF;
+            // A landmark is the highest of its neighbours, clears their mean
+            // by FP_PEAK_PROMINENCE_DB, which noise-like sound seldom does,
+            // and its bin's noise floor by FP_PEAK_MIN_DB. The floor falls
+            // quickly and rises slowly, so it stays under sounds and settles
+            // a little below the noise.
+            int is_peak = v > row[k - 1] && v > row[k + 1] && v >= floor_db[k] + FP_PEAK_MIN_DB;
+            float sum = 0.0f;
+            for (int i = lo; i <= hi && is_peak; i++) {
+                is_peak = row[i] <= v;
+                sum += row[i];
+            }
+            if (!is_peak || v < sum / (hi - lo + 1) + FP_PEAK_PROMINENCE_DB) continue;
+            // Keep the frame's strongest, in descending order
+            if (peak_count - first == FP_PEAKS_PER_FRAME && v <= peaks[peak_count - 1].db) continue;
+            int i = peak_count - first < FP_PEAKS_PER_FRAME ? peak_count++ : peak_count - 1;
+            for (; i > first && peaks[i - 1].db < v; i--) peaks[i] = peaks[i - 1];
+            peaks[i].frame = t;
+            peaks[i].bin = k;
+            peaks[i].db = v;
+        }
+        for (int k = FP_MIN_BIN; k <= FP_MAX_BIN; k++) {
+            floor_db[k] += (row[k] < floor_db[k] ? FP_FLOOR_FALL : FP_FLOOR_RISE) * (row[k] - floor_db[k]);
+        }
+    }
+    fft_plan_free(&plan);
+
+    FpHash* out = (FpHash*)malloc(((size_t)peak_count * FP_FANOUT + 1) * sizeof(FpHash));
+    if (!out) {
+        free(peaks);
+        return -1;
+    }
+    // Each landmark anchors pairs with the strongest landmarks in a zone
+    // after it. Strong ones are the likeliest to be found again in another
+    // take of the same sound.
+    int n = 0, frame_start = 0, previous_start = 0;
+    for (int i = 0; i < peak_count; i++) {
+        if (i == 0 || peaks[i].frame != peaks[i - 1].frame) {
+            previous_start = i > 0 && peaks[i].frame == peaks[i - 1].frame + 1 ? frame_start : n;
+            frame_start = n;
+        }
+        int targets[FP_FANOUT], pairs = 0;
+        for (int j = i + 1; j < peak_count && peaks[j].frame - peaks[i].frame <= FP_TARGET_DT; j++) {
+            int df = abs(peaks[j].bin - peaks[i].bin);
+            if (peaks[j].frame == peaks[i].frame || df < FP_TARGET_MIN_DF) continue;
+            if (pairs == FP_FANOUT && peaks[j].db <= peaks[targets[pairs - 1]].db) continue;
+            int k = pairs < FP_FANOUT ? pairs++ : pairs - 1;
+            for (; k > 0 && peaks[targets[k - 1]].db < peaks[j].db; k--) targets[k] = targets[k - 1];
+            targets[k] = j;
+        }
+        for (int k = 0; k < pairs; k++) {
+            const Landmark* target = &peaks[targets[k]];
+            Uint32 hash = (Uint32)peaks[i].bin << 15 | (Uint32)target->bin << 6 | (Uint32)(target->frame - peaks[i].frame);
+            // Two steady sounds give the same pair frame after frame; only
+            // its first frame is kept, or they would outvote everything else.
+            int repeated = 0;
+            for (int r = previous_start; r < frame_start && !repeated; r++) repeated = out[r].hash == hash;
+            if (repeated) continue;
+            out[n].hash = hash;
+            out[n].frame = (Uint32)peaks[i].frame;
+            n++;
+        }
+    }
+    free(peaks);
+    *hashes = out;
+    *hash_count = n;
+    return 0;
+}
+
+// Fingerprints a WAV or EVPC recording. Recordings at another sample rate
+// would never match, so they are refused.
+int fp_fingerprint_file(const char* path, FpHash** hashes, int* hash_count, double* seconds) {
+    Sint16* samples;
+    Uint32 count, sample_rate;
+    if (load_recording(path, &samples, &count, &sample_rate) != 0) return -1;
+    int rc = sample_rate == SAMPLE_RATE ? fp_extract(samples, count, hashes, hash_count) : -1;
+    if (seconds) *seconds = (double)count / sample_rate;
+    free(samples);
+    return rc;
+}
+
+int compare_fp_postings(const void* a, const void* b) {
+    const FpPosting* pa = (const FpPosting*)a;
+    const FpPosting* pb = (const FpPosting*)b;
+    if (pa->hash != pb->hash) return pa->hash < pb->hash ? -1 : 1;
+    return pa->ref < pb->ref ? -1 : pa->ref > pb->ref;
+}
+
+// Adds a recording's hashes to the in-memory part of the index.
+int fp_log_add(FpIndex* index, const char* name, const FpHash* hashes, int count) {
+    if (index->log_count + count > index->log_capacity) {
+        int capacity = index->log_capacity ? index->log_capacity : 4096;
+        while (capacity < index->log_count + count) capacity *= 2;
+        FpPosting* postings = (FpPosting*)realloc(index->log_postings, (size_t)capacity * sizeof(FpPosting));
+        if (!postings) return -1;
+        index->log_postings = postings;
+        index->log_capacity = capacity;
+    }
+    if (index->log_recordings == index->log_names_capacity) {
+        Uint32 capacity = index->log_names_capacity ? index->log_names_capacity * 2 : 64;
+        char(*names)[FP_NAME_SIZE] = (char(*)[FP_NAME_SIZE])realloc(index->log_names, capacity * FP_NAME_SIZE);
+        if (!names) return -1;
+        index->log_names = names;
+        index->log_names_capacity = capacity;
+    }
+    Uint32 recording = index->recordings + index->log_recordings;
+    for (int i = 0; i < count; i++) {
+        FpPosting* p = &index->log_postings[index->log_count++];
+        p->hash = hashes[i].hash;
+        p->ref = recording << FP_TIME_BITS | (hashes[i].frame & ((1u << FP_TIME_BITS) - 1));
+    }
+    snprintf(index->log_names[index->log_recordings++], FP_NAME_SIZE, "%s", name);
+    index->log_sorted = 0;
+    return 0;
+}
+
+// Maps BASE.idx and reads BASE.log. Neither needs to exist. Returns -1 if
+// the index is damaged or was built for another sample rate.
+int fp_index_open(FpIndex* index, const char* base) {
+    memset(index, 0, sizeof(*index));
+    snprintf(index->base, sizeof(index->base), "%s", base);
+    char path[FP_NAME_SIZE + 8];
+    snprintf(path, sizeof(path), "%s.idx", base);
+    if (map_file(path, &index->map) == 0) {
+        const Uint8* h = index->map.data;
+        size_t directory_size = ((1u << FP_BUCKET_BITS) + 1) * 4;
+        int ok = index->map.size >= FP_HEADER_SIZE + directory_size && get_le32(h) == FP_INDEX_MAGIC &&
+                 get_le16(h + 4) == FP_VERSION && get_le16(h + 6) == FP_BUCKET_BITS && get_le32(h + 8) == SAMPLE_RATE;
+        if (ok) {
+            index->recordings = get_le32(h + 12);
+            index->postings = get_le32(h + 16);
+            index->names_size = get_le32(h + 20);
+            index->directory = h + FP_HEADER_SIZE;
+            index->entries = index->directory + directory_size;
+            index->name_offsets = index->entries + (size_t)index->postings * 8;
+            index->names = index->name_offsets + (size_t)index->recordings * 4;
+            ok = index->recordings <= FP_MAX_RECORDINGS &&
+                 index->map.size == FP_HEADER_SIZE + directory_size + (size_t)index->postings * 8 +
+                                        (size_t)index->recordings * 4 + index->names_size &&
+                 (index->names_size == 0 || index->names[index->names_size - 1] == '\0');
+            // Lookups trust the directory, so check it once here
+            for (Uint32 b = 0; ok && b < (1u << FP_BUCKET_BITS); b++) {
+                ok = get_le32(index->directory + b * 4) <= get_le32(index->directory + b * 4 + 4);
+            }
+            ok = ok && get_le32(index->directory) == 0 &&
+                 get_le32(index->directory + (1u << FP_BUCKET_BITS) * 4) == index->postings;
+        }
+        if (!ok) {
+            fp_index_close(index);
+            return -1;
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s.log", base);
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    Uint8* data = size > 0 ? (Uint8*)malloc(size) : NULL;
+    int read_ok = data && fread(data, 1, size, file) == (size_t)size;
+    fclose(file);
+    if (!read_ok) {
+        free(data);
+        return 0;
+    }
+    size_t pos = 0;
+    while (pos + FP_LOG_HEADER_SIZE <= (size_t)size) {
+        const Uint8* r = data + pos;
+        Uint32 recording = get_le32(r + 4);
+        Uint32 count = get_le32(r + 8);
+        Uint16 name_len = get_le16(r + 12);
+        size_t left = (size_t)size - pos - FP_LOG_HEADER_SIZE;
+        if (get_le32(r) != FP_LOG_MAGIC || name_len >= FP_NAME_SIZE || name_len > left ||
+            count > (left - name_len) / 8) {
+            break;
+        }
+        size_t len = FP_LOG_HEADER_SIZE + name_len + (size_t)count * 8;
+        Uint32 crc = crc32_update(0, r, 16);
+        crc = crc32_update(crc, r + FP_LOG_HEADER_SIZE, len - FP_LOG_HEADER_SIZE);
+        if (crc != get_le32(r + 16)) break;
+        if (recording >= index->recordings) { // Otherwise merged already, by a merge the log outlived
+            if (recording != index->recordings + index->log_recordings) break;
+            char name[FP_NAME_SIZE];
+            memcpy(name, r + FP_LOG_HEADER_SIZE, name_len);
+            name[name_len] = '\0';
+            FpHash* hashes = (FpHash*)malloc(((size_t)count + 1) * sizeof(FpHash));
+            if (!hashes) break;
+            for (Uint32 i = 0; i < count; i++) {
+                hashes[i].hash = get_le32(r + FP_LOG_HEADER_SIZE + name_len + i * 8);
+                hashes[i].frame = get_le32(r + FP_LOG_HEADER_SIZE + name_len + i * 8 + 4);
+            }
+            int rc = fp_log_add(index, name, hashes, (int)count);
+            free(hashes);
+            if (rc != 0) break;
+        }
+        pos += len;
+    }
+    if (pos < (size_t)size) {
+        // Keep only the intact records, so later appends are not lost behind
+        // a damaged one.
+        SDL_Log("Index log %s: dropping %ld damaged bytes", path, size - (long)pos);
+        file = fopen(path, "wb");
+        if (file) {
+            fwrite(data, 1, pos, file);
+            fclose(file);
+        }
+    }
+    free(data);
+    return 0;
+}
+
+void fp_index_close(FpIndex* index) {
+    unmap_file(&index->map);
+    free(index->log_postings);
+    free(index->log_names);
+    index->log_postings = NULL;
+    index->log_names = NULL;
+    index->log_count = index->log_capacity = 0;
+    index->log_recordings = index->log_names_capacity = 0;
+    index->recordings = index->postings = index->names_size = 0;
+}
+
+const char* fp_recording_name(const FpIndex* index, Uint32 recording) {
+    if (recording < index->recordings) {
+        Uint32 offset = get_le32(index->name_offsets + recording * 4);
+        return offset < index->names_size ? (const char*)index->names + offset : "?";
+    }
+    recording -= index->recordings;
+    return recording < index->log_recordings ? index->log_names[recording] : "?";
+}
+
+int fp_index_contains(const FpIndex* index, const char* name) {
+    for (Uint32 r = 0; r < index->recordings + index->log_recordings; r++) {
+        if (strcmp(fp_recording_name(index, r), name) == 0) return 1;
+    }
+    return 0;
+}
+
+// Appends a recording to BASE.log and to the in-memory index. Returns 1,
+// adding nothing, if a recording of that name is already indexed.
+int fp_index_append(FpIndex* index, const char* name, const FpHash* hashes, int count) {
+    if (fp_index_contains(index, name)) return 1;
+    size_t name_len = strlen(name);
+    Uint32 recording = index->recordings + index->log_recordings;
+    if (name_len >= FP_NAME_SIZE || recording >= FP_MAX_RECORDINGS) return -1;
+    size_t len = FP_LOG_HEADER_SIZE + name_len + (size_t)count * 8;
+    Uint8* r = (Uint8*)malloc(len);
+    if (!r) return -1;
+    put_le32(r, FP_LOG_MAGIC);
+    put_le32(r + 4, recording);
+    put_le32(r + 8, (Uint32)count);
+    put_le16(r + 12, (Uint16)name_len);
+    put_le16(r + 14, 0);
+    memcpy(r + FP_LOG_HEADER_SIZE, name, name_len);
+    Uint8* p = r + FP_LOG_HEADER_SIZE + name_len;
+    for (int i = 0; i < count; i++, p += 8) {
+        put_le32(p, hashes[i].hash);
+        put_le32(p + 4, hashes[i].frame);
+    }
+    Uint32 crc = crc32_update(0, r, 16);
+    put_le32(r + 16, crc32_update(crc, r + FP_LOG_HEADER_SIZE, len - FP_LOG_HEADER_SIZE));
+
+    char path[FP_NAME_SIZE + 8];
+    snprintf(path, sizeof(path), "%s.log", index->base);
+    FILE* file = fopen(path, "ab");
+    int ok = file && fwrite(r, 1, len, file) == len;
+    if (file && fclose(file) != 0) ok = 0;
+    free(r);
+    if (!ok) return -1;
+    return fp_log_add(index, name, hashes, count);
+}
+
+// Writes BASE.idx afresh with the log folded in, then empties the log. The
+// new file replaces the old one atomically, so readers see one or the other.
+int fp_index_merge(FpIndex* index) {
+    if (!index->log_recordings) return 0;
+    if (!index->log_sorted) {
+        qsort(index->log_postings, index->log_count, sizeof(FpPosting), compare_fp_postings);
+        index->log_sorted = 1;
+    }
+    Uint64 postings = (Uint64)index->postings + index->log_count;
+    Uint64 names_size = index->names_size;
+    for (Uint32 r = 0; r < index->log_recordings; r++) names_size += strlen(index->log_names[r]) + 1;
+    if (postings > 0xFFFFFFFFu || names_size > 0xFFFFFFFFu) return -1;
+
+    Uint32 buckets = 1u << FP_BUCKET_BITS;
+    size_t head_size = FP_HEADER_SIZE + (buckets + 1) * 4;
+    Uint8* head = (Uint8*)calloc(head_size, 1);
+    Uint32* starts = (Uint32*)calloc(buckets + 1, sizeof(Uint32));
+    if (!head || !starts) {
+        free(head);
+        free(starts);
+        return -1;
+    }
+    for (Uint32 b = 0; b < buckets && index->directory; b++) {
+        starts[b + 1] = get_le32(index->directory + b * 4 + 4) - get_le32(index->directory + b * 4);
+    }
+    for (int i = 0; i < index->log_count; i++) {
+        starts[(index->log_postings[i].hash >> (FP_HASH_BITS - FP_BUCKET_BITS)) + 1]++;
+    }
+    for (Uint32 b = 0; b < buckets; b++) starts[b + 1] += starts[b];
+    put_le32(head, FP_INDEX_MAGIC);
+    put_le16(head + 4, FP_VERSION);
+    put_le16(head + 6, FP_BUCKET_BITS);
+    put_le32(head + 8, SAMPLE_RATE);
+    put_le32(head + 12, index->recordings + index->log_recordings);
+    put_le32(head + 16, (Uint32)postings);
+    put_le32(head + 20, (Uint32)names_size);
+    for (Uint32 b = 0; b <= buckets; b++) put_le32(head + FP_HEADER_SIZE + b * 4, starts[b]);
+    free(starts);
+
+    char path[FP_NAME_SIZE + 8], temp_path[FP_NAME_SIZE + 12], log_path[FP_NAME_SIZE + 8];
+    snprintf(path, sizeof(path), "%s.idx", index->base);
+    snprintf(temp_path, sizeof(temp_path), "%s.idx.tmp", index->base);
+    snprintf(log_path, sizeof(log_path), "%s.log", index->base);
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) {
+        free(head);
+        return -1;
+    }
+    fwrite(head, 1, head_size, file);
+    free(head);
+
+    // Both runs are sorted by (hash, ref), and every mapped ref is below
+    // every log ref, so a two-way merge keeps that order.
+    Uint8 buffer[8 * 1024];
+    size_t fill = 0;
+    Uint32 i = 0;
+    int j = 0;
+    while (i < index->postings || j < index->log_count) {
+        Uint32 hash, ref;
+        if (j == index->log_count ||
+            (i < index->postings && get_le32(index->entries + (size_t)i * 8) <= index->log_postings[j].hash)) {
+            hash = get_le32(index->entries + (size_t)i * 8);
+            ref = get_le32(index->entries + (size_t)i * 8 + 4);
+            i++;
+        } else {
+            hash = index->log_postings[j].hash;
+            ref = index->log_postings[j].ref;
+            j++;
+        }
+        put_le32(buffer + fill, hash);
+        put_le32(buffer + fill + 4, ref);
+        fill += 8;
+        if (fill == sizeof(buffer)) {
+            fwrite(buffer, 1, fill, file);
+            fill = 0;
+        }
+    }
+    fwrite(buffer, 1, fill, file);
+    if (index->recordings) fwrite(index->name_offsets, 4, index->recordings, file);
+    Uint32 offset = index->names_size;
+    for (Uint32 r = 0; r < index->log_recordings; r++) {
+        Uint8 le[4];
+        put_le32(le, offset);
+        fwrite(le, 1, 4, file);
+        offset += (Uint32)strlen(index->log_names[r]) + 1;
+    }
+    if (index->names_size) fwrite(index->names, 1, index->names_size, file);
+    for (Uint32 r = 0; r < index->log_recordings; r++) {
+        fwrite(index->log_names[r], 1, strlen(index->log_names[r]) + 1, file);
+    }
+    int failed = ferror(file);
+    if (fclose(file) != 0 || failed) {
+        remove(temp_path);
+        return -1;
+    }
+
+    char base[FP_NAME_SIZE];
+    snprintf(base, sizeof(base), "%s", index->base);
+    fp_index_close(index);
+#ifdef _WIN32
+    remove(path); // rename() does not replace an existing file here
+#endif
+    int rc = rename(temp_path, path) == 0 ? 0 : -1;
+    if (rc == 0) remove(log_path);
+    if (fp_index_open(index, base) != 0) rc = -1;
+    return rc;
+}
+
+// Range of postings with the given hash: [*begin, *end) of the mapped ones,
+// [*log_begin, *log_end) of the log's.
+void fp_lookup(const FpIndex* index, Uint32 hash, Uint32* begin, Uint32* end, int* log_begin, int* log_end) {
+    *begin = *end = 0;
+    if (index->directory) {
+        Uint32 bucket = hash >> (FP_HASH_BITS - FP_BUCKET_BITS);
+        Uint32 lo = get_le32(index->directory + bucket * 4), hi = get_le32(index->directory + bucket * 4 + 4);
+        while (lo < hi) {
+            Uint32 mid = lo + (hi - lo) / 2;
+            if (get_le32(index->entries + (size_t)mid * 8) < hash) lo = mid + 1;
+            else hi = mid;
+        }
+        *begin = *end = lo;
+        while (*end < index->postings && get_le32(index->entries + (size_t)*end * 8) == hash) (*end)++;
+    }
+    int lo = 0, hi = index->log_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (index->log_postings[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    *log_begin = *log_end = lo;
+    while (*log_end < index->log_count && index->log_postings[*log_end].hash == hash) (*log_end)++;
+}
+
+// Slot of key in an open-addressed vote table, or the empty slot where it
+// would go.
+Uint32 fp_vote_slot(const Uint32* keys, Uint32 slots, Uint32 key) {
+    Uint32 mask = slots - 1;
+    Uint32 i = (key * 2654435761u) & mask;
+    while (keys[i] != key && keys[i] != 0xFFFFFFFFu) i = (i + 1) & mask;
+    return i;
+}
+
+int compare_fp_matches(const void* a, const void* b) {
+    return ((const FpMatch*)b)->score - ((const FpMatch*)a)->score;
+}
+
+// Finds the indexed recordings that share the most hashes with the query at
+// one time offset. Each shared hash votes for (recording, offset); a vote
+// for the next offset also counts, since two takes of one sound can fall
+// either side of a hop boundary. Returns up to max_matches recordings with
+// at least FP_MIN_SCORE votes, best first.
+int fp_index_query(FpIndex* index, const FpHash* hashes, int count, FpMatch* matches, int max_matches) {
+    if (!index->log_sorted && index->log_count) {
+        qsort(index->log_postings, index->log_count, sizeof(FpPosting), compare_fp_postings);
+        index->log_sorted = 1;
+    }
+    size_t candidates = 0;
+    for (int q = 0; q < count; q++) {
+        Uint32 begin, end;
+        int log_begin, log_end;
+        fp_lookup(index, hashes[q].hash, &begin, &end, &log_begin, &log_end);
+        candidates += (end - begin) + (size_t)(log_end - log_begin);
+    }
+    if (!candidates) return 0;
+    Uint32 slots = 64;
+    while (slots < candidates * 2) slots <<= 1;
+    Uint32* keys = (Uint32*)malloc((size_t)slots * sizeof(Uint32));
+    int* votes = (int*)calloc(slots, sizeof(int));
+    if (!keys || !votes) {
+        free(keys);
+        free(votes);
+        return 0;
+    }
+    memset(keys, 0xFF, (size_t)slots * sizeof(Uint32)); // Recording numbers never reach the all-ones key
+
+    const Uint32 time_mask = (1u << FP_TIME_BITS) - 1;
+    for (int q = 0; q < count; q++) {
+        Uint32 begin, end;
+        int log_begin, log_end;
+        fp_lookup(index, hashes[q].hash, &begin, &end, &log_begin, &log_end);
+        for (Uint32 e = begin; e < end + (Uint32)(log_end - log_begin); e++) {
+            Uint32 ref = e < end ? get_le32(index->entries + (size_t)e * 8 + 4) : index->log_postings[log_begin + (e - end)].ref;
+            Uint32 key = (ref & ~time_mask) | ((ref - hashes[q].frame) & time_mask);
+            Uint32 slot = fp_vote_slot(keys, slots, key);
+            keys[slot] = key;
+            votes[slot]++;
+        }
+    }
+
+    int found = 0, capacity = 64;
+    FpMatch* best = (FpMatch*)malloc(capacity * sizeof(FpMatch));
+    for (Uint32 s = 0; s < slots && best; s++) {
+        if (keys[s] == 0xFFFFFFFFu) continue;
+        Uint32 next = (keys[s] & ~time_mask) | ((keys[s] + 1) & time_mask);
+        int score = votes[s] + votes[fp_vote_slot(keys, slots, next)];
+        if (score < FP_MIN_SCORE) continue;
+        if (found == capacity) {
+            capacity *= 2;
+            FpMatch* grown = (FpMatch*)realloc(best, capacity * sizeof(FpMatch));
+            if (!grown) break;
+            best = grown;
+        }
+        best[found].recording = keys[s] >> FP_TIME_BITS;
+        best[found].score = score;
+        int offset = (int)(keys[s] & time_mask);
+        best[found].offset = offset >= (1 << (FP_TIME_BITS - 1)) ? offset - (1 << FP_TIME_BITS) : offset;
+        found++;
+    }
+    free(keys);
+    free(votes);
+    if (best) qsort(best, found, sizeof(FpMatch), compare_fp_matches);
+    int n = 0;
+    for (int i = 0; i < found && n < max_matches; i++) {
+        int seen = 0;
+        for (int k = 0; k < n && !seen; k++) seen = matches[k].recording == best[i].recording;
+        if (!seen) matches[n++] = best[i];
+    }
+    free(best);
+    return n;
+}
+
+// Queues a finished recording for the indexer. Called from the writer thread
+// only; with the queue full the recording is left out of the index.
+void fp_queue_recording(const char* filename) {
+    Uint32 head = (Uint32)SDL_AtomicGet(&g_fp_queue_head);
+    if (head - (Uint32)SDL_AtomicGet(&g_fp_queue_tail) >= FP_QUEUE_SIZE) {
+        bus_post_text("Index queue full; recording not indexed.");
+        return;
+    }
+    snprintf(g_fp_queue[head & (FP_QUEUE_SIZE - 1)], sizeof(g_fp_queue[0]), "%s", filename);
+    SDL_AtomicAdd(&g_fp_queue_head, 1);
+}
+
+// Fingerprints each finished recording, reports the best earlier match and
+// adds it to the index, merging the log once FP_MERGE_RECORDINGS have built
+// up. Drains the queue before stopping.
+int fp_indexer_thread(void* data) {
+    for (;;) {
+        Uint32 tail = (Uint32)SDL_AtomicGet(&g_fp_queue_tail);
+        if ((Uint32)SDL_AtomicGet(&g_fp_queue_head) == tail) {
+            if (!SDL_AtomicGet(&g_fp_running)) break;
+            SDL_Delay(FP_POLL_MS);
+            continue;
+        }
+        char filename[sizeof(g_fp_queue[0])];
+        memcpy(filename, g_fp_queue[tail & (FP_QUEUE_SIZE - 1)], sizeof(filename));
+        SDL_AtomicAdd(&g_fp_queue_tail, 1);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        char log[BUS_TEXT_SIZE];
+        if (fp_index_contains(&g_fp_index, filename)) {
+            snprintf(log, sizeof(log), "Index: %s is already indexed", filename);
+            bus_post_text(log);
+            continue;
+        }
+        FpHash* hashes;
+        int count;
+        if (fp_fingerprint_file(filename, &hashes, &count, NULL) != 0) {
+            snprintf(log, sizeof(log), "Index: cannot read %s", filename);
+            bus_post_text(log);
+            continue;
+        }
+        FpMatch match;
+        int found = fp_index_query(&g_fp_index, hashes, count, &match, 1);
+        int rc = fp_index_append(&g_fp_index, filename, hashes, count);
+        free(hashes);
+        if (rc == 0 && g_fp_index.log_recordings >= FP_MERGE_RECORDINGS) rc = fp_index_merge(&g_fp_index);
+        double ms = 1000.0 * (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        if (rc != 0) {
+            snprintf(log, sizeof(log), "Index: cannot update %.70s", g_fp_base);
+        } else if (found) {
+            snprintf(log, sizeof(log), "Match: %s ~ %s (%d hashes)", filename,
+                     fp_recording_name(&g_fp_index, match.recording), match.score);
+        } else {
+            snprintf(log, sizeof(log), "Indexed %s: %d hashes, %.0f ms, no match", filename, count, ms);
+        }
+        bus_post_text(log);
+    }
+    fp_index_close(&g_fp_index);
+    return 0;
+}
+
+int start_indexer() {
+    if (fp_index_open(&g_fp_index, g_fp_base) != 0) {
+        SDL_Log("Fingerprint index %s.idx is damaged or was built for another sample rate", g_fp_base);
+        return -1;
+    }
+    SDL_AtomicSet(&g_fp_running, 1);
+    g_fp_thread = SDL_CreateThread(fp_indexer_thread, "fp_indexer", NULL);
+    if (!g_fp_thread) {
+        fp_index_close(&g_fp_index);
+        return -1;
+    }
+    return 0;
+}
+
+void stop_indexer() {
+    if (!g_fp_thread) return;
+    SDL_AtomicSet(&g_fp_running, 0);
+    SDL_WaitThread(g_fp_thread, NULL);
+    g_fp_thread = NULL;
+}
+
+// Adds existing recordings to the index, skipping any already in it, and
+// merges once at the end.
+int run_index_add(char** paths, int count) {
+    FpIndex index;
+    if (fp_index_open(&index, g_fp_base) != 0) {
+        fprintf(stderr, "index: %s.idx is damaged or was built for another sample rate\n", g_fp_base);
+        return 1;
+    }
+    Uint64 start = SDL_GetPerformanceCounter();
+    int added = 0, skipped = 0, failed = 0;
+    Uint64 hashes_added = 0;
+    for (int i = 0; i < count; i++) {
+        if (fp_index_contains(&index, paths[i])) {
+            skipped++;
+            continue;
+        }
+        FpHash* hashes;
+        int n;
+        if (fp_fingerprint_file(paths[i], &hashes, &n, NULL) != 0) {
+            fprintf(stderr, "index: %s is not a 16-bit mono WAV/EVPC recording at %d Hz\n", paths[i], SAMPLE_RATE);
+            failed++;
+            continue;
+        }
+        int rc = fp_index_append(&index, paths[i], hashes, n);
+        free(hashes);
+        if (rc != 0) {
+            fprintf(stderr, "index: cannot append %s to %s.log\n", paths[i], g_fp_base);
+            failed++;
+            break;
+        }
+        added++;
+        hashes_added += n;
+    }
+    if (fp_index_merge(&index) != 0) {
+        fprintf(stderr, "index: cannot write %s.idx\n", g_fp_base);
+        fp_index_close(&index);
+        return 1;
+    }
+    double ms = 1000.0 * (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    printf("indexed %d recording(s), %llu hashes in %.0f ms (%d already indexed, %d failed)\n", added,
+           (unsigned long long)hashes_added, ms, skipped, failed);
+    printf("%s.idx: %u recordings, %u hashes, %.1f MB\n", g_fp_base, index.recordings, index.postings,
+           index.map.size / 1048576.0);
+    fp_index_close(&index);
+    return failed ? 1 : 0;
+}
+
+int run_index_query(const char* path) {
+    FpHash* hashes;
+    int count;
+    double seconds;
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (fp_fingerprint_file(path, &hashes, &count, &seconds) != 0) {
+        fprintf(stderr, "query: %s is not a 16-bit mono WAV/EVPC recording at %d Hz\n", path, SAMPLE_RATE);
+        return 1;
+    }
+    Uint64 fingerprinted = SDL_GetPerformanceCounter();
+    FpIndex index;
+    if (fp_index_open(&index, g_fp_base) != 0) {
+        fprintf(stderr, "query: %s.idx is damaged or was built for another sample rate\n", g_fp_base);
+        free(hashes);
+        return 1;
+    }
+    FpMatch matches[FP_MAX_MATCHES];
+    int found = fp_index_query(&index, hashes, count, matches, FP_MAX_MATCHES);
+    Uint64 done = SDL_GetPerformanceCounter();
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    printf("%s: %.2f s, %d hashes (%.1f ms); searched %u recordings, %u hashes in %.2f ms\n", path, seconds, count,
+           1000.0 * (fingerprinted - start) / frequency, index.recordings + index.log_recordings,
+           index.postings + (Uint32)index.log_count, 1000.0 * (done - fingerprinted) / frequency);
+    for (int i = 0; i < found; i++) {
+        printf("  %-40s %5d hashes at %+.2f s\n", fp_recording_name(&index, matches[i].recording), matches[i].score,
+               matches[i].offset * (double)FP_HOP / SAMPLE_RATE);
+    }
+    if (!found) printf("  no match\n");
+    fp_index_close(&index);
+    free(hashes);
+    return 0;
+}
+
+// --- Feature Stream ---
+//
+// With --features every hop's analysis is kept as a FeatureRecord (see
+// parc_features.h): sample index, level, spectral centroid and flatness, band
+// levels and burst state, and the top peaks. process_fft() fills records in
+// place in an SPSC ring and the feature writer thread appends them to the
+// current file through a large stdio buffer, so the analysis thread never
+// waits on the disk. A full ring drops the hop, which shows as a gap in the
+// sequence numbers. A new file starts every FEATURE_FILE_SECONDS of audio and
+// whenever the band list changes. Records are written in host byte order,
+// which is little-endian everywhere PARC builds; features_view() rejects
+// anything else.
+
+// Centroid and flatness over the whole spectrum, DC and Nyquist aside, in one
+// pass. The geometric mean comes from the mean level in dB.
+void feature_spectrum(const FftPlan* plan, const double* power, float* centroid_hz, float* flatness) {
+    int half = plan->config.size / 2;
+    double total = 0.0, weighted = 0.0, db_sum = 0.0;
+    for (int i = 1; i < half; i++) {
+        float p = (float)power[i] + 1e-20f;
+        total += p;
+        weighted += (double)p * i;
+        db_sum += survey_fast_db(p);
+    }
+    int bins = half - 1;
+    *centroid_hz = (float)(weighted / total * SAMPLE_RATE / plan->config.size);
+    *flatness = fminf(1.0f, (float)(pow(10.0, db_sum / bins / 10.0) / (total / bins)));
+}
+
+// Whether the bands no longer match the current file's table. Thresholds may
+// move without starting a new file.
+int feature_layout_changed() {
+    if ((int)g_feature_layout.band_count != g_band_count) return 1;
+    for (int b = 0; b < g_band_count; b++) {
+        const FeatureBand* band = &g_feature_layout.bands[b];
+        const BandSpec* spec = &g_bands[b].spec;
+        if (memcmp(band->name, spec->name, FEATURE_BAND_NAME_SIZE) != 0 || band->min_hz != spec->min_hz ||
+            band->max_hz != spec->max_hz) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Queues the header of a new file starting with the current hop. Returns -1
+// when the writer already has FEATURE_FILE_QUEUE_SIZE files to start.
+int feature_start_file(Uint64 end_sample, Uint32 sequence) {
+    Uint32 head = (Uint32)SDL_AtomicGet(&g_feature_file_head);
+    if (head - (Uint32)SDL_AtomicGet(&g_feature_file_tail) >= FEATURE_FILE_QUEUE_SIZE) return -1;
+    FeatureHeader* header = &g_feature_files[head & (FEATURE_FILE_QUEUE_SIZE - 1)];
+    memset(header, 0, sizeof(*header));
+    header->magic = FEATURE_MAGIC;
+    header->version = FEATURE_VERSION;
+    header->header_size = sizeof(FeatureHeader);
+    header->record_size = sizeof(FeatureRecord);
+    header->max_bands = FEATURE_BANDS;
+    header->max_peaks = FEATURE_PEAKS;
+    header->sample_rate = SAMPLE_RATE;
+    header->band_count = (uint32_t)g_band_count;
+    header->first_sequence = sequence;
+    header->start_time = (int64_t)time(NULL);
+    for (int b = 0; b < g_band_count; b++) {
+        const BandSpec* spec = &g_bands[b].spec;
+        memcpy(header->bands[b].name, spec->name, FEATURE_BAND_NAME_SIZE);
+        header->bands[b].min_hz = spec->min_hz;
+        header->bands[b].max_hz = spec->max_hz;
+        header->bands[b].threshold_db = spec->threshold_db;
+    }
+    g_feature_layout = *header;
+    g_feature_file_end = end_sample + (Uint64)FEATURE_FILE_SECONDS * SAMPLE_RATE;
+    SDL_AtomicAdd(&g_feature_file_head, 1);
+    return 0;
+}
+
+// Fills the next record in place from this hop's analysis. The sequence is
+// the capture hop number, so hops the callback could not queue leave a gap
+// just like the ones dropped here. Never blocks: with the ring full, or a new
+// file that cannot be queued yet, the hop is dropped.
+void feature_push(const FftPlan* plan, const double* power, const VadFeatures* vad_f, Uint64 end_sample,
+                  Uint32 sequence) {
+    Uint32 head = (Uint32)SDL_AtomicGet(&g_feature_head);
+    if (head - (Uint32)SDL_AtomicGet(&g_feature_tail) >= FEATURE_QUEUE_SIZE ||
+        ((g_feature_file_end == 0 || end_sample >= g_feature_file_end || feature_layout_changed()) &&
+         feature_start_file(end_sample, sequence) != 0)) {
+        SDL_AtomicAdd(&g_feature_dropped, 1);
+        return;
+    }
+    FeatureRecord* record = &g_feature_queue[head & (FEATURE_QUEUE_SIZE - 1)];
+    memset(record, 0, sizeof(*record));
+    record->end_sample = end_sample;
+    record->sequence = sequence;
+    record->fft_size = (uint32_t)plan->config.size;
+    record->level_dbfs = vad_f->total_db;
+    feature_spectrum(plan, power, &record->centroid_hz, &record->flatness);
+    record->band_count = (uint8_t)g_band_count;
+    for (int b = 0; b < g_band_count; b++) {
+        record->band_db[b] = g_bands[b].level_db;
+        if (g_bands[b].state == STATE_BURST) record->burst_mask |= (uint8_t)(1 << b);
+    }
+    record->peak_count = (uint8_t)g_peak_count;
+    for (int p = 0; p < g_peak_count; p++) {
+        record->peaks[p].freq_hz = g_peaks[p].freq_hz;
+        record->peaks[p].mag_db = g_peaks[p].mag_db;
+    }
+    record->flags = (uint8_t)((g_vad.speech ? FEATURE_FLAG_SPEECH : 0) | (g_vad.active ? FEATURE_FLAG_VOICE : 0));
+    SDL_AtomicAdd(&g_feature_head, 1);
+}
+
+// Creates feat_YYYYMMDD_HHMMSS.pfs for a header, with a suffix if a file
+// started in the same second, and writes the header.
+FILE* feature_open(const FeatureHeader* header, char* path, size_t path_size, char* buffer) {
+    time_t started = (time_t)header->start_time;
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", localtime(&started));
+    snprintf(path, path_size, "feat_%s.pfs", stamp);
+    struct stat st;
+    for (int n = 2; stat(path, &st) == 0 && n < 100; n++) {
+        snprintf(path, path_size, "feat_%s_%d.pfs", stamp, n);
+    }
+    FILE* file = fopen(path, "wb");
+    if (!file) return NULL;
+    if (buffer) setvbuf(file, buffer, _IOFBF, FEATURE_IO_BUFFER);
+    if (fwrite(header, sizeof(*header), 1, file) != 1) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+// Appends queued records straight from the ring in contiguous runs, starting
+// a new file where the next queued header begins. Drains the ring before
+// stopping.
+int feature_writer_thread(void* data) {
+    char* buffer = (char*)malloc(FEATURE_IO_BUFFER);
+    FILE* file = NULL;
+    char path[64] = "";
+    char log[BUS_TEXT_SIZE];
+    Uint32 flushed = SDL_GetTicks();
+    for (;;) {
+        Uint32 tail = (Uint32)SDL_AtomicGet(&g_feature_tail);
+        Uint32 count = (Uint32)SDL_AtomicGet(&g_feature_head) - tail;
+        if (count == 0) {
+            if (!SDL_AtomicGet(&g_feature_running)) break;
+            if (file && SDL_GetTicks() - flushed >= FEATURE_FLUSH_MS) {
+                fflush(file);
+                flushed = SDL_GetTicks();
+            }
+            SDL_Delay(FEATURE_POLL_MS);
+            continue;
+        }
+        const FeatureRecord* records = &g_feature_queue[tail & (FEATURE_QUEUE_SIZE - 1)];
+        if (count > FEATURE_QUEUE_SIZE - (tail & (FEATURE_QUEUE_SIZE - 1))) {
+            count = FEATURE_QUEUE_SIZE - (tail & (FEATURE_QUEUE_SIZE - 1));
+        }
+        Uint32 file_tail = (Uint32)SDL_AtomicGet(&g_feature_file_tail);
+        if (file_tail != (Uint32)SDL_AtomicGet(&g_feature_file_head)) {
+            const FeatureHeader* next = &g_feature_files[file_tail & (FEATURE_FILE_QUEUE_SIZE - 1)];
+            if ((Sint32)(records[0].sequence - next->first_sequence) >= 0) {
+                if (file && fclose(file) != 0) {
+                    snprintf(log, sizeof(log), "Feature stream: error writing %s", path);
+                    bus_post_text(log);
+                }
+                file = feature_open(next, path, sizeof(path), buffer);
+                if (!file) {
+                    snprintf(log, sizeof(log), "Feature stream: cannot create %s", path);
+                    bus_post_text(log);
+                }
+                SDL_AtomicAdd(&g_feature_file_tail, 1);
+                continue;
+            }
+            for (Uint32 i = 1; i < count; i++) {
+                if ((Sint32)(records[i].sequence - next->first_sequence) >= 0) {
+                    count = i;
+                    break;
+                }
+            }
+        }
+        if (file && fwrite(records, sizeof(FeatureRecord), count, file) == count) {
+            SDL_AtomicAdd(&g_feature_written, (int)count);
+        } else {
+            if (file) {
+                snprintf(log, sizeof(log), "Feature stream: error writing %s", path);
+                bus_post_text(log);
+                fclose(file);
+                file = NULL;
+            }
+            SDL_AtomicAdd(&g_feature_dropped, (int)count);
+        }
+        SDL_AtomicAdd(&g_feature_tail, (int)count);
+    }
+    if (file && fclose(file) != 0) {
+        snprintf(log, sizeof(log), "Feature stream: error writing %s", path);
+        bus_post_text(log);
+    }
+    free(buffer);
+    return 0;
+}
+
+int start_feature_writer() {
+    SDL_AtomicSet(&g_feature_running, 1);
+    g_feature_thread = SDL_CreateThread(feature_writer_thread, "feature_writer", NULL);
+    return g_feature_thread ? 0 : -1;
+}
+
+void stop_feature_writer() {
+    if (!g_feature_thread) return;
+    SDL_AtomicSet(&g_feature_running, 0);
+    SDL_WaitThread(g_feature_thread, NULL);
+    g_feature_thread = NULL;
+}
+
+// Summarises a feature file read in place through a memory map, the way an
+// offline analysis would, and checks it for dropped hops.
+int run_features_stats(const char* path) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    MappedFile map;
+    FeatureView view;
+    if (map_file(path, &map) != 0 || features_view(map.data, map.size, &view) != 0) {
+        fprintf(stderr, "features: %s is not a version %d feature file\n", path, FEATURE_VERSION);
+        unmap_file(&map);
+        return 1;
+    }
+    const FeatureHeader* header = view.header;
+    double level = 0.0, centroid = 0.0, flatness = 0.0, peaks = 0.0, band_db[FEATURE_BANDS] = {0};
+    Uint64 bursts[FEATURE_BANDS] = {0}, speech = 0, gaps = 0, missing = 0;
+    for (Uint64 i = 0; i < view.count; i++) {
+        const FeatureRecord* r = &view.records[i];
+        level += r->level_dbfs;
+        centroid += r->centroid_hz;
+        flatness += r->flatness;
+        peaks += r->peak_count;
+        speech += r->flags & FEATURE_FLAG_SPEECH;
+        for (Uint32 b = 0; b < header->band_count; b++) {
+            band_db[b] += r->band_db[b];
+            bursts[b] += (r->burst_mask >> b) & 1;
+        }
+        if (i > 0 && r->sequence != view.records[i - 1].sequence + 1) {
+            gaps++;
+            missing += r->sequence - view.records[i - 1].sequence - 1;
+        }
+    }
+    double ms = 1000.0 * (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    time_t started = (time_t)header->start_time;
+    char started_text[32];
+    strftime(started_text, sizeof(started_text), "%Y-%m-%d %H:%M:%S", localtime(&started));
+    double hops = view.count ? (double)view.count : 1.0;
+    double span = view.count ? (double)(view.records[view.count - 1].end_sample - view.records[0].end_sample) /
+                                   header->sample_rate : 0.0;
+    printf("%s: %llu hops over %.1f s from %s, %u Hz, %u band(s); %llu gap(s), %llu hop(s) missing\n", path,
+           (unsigned long long)view.count, span, started_text, header->sample_rate, header->band_count,
+           (unsigned long long)gaps, (unsigned long long)missing);
+    printf("  mean level %.1f dBFS, centroid %.0f Hz, flatness %.2f, %.1f peaks per hop; %.1f%% speech-like\n",
+           level / hops, centroid / hops, flatness / hops, peaks / hops, 100.0 * speech / hops);
+    for (Uint32 b = 0; b < header->band_count; b++) {
+        const FeatureBand* band = &header->bands[b];
+        char range[32];
+        snprintf(range, sizeof(range), "%.0f-%.0f Hz", band->min_hz, band->max_hz);
+        printf("  %-*.*s %-15s mean %6.1f dB, burst in %5.1f%% of hops\n", FEATURE_BAND_NAME_SIZE,
+               FEATURE_BAND_NAME_SIZE, band->name, range, band_db[b] / hops, 100.0 * bursts[b] / hops);
+    }
+    printf("read %.1f MB in place in %.2f ms\n", map.size / 1e6, ms);
+    unmap_file(&map);
+    return 0;
+}
+
+// --- Network Event Export ---
+//
+// Classified events, burst peaks and recording notifications are pushed into
+// per-thread SPSC rings and drained by a dedicated exporter thread, which
+// batches them into compact frames. A frame is a EXPORT_HEADER_SIZE header
+// (magic, version, record count, sequence, dropped count, session start
+// time) followed by EXPORT_RECORD_SIZE-byte records, all little-endian. Over
+// TCP frames are sent back to back; while the collector is unreachable they
+// are spilled to EXPORT_SPILL_FILE and replayed after reconnecting. UDP is
+// best-effort: each frame is one datagram, and since a send cannot tell
+// whether anyone is listening there is no link state and no spill; frames
+// whose send fails are counted as lost. Producers never block: when a ring
+// is full the record is dropped and counted.
+
+int parse_endpoint(const char* spec, ExportTransport* transport, char* host, size_t host_size, int* port) {
+    if (strncmp(spec, "udp:", 4) == 0) {
+        *transport = TRANSPORT_UDP;
+    } else if (strncmp(spec, "tcp:", 4) == 0) {
+        *transport = TRANSPORT_TCP;
+    } else {
+        return -1;
+    }
+    const char* rest = spec + 4;
+    const char* colon = strrchr(rest, ':');
+    if (colon) {
+        if (!host || (size_t)(colon - rest) >= host_size) return -1;
+        memcpy(host, rest, colon - rest);
+        host[colon - rest] = '\0';
+        rest = colon + 1;
+    }
+    *port = atoi(rest);
+    return (*port > 0 && *port < 65536) ? 0 : -1;
+}
+
+int net_startup() {
+#ifdef _WIN32
+    WSADATA wsa;
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0 ? 0 : -1;
+#else
+    return 0;
+#endif
+}
+
+void net_shutdown() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void put_le16(Uint8* p, Uint16 v) {
+    p[0] = (Uint8)v;
+    p[1] = (Uint8)(v >> 8);
+}
+
+void put_le32(Uint8* p, Uint32 v) {
+    for (int i = 0; i < 4; i++) p[i] = (Uint8)(v >> (8 * i));
+}
+
+Uint16 get_le16(const Uint8* p) {
+    return (Uint16)(p[0] | (p[1] << 8));
+}
+
+Uint32 get_le32(const Uint8* p) {
+    return (Uint32)p[0] | ((Uint32)p[1] << 8) | ((Uint32)p[2] << 16) | ((Uint32)p[3] << 24);
+}
+
+void put_lef32(Uint8* p, float v) {
+    Uint32 bits;
+    memcpy(&bits, &v, sizeof(bits));
+    put_le32(p, bits);
+}
+
+float get_lef32(const Uint8* p) {
+    Uint32 bits = get_le32(p);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+void export_push(ExportQueue* q, ExportRecordType type, int band, int duration_class, float value, float freq_hz) {
+    if (!g_export_enabled) return;
+    Uint32 head = (Uint32)SDL_AtomicGet(&q->head);
+    Uint32 tail = (Uint32)SDL_AtomicGet(&q->tail);
+    if (head - tail >= EXPORT_QUEUE_SIZE) {
+        SDL_AtomicAdd(&g_export_dropped, 1);
+        return;
+    }
+    ExportRecord* r = &q->records[head & (EXPORT_QUEUE_SIZE - 1)];
+    r->type = (Uint8)type;
+    r->duration_class = (Uint8)duration_class;
+    r->band = (Uint8)band;
+    r->duration_classes = type == RECORD_SILENCE || type == RECORD_BURST ? (Uint8)g_duration_config.classes : 0;
+    r->timestamp_ms = SDL_GetTicks();
+    r->value = value;
+    r->freq_hz = freq_hz;
+    SDL_AtomicAdd(&q->head, 1);
+}
+
+int export_pop(ExportQueue* q, ExportRecord* out) {
+    Uint32 tail = (Uint32)SDL_AtomicGet(&q->tail);
+    if ((Uint32)SDL_AtomicGet(&q->head) == tail) return 0;
+    *out = q->records[tail & (EXPORT_QUEUE_SIZE - 1)];
+    SDL_AtomicAdd(&q->tail, 1);
+    return 1;
+}
+
+int export_encode_frame(Uint8* frame, const ExportRecord* records, int count, Uint32 seq) {
+    put_le32(frame, EXPORT_FRAME_MAGIC);
+    put_le16(frame + 4, EXPORT_FRAME_VERSION);
+    put_le16(frame + 6, (Uint16)count);
+    put_le32(frame + 8, seq);
+    put_le32(frame + 12, (Uint32)SDL_AtomicGet(&g_export_dropped));
+    put_le32(frame + 16, (Uint32)g_export_session_start);
+    put_le32(frame + 20, (Uint32)(g_export_session_start >> 32));
+    Uint8* p = frame + EXPORT_HEADER_SIZE;
+    for (int i = 0; i < count; i++, p += EXPORT_RECORD_SIZE) {
+        p[0] = records[i].type;
+        p[1] = records[i].duration_class;
+        p[2] = records[i].band;
+        p[3] = records[i].duration_classes;
+        put_le32(p + 4, records[i].timestamp_ms);
+        put_lef32(p + 8, records[i].value);
+        put_lef32(p + 12, records[i].freq_hz);
+    }
+    return EXPORT_HEADER_SIZE + count * EXPORT_RECORD_SIZE;
+}
+
+// Returns the record count of a valid frame header, or -1.
+int export_decode_header(const Uint8* frame) {
+    if (get_le32(frame) != EXPORT_FRAME_MAGIC || get_le16(frame + 4) != EXPORT_FRAME_VERSION) return -1;
+    int count = get_le16(frame + 6);
+    return count <= EXPORT_BATCH_MAX ? count : -1;
+}
+
+int net_set_nonblocking(net_socket s, int enable) {
+#ifdef _WIN32
+    u_long mode = enable ? 1 : 0;
+    return ioctlsocket(s, FIONBIO, &mode) == 0 ? 0 : -1;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    if (flags < 0) return -1;
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(s, F_SETFL, flags) == 0 ? 0 : -1;
+#endif
+}
+
+int net_connect_timeout(net_socket s, const struct sockaddr* addr, int addr_len, int timeout_ms) {
+    if (net_set_nonblocking(s, 1) != 0) return -1;
+    int rc = connect(s, addr, addr_len);
+    if (rc != 0) {
+#ifdef _WIN32
+        int in_progress = WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        int in_progress = errno == EINPROGRESS;
+#endif
+        if (!in_progress) return -1;
+        fd_set wset;
+        FD_ZERO(&wset);
+        FD_SET(s, &wset);
+        struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        if (select((int)s + 1, NULL, &wset, NULL, &tv) <= 0) return -1;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(s, SOL_SOCKET, SO_ERROR, (char*)&err, &len) != 0 || err != 0) return -1;
+    }
+    if (net_set_nonblocking(s, 0) != 0) return -1;
+#ifdef _WIN32
+    DWORD send_timeout = 1000;
+#else
+    struct timeval send_timeout = {1, 0};
+#endif
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&send_timeout, sizeof(send_timeout));
+    return 0;
+}
+
+net_socket export_connect() {
+    struct addrinfo hints, *res = NULL;
+    char port[16];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = g_export_transport == TRANSPORT_TCP ? SOCK_STREAM : SOCK_DGRAM;
+    snprintf(port, sizeof(port), "%d", g_export_port);
+    if (getaddrinfo(g_export_host, port, &hints, &res) != 0) return NET_INVALID_SOCKET;
+
+    net_socket s = NET_INVALID_SOCKET;
+    for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+        s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s == NET_INVALID_SOCKET) continue;
+        if (net_connect_timeout(s, ai->ai_addr, (int)ai->ai_addrlen, EXPORT_CONNECT_TIMEOUT_MS) == 0) break;
+        net_close(s);
+        s = NET_INVALID_SOCKET;
+    }
+    freeaddrinfo(res);
+    return s;
+}
+
+int export_send(net_socket s, const Uint8* data, int len) {
+#ifdef MSG_NOSIGNAL
+    int flags = MSG_NOSIGNAL;
+#else
+    int flags = 0;
+#endif
+    while (len > 0) {
+        int sent = (int)send(s, (const char*)data, len, flags);
+        if (sent <= 0) return -1;
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+void export_spill(FILE** spill, long* spill_size, const Uint8* frame, int len) {
+    if (*spill_size + len > EXPORT_SPILL_MAX) {
+        SDL_AtomicAdd(&g_export_spill_dropped, 1);
+        return;
+    }
+    if (!*spill) *spill = fopen(EXPORT_SPILL_FILE, "ab");
+    if (!*spill || fwrite(frame, 1, len, *spill) != (size_t)len) {
+        SDL_AtomicAdd(&g_export_spill_dropped, 1);
+        return;
+    }
+    *spill_size += len;
+    SDL_AtomicAdd(&g_export_frames_spilled, 1);
+}
+
+// Sends every spilled frame. The file is only removed once all of it went
+// out, so a failure part way through may later resend some frames; the
+// collector can discard those by sequence number.
+int export_replay_spill(net_socket s, FILE** spill, long* spill_size) {
+    if (*spill) {
+        fclose(*spill);
+        *spill = NULL;
+    }
+    FILE* in = fopen(EXPORT_SPILL_FILE, "rb");
+    if (!in) {
+        *spill_size = 0;
+        return 0;
+    }
+    Uint8 frame[EXPORT_FRAME_MAX];
+    int rc = 0;
+    while (fread(frame, 1, EXPORT_HEADER_SIZE, in) == EXPORT_HEADER_SIZE) {
+        int count = export_decode_header(frame);
+        if (count < 0) break;
+        size_t body = (size_t)count * EXPORT_RECORD_SIZE;
+        if (fread(frame + EXPORT_HEADER_SIZE, 1, body, in) != body) break;
+        if (export_send(s, frame, EXPORT_HEADER_SIZE + (int)body) != 0) {
+            rc = -1;
+            break;
+        }
+        SDL_AtomicAdd(&g_export_frames_sent, 1);
+    }
+    fclose(in);
+    if (rc == 0) {
+        remove(EXPORT_SPILL_FILE);
+        *spill_size = 0;
+    }
+    return rc;
+}
+
+int exporter_thread(void* data) {
+    ExportRecord batch[EXPORT_BATCH_MAX];
+    Uint8 frame[EXPORT_FRAME_MAX];
+    int batch_count = 0;
+    Uint32 batch_started = 0;
+    Uint32 seq = 0;
+    net_socket sock = NET_INVALID_SOCKET;
+    Uint32 next_connect = 0;
+    Uint32 backoff = EXPORT_BACKOFF_MIN_MS;
+    FILE* spill = NULL;
+    long spill_size = 0;
+    int reliable = g_export_transport == TRANSPORT_TCP;
+
+    FILE* existing = reliable ? fopen(EXPORT_SPILL_FILE, "rb") : NULL;
+    if (existing) {
+        fseek(existing, 0, SEEK_END);
+        spill_size = ftell(existing);
+        fclose(existing);
+    }
+
+    for (;;) {
+        int running = SDL_AtomicGet(&g_export_running);
+        Uint32 now = SDL_GetTicks();
+
+        if (sock == NET_INVALID_SOCKET && running && (Sint32)(now - next_connect) >= 0) {
+            sock = export_connect();
+            if (sock != NET_INVALID_SOCKET && !reliable) {
+                backoff = EXPORT_BACKOFF_MIN_MS;
+            } else if (sock != NET_INVALID_SOCKET && export_replay_spill(sock, &spill, &spill_size) == 0) {
+                SDL_AtomicSet(&g_export_connected, 1);
+                SDL_AtomicAdd(&g_export_reconnects, 1);
+                backoff = EXPORT_BACKOFF_MIN_MS;
+                BusMessage message;
+                message.type = BUS_EXPORT_CONNECTED;
+                message.data.count = (Uint32)SDL_AtomicGet(&g_export_frames_spilled);
+                bus_post(&message);
+            } else {
+                if (sock != NET_INVALID_SOCKET) net_close(sock);
+                sock = NET_INVALID_SOCKET;
+                next_connect = now + backoff;
+                backoff = backoff * 2 > EXPORT_BACKOFF_MAX_MS ? EXPORT_BACKOFF_MAX_MS : backoff * 2;
+            }
+        }
+
+        int drained = 0;
+        ExportRecord record;
+        while (batch_count < EXPORT_BATCH_MAX &&
+               (export_pop(&g_export_analysis_queue, &record) || export_pop(&g_export_audio_queue, &record))) {
+            if (batch_count == 0) batch_started = now;
+            batch[batch_count++] = record;
+            drained = 1;
+        }
+
+        if (batch_count > 0 &&
+            (batch_count == EXPORT_BATCH_MAX || now - batch_started >= EXPORT_FLUSH_MS || !running)) {
+            int len = export_encode_frame(frame, batch, batch_count, seq++);
+            batch_count = 0;
+            if (sock != NET_INVALID_SOCKET && export_send(sock, frame, len) == 0) {
+                SDL_AtomicAdd(&g_export_frames_sent, 1);
+            } else if (!reliable) {
+                SDL_AtomicAdd(&g_export_frames_lost, 1);
+            } else {
+                if (sock != NET_INVALID_SOCKET) {
+                    net_close(sock);
+                    sock = NET_INVALID_SOCKET;
+                    SDL_AtomicSet(&g_export_connected, 0);
+                    next_connect = now + backoff;
+                    BusMessage message;
+                    message.type = BUS_EXPORT_LOST;
+                    message.data.count = (Uint32)SDL_AtomicGet(&g_export_frames_spilled);
+                    bus_post(&message);
+                }
+                export_spill(&spill, &spill_size, frame, len);
+            }
+            continue;
+        }
+
+        if (!running && !drained && batch_count == 0) break;
+        if (!drained) SDL_Delay(EXPORT_POLL_MS);
+    }
+
+    if (spill) fclose(spill);
+    if (sock != NET_INVALID_SOCKET) net_close(sock);
+    SDL_AtomicSet(&g_export_connected, 0);
+    return 0;
+}
+
+int start_exporter() {
+    if (net_startup() != 0) return -1;
+    g_export_session_start = (Uint64)time(NULL);
+    SDL_AtomicSet(&g_export_running, 1);
+    g_export_thread = SDL_CreateThread(exporter_thread, "exporter", NULL);
+    if (!g_export_thread) {
+        SDL_AtomicSet(&g_export_running, 0);
+        g_export_enabled = 0;
+        net_shutdown();
+        return -1;
+    }
+    return 0;
+}
+
+void stop_exporter() {
+    if (!g_export_thread) return;
+    SDL_AtomicSet(&g_export_running, 0);
+    SDL_WaitThread(g_export_thread, NULL);
+    g_export_thread = NULL;
+    net_shutdown();
+}
+
+const char* export_record_name(int type) {
+    switch (type) {
+        case RECORD_SILENCE: return "SILENCE";
+        case RECORD_BURST: return "BURST";
+        case RECORD_PEAK: return "PEAK";
+        case RECORD_RECORDING_START: return "REC_START";
+        case RECORD_RECORDING_STOP: return "REC_STOP";
+        case RECORD_FAST_ONSET: return "ONSET";
+        case RECORD_FAST_OFFSET: return "OFFSET";
+        default: return "UNKNOWN";
+    }
+}
+
+void collector_print_frame(const Uint8* frame, int count) {
+    Uint64 session = get_le32(frame + 16) | ((Uint64)get_le32(frame + 20) << 32);
+    printf("frame seq=%u records=%d dropped=%u session=%llu\n", get_le32(frame + 8), count,
+           get_le32(frame + 12), (unsigned long long)session);
+    const Uint8* p = frame + EXPORT_HEADER_SIZE;
+    for (int i = 0; i < count; i++, p += EXPORT_RECORD_SIZE) {
+        printf("  t=%8ums %-9s band=%u class=%c value=%.3f freq=%.1f\n", get_le32(p + 4), export_record_name(p[0]),
+               p[2], duration_class_char(p[1], p[3] ? p[3] : 2), get_lef32(p + 8), get_lef32(p + 12));
+    }
+    fflush(stdout);
+}
+
+int recv_all(net_socket s, Uint8* buf, int len) {
+    while (len > 0) {
+        int got = (int)recv(s, (char*)buf, len, 0);
+        if (got <= 0) return -1;
+        buf += got;
+        len -= got;
+    }
+    return 0;
+}
+
+// Minimal stand-in for a remote collector, used to exercise the exporter
+// locally. Listens on all interfaces and prints every frame it receives.
+int run_collector(ExportTransport transport, int port, int max_frames) {
+    if (net_startup() != 0) return 1;
+    net_socket s = socket(AF_INET, transport == TRANSPORT_TCP ? SOCK_STREAM : SOCK_DGRAM, 0);
+    if (s == NET_INVALID_SOCKET) {
+        fprintf(stderr, "collector: socket() failed\n");
+        net_shutdown();
+        return 1;
+    }
+    int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        (transport == TRANSPORT_TCP && listen(s, 1) != 0)) {
+        fprintf(stderr, "collector: cannot listen on port %d\n", port);
+        net_close(s);
+        net_shutdown();
+        return 1;
+    }
+    printf("collector: listening on %s port %d\n", transport == TRANSPORT_TCP ? "tcp" : "udp", port);
+    fflush(stdout);
+
+    Uint8 frame[EXPORT_FRAME_MAX];
+    int frames = 0;
+    while (max_frames <= 0 || frames < max_frames) {
+        if (transport == TRANSPORT_UDP) {
+            int len = (int)recv(s, (char*)frame, sizeof(frame), 0);
+            if (len < EXPORT_HEADER_SIZE) continue;
+            int count = export_decode_header(frame);
+            if (count < 0 || len != EXPORT_HEADER_SIZE + count * EXPORT_RECORD_SIZE) {
+                printf("collector: malformed datagram (%d bytes)\n", len);
+                continue;
+            }
+            collector_print_frame(frame, count);
+            frames++;
+        } else {
+            net_socket client = accept(s, NULL, NULL);
+            if (client == NET_INVALID_SOCKET) continue;
+            printf("collector: client connected\n");
+            while (max_frames <= 0 || frames < max_frames) {
+                if (recv_all(client, frame, EXPORT_HEADER_SIZE) != 0) break;
+                int count = export_decode_header(frame);
+                if (count < 0) {
+                    printf("collector: bad frame header, dropping client\n");
+                    break;
+                }
+                if (recv_all(client, frame + EXPORT_HEADER_SIZE, count * EXPORT_RECORD_SIZE) != 0) break;
+                collector_print_frame(frame, count);
+                frames++;
+            }
+            printf("collector: client disconnected\n");
+            fflush(stdout);
+            net_close(client);
+        }
+    }
+    net_close(s);
+    net_shutdown();
+    return 0;
+}
+
+// --- Synthetic Source and Headless Operation ---
+//
+// The synthetic source stands in for the SDL capture device: a thread
+// generates seeded test signals in device-buffer-sized blocks and hands them
+// to audio_callback exactly as the device would, so the whole pipeline
+// (recording trigger, framing, FFT, burst analysis, export) is exercised.
+// Events are tone bursts and chirps in the monitored band, rhythmic
+// short/long burst sequences, broadband noise bursts and short voiced
+// utterances, spaced by exponentially distributed gaps over a continuous
+// noise floor.
+
+// Rhythm segments alternate on/off, in milliseconds: s s L, twice.
+static const int g_synth_rhythm_ms[SYNTH_RHYTHM_STEPS] = {60, 150, 60, 150, 300, 500, 60, 150, 60, 150, 300, 500};
+
+// First three formants of /a/ /e/ /i/ /o/ /u/ in Hz, and their bandwidths.
+static const float g_synth_vowels[5][3] = {
+    {730, 1090, 2440}, {530, 1840, 2480}, {270, 2290, 3010}, {570, 840, 2410}, {300, 870, 2240}};
+static const float g_synth_formant_bw[3] = {80, 100, 150};
+
+Uint32 synth_rand(SynthState* st) {
+    st->rng ^= st->rng << 13;
+    st->rng ^= st->rng >> 17;
+    st->rng ^= st->rng << 5;
+    return st->rng;
+}
+
+float synth_uniform(SynthState* st) {
+    return (synth_rand(st) >> 8) * (1.0f / 16777216.0f);
+}
+
+Uint32 synth_ms(float ms) {
+    Uint32 n = (Uint32)(ms * SAMPLE_RATE / 1000.0f);
+    return n > 0 ? n : 1;
+}
+
+void synth_init(SynthState* st, const SynthConfig* cfg) {
+    memset(st, 0, sizeof(*st));
+    st->rng = cfg->seed ? cfg->seed : 1;
+    st->kind = SYNTH_TONE_BURST; // So the first segment is a gap
+    st->noise_amp = powf(10.0f, cfg->noise_db / 20.0f);
+}
+
+// A voiced syllable: a glottal pulse train gliding in pitch, tilted and
+// shaped by three formant resonators, each normalized to unity peak gain.
+void synth_start_syllable(SynthState* st) {
+    const float* formants = g_synth_vowels[synth_rand(st) % 5];
+    for (int k = 0; k < 3; k++) {
+        double r = exp(-M_PI * g_synth_formant_bw[k] / SAMPLE_RATE);
+        double theta = 2.0 * M_PI * formants[k] / SAMPLE_RATE;
+        st->formant_a1[k] = (float)(2.0 * r * cos(theta));
+        st->formant_a2[k] = (float)(-r * r);
+        st->formant_b[k] = (float)((1.0 - r) * sqrt(1.0 - 2.0 * r * cos(2.0 * theta) + r * r));
+    }
+    st->f0 = 90.0 + 140.0 * synth_uniform(st);
+    st->segment_on = 1;
+    st->segment_length = st->remaining = synth_ms(120.0f + 160.0f * synth_uniform(st));
+    st->f0_step = st->f0 * (0.15 * synth_uniform(st) - 0.1) / st->segment_length;
+    st->syllables--;
+}
+
+void synth_next_segment(SynthState* st, const SynthConfig* cfg) {
+    if (st->kind == SYNTH_RHYTHM && st->rhythm_step < SYNTH_RHYTHM_STEPS) {
+        st->segment_on = (st->rhythm_step % 2) == 0;
+        st->remaining = synth_ms((float)g_synth_rhythm_ms[st->rhythm_step++]);
+        return;
+    }
+    if (st->kind == SYNTH_VOICE && st->syllables > 0) {
+        if (st->segment_on) {
+            st->segment_on = 0;
+            st->remaining = synth_ms(40.0f + 80.0f * synth_uniform(st));
+        } else {
+            synth_start_syllable(st);
+        }
+        return;
+    }
+    if (st->kind != SYNTH_IDLE) {
+        float mean_gap = cfg->event_rate > 0.0f ? 1.0f / cfg->event_rate : 3600.0f;
+        st->kind = SYNTH_IDLE;
+        st->segment_on = 0;
+        st->remaining = synth_ms(-logf(1.0f - synth_uniform(st) * 0.999f) * mean_gap * 1000.0f);
+        return;
+    }
+    synth_start_event(st, cfg, (SynthEventKind)(SYNTH_TONE_BURST + synth_rand(st) % 5));
+}
+
+void synth_start_event(SynthState* st, const SynthConfig* cfg, SynthEventKind kind) {
+    st->kind = kind;
+    st->segment_on = 1;
+    st->phase = 0.0;
+    st->freq = MIN_FREQ_TO_DISPLAY + 500.0 + synth_uniform(st) * (MAX_FREQ_TO_DISPLAY - MIN_FREQ_TO_DISPLAY - 1000.0);
+    st->freq_step = 0.0;
+    st->amp = 0.05f + 0.25f * synth_uniform(st);
+    switch (st->kind) {
+        case SYNTH_TONE_BURST:
+            st->remaining = synth_ms(20.0f + 380.0f * synth_uniform(st));
+            break;
+        case SYNTH_RHYTHM:
+            st->rhythm_step = 0;
+            synth_next_segment(st, cfg);
+            break;
+        case SYNTH_CHIRP:
+            st->freq = MIN_FREQ_TO_DISPLAY;
+            st->remaining = synth_ms(50.0f + 150.0f * synth_uniform(st));
+            st->freq_step = (double)(MAX_FREQ_TO_DISPLAY - MIN_FREQ_TO_DISPLAY) / st->remaining;
+            break;
+        case SYNTH_VOICE:
+            st->syllables = 2 + synth_rand(st) % 5;
+            st->glottal_phase = 0.0;
+            st->tilt = 0.0f;
+            memset(st->formant_y1, 0, sizeof(st->formant_y1));
+            memset(st->formant_y2, 0, sizeof(st->formant_y2));
+            synth_start_syllable(st);
+            break;
+        default: // SYNTH_NOISE_BURST, e.g. a click or handling noise
+            st->remaining = synth_ms(5.0f + 25.0f * synth_uniform(st));
+            break;
+    }
+}
+
+float synth_next_sample(SynthState* st, const SynthConfig* cfg) {
+    while (st->remaining == 0) synth_next_segment(st, cfg);
+    st->remaining--;
+    float v = st->noise_amp * (2.0f * synth_uniform(st) - 1.0f);
+    if (st->segment_on) {
+        if (st->kind == SYNTH_NOISE_BURST) {
+            v += st->amp * (2.0f * synth_uniform(st) - 1.0f);
+        } else if (st->kind == SYNTH_VOICE) {
+            float x = 0.0f;
+            st->glottal_phase += st->f0 / SAMPLE_RATE;
+            st->f0 += st->f0_step;
+            if (st->glottal_phase >= 1.0) {
+                st->glottal_phase -= 1.0;
+                x = 1.0f;
+            }
+            // Pulse train lowpassed at about 100 Hz: roughly the -12 dB/octave
+            // tilt of the glottal source once the resonators' own slope is added.
+            st->tilt = x + 0.985f * st->tilt;
+            float y = st->tilt;
+            for (int k = 0; k < 3; k++) {
+                float out = st->formant_b[k] * y + st->formant_a1[k] * st->formant_y1[k] +
+                            st->formant_a2[k] * st->formant_y2[k];
+                st->formant_y2[k] = st->formant_y1[k];
+                st->formant_y1[k] = out;
+                y = out;
+            }
+            float envelope = sinf((float)M_PI * (st->segment_length - st->remaining) / st->segment_length);
+            v += st->amp * SYNTH_VOICE_GAIN * envelope * y;
+        } else {
+            v += st->amp * (float)sin(st->phase);
+            st->phase += 2.0 * M_PI * st->freq / SAMPLE_RATE;
+            if (st->phase > 2.0 * M_PI) st->phase -= 2.0 * M_PI;
+            st->freq += st->freq_step;
+        }
+    }
+    return v;
+}
+
+int synth_thread(void* data) {
+    static Sint16 block[SYNTH_MAX_BLOCK_SAMPLES * 2];
+    static float history[TDOA_SYNTH_HISTORY];
+    SynthConfig cfg = g_synth_config;
+    SynthState st;
+    synth_init(&st, &cfg);
+    // With --tdoa the second channel is the first delayed by --synth-delay,
+    // rounded to whole samples (a fractional delay filter cannot reach the
+    // top of the band at 44.1 kHz; --tdoa-test covers fractional delays),
+    // plus its own noise. A negative delay holds back the first channel.
+    int delay = (int)lround(g_tdoa_synth_delay_us * 1e-6 * SAMPLE_RATE);
+    if (delay >= TDOA_SYNTH_HISTORY) delay = TDOA_SYNTH_HISTORY - 1;
+    if (delay <= -TDOA_SYNTH_HISTORY) delay = -TDOA_SYNTH_HISTORY + 1;
+    Uint32 n = 0;
+    memset(history, 0, sizeof(history));
+    double ticks_per_sec = (double)SDL_GetPerformanceFrequency();
+    g_capture_ticks_per_sample = cfg.speed > 0.0f ? ticks_per_sec / (SAMPLE_RATE * cfg.speed) : 0.0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 produced = 0;
+
+    while (!SDL_AtomicGet(&g_synth_stop)) {
+        if (cfg.duration_samples && produced >= cfg.duration_samples) break;
+        if (SDL_AtomicGet(&g_synth_paused)) {
+            SDL_Delay(10);
+            start = SDL_GetPerformanceCounter() - (Uint64)(produced / (SAMPLE_RATE * cfg.speed) * ticks_per_sec);
+            continue;
+        }
+        int samples = g_capture_samples;
+        for (int i = 0; i < samples; i++) {
+            float v = synth_next_sample(&st, &cfg);
+            if (g_capture_channels == 2) {
+                history[n & (TDOA_SYNTH_HISTORY - 1)] = v;
+                float a = history[(n - (delay < 0 ? -delay : 0)) & (TDOA_SYNTH_HISTORY - 1)];
+                float b = history[(n - (delay > 0 ? delay : 0)) & (TDOA_SYNTH_HISTORY - 1)] +
+                          st.noise_amp * (synth_uniform(&st) * 2.0f - 1.0f);
+                n++;
+                block[i * 2] = (Sint16)(fmaxf(-1.0f, fminf(1.0f, a)) * 32767.0f);
+                block[i * 2 + 1] = (Sint16)(fmaxf(-1.0f, fminf(1.0f, b)) * 32767.0f);
+                continue;
+            }
+            v = fmaxf(-1.0f, fminf(1.0f, v));
+            block[i] = (Sint16)(v * 32767.0f);
+        }
+        audio_callback(NULL, (Uint8*)block, samples * g_capture_channels * (int)sizeof(Sint16));
+        produced += samples;
+
+        if (cfg.speed > 0.0f) {
+            double target = produced / (SAMPLE_RATE * (double)cfg.speed);
+            double elapsed = (SDL_GetPerformanceCounter() - start) / ticks_per_sec;
+            if (target - elapsed > 0.001) SDL_Delay((Uint32)((target - elapsed) * 1000.0));
+        }
+    }
+    SDL_AtomicSet(&g_synth_done, 1);
+    if (g_headless) SDL_SemPost(g_fft_sem);
+    return 0;
+}
+
+int start_synth() {
+    SDL_AtomicSet(&g_synth_stop, 0);
+    SDL_AtomicSet(&g_synth_done, 0);
+    g_synth_thread = SDL_CreateThread(synth_thread, "synth_source", NULL);
+    return g_synth_thread ? 0 : -1;
+}
+
+void stop_synth() {
+    if (!g_synth_thread) return;
+    SDL_AtomicSet(&g_synth_stop, 1);
+    SDL_WaitThread(g_synth_thread, NULL);
+    g_synth_thread = NULL;
+}
+
+// Feeds one sample of the evaluation corpus through framing, the FFT and the
+// detector, exactly as the capture path would.
+void vad_eval_sample(VadEval* ev, float v) {
+    v = fmaxf(-1.0f, fminf(1.0f, v));
+    float x = (Sint16)(v * 32767.0f) / 32768.0f;
+    if (fabsf(x) > VAD_LEVEL_TRIGGER) ev->level_hit = 1;
+    int n = ev->plan.config.size;
+    ev->history[ev->samples & (FFT_MAX_SIZE - 1)] = x;
+    ev->samples++;
+    if (++ev->hop_fill < ev->plan.hop || ev->samples < (Uint64)n) return;
+    ev->hop_fill = 0;
+
+    Uint32 start = (Uint32)(ev->samples - n);
+    for (int j = 0; j < n; j++) {
+        ev->plan.frame[j * 2] = ev->history[(start + j) & (FFT_MAX_SIZE - 1)] * ev->plan.window[j];
+        ev->plan.frame[j * 2 + 1] = 0.0;
+    }
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    fft_plan_execute(&ev->plan, ev->plan.frame);
+    fft_power(ev->plan.spectrum, ev->plan.power, n);
+    Uint64 t1 = SDL_GetPerformanceCounter();
+    VadFeatures features;
+    vad_features(&ev->vad, &ev->plan, ev->plan.frame, ev->plan.power, &features);
+    float hop_ms = 1000.0f * ev->plan.hop / SAMPLE_RATE;
+    if (vad_update(&ev->vad, &features, hop_ms, start) == VAD_START) ev->vad_hit = 1;
+    Uint64 t2 = SDL_GetPerformanceCounter();
+    ev->fft_ticks += t1 - t0;
+    ev->vad_ticks += t2 - t1;
+    ev->hops++;
+}
+
+// Runs the detector over a labelled corpus from the synthetic source: clips
+// of each event kind in turn, every one surrounded by background noise, of
+// which only the voice clips should start a recording. Prints per-kind
+// trigger counts and precision/recall against the old per-sample level
+// trigger, plus the detector's cost per hop.
+int run_vad_eval(int clips) {
+    static VadEval ev;
+    memset(&ev, 0, sizeof(ev));
+    if (clips < 1 || fft_plan_build(&ev.plan, &g_fft_config) != 0) {
+        fprintf(stderr, "vad-eval: invalid clip count or out of memory\n");
+        return 1;
+    }
+    SynthConfig cfg = g_synth_config;
+    SynthState st;
+    synth_init(&st, &cfg);
+    static const char* kind_names[] = {"", "tone burst", "rhythm", "chirp", "noise burst", "voice"};
+    int kinds = SYNTH_VOICE - SYNTH_TONE_BURST + 1;
+    int clip_count[SYNTH_VOICE + 1] = {0}, vad_hits[SYNTH_VOICE + 1] = {0}, level_hits[SYNTH_VOICE + 1] = {0};
+
+    for (int c = 0; c < clips; c++) {
+        SynthEventKind kind = (SynthEventKind)(SYNTH_TONE_BURST + c % kinds);
+        ev.vad_hit = ev.level_hit = 0;
+        st.kind = SYNTH_IDLE;
+        st.segment_on = 0;
+        st.remaining = synth_ms(500.0f + 500.0f * synth_uniform(&st));
+        for (Uint32 lead = st.remaining; lead > 0; lead--) vad_eval_sample(&ev, synth_next_sample(&st, &cfg));
+        synth_start_event(&st, &cfg, kind);
+        while (st.kind == kind) vad_eval_sample(&ev, synth_next_sample(&st, &cfg));
+        // Long enough for the hangover to end any recording before the next clip.
+        st.remaining = synth_ms(2.0f * VAD_HANG_MS);
+        for (Uint32 tail = st.remaining; tail > 0; tail--) vad_eval_sample(&ev, synth_next_sample(&st, &cfg));
+        clip_count[kind]++;
+        vad_hits[kind] += ev.vad_hit;
+        level_hits[kind] += ev.level_hit;
+    }
+
+    printf("VAD evaluation: %d clips, FFT %d %s %.1f%% overlap (hop %d), noise %.0f dBFS, seed %u\n", clips,
+           ev.plan.config.size, window_name(ev.plan.config.window), ev.plan.config.overlap * 100.0f, ev.plan.hop,
+           cfg.noise_db, cfg.seed);
+    printf("%-12s %6s %6s %6s\n", "kind", "clips", "vad", "level");
+    int vad_tp = 0, vad_fp = 0, level_tp = 0, level_fp = 0;
+    for (int k = SYNTH_TONE_BURST; k <= SYNTH_VOICE; k++) {
+        printf("%-12s %6d %6d %6d\n", kind_names[k], clip_count[k], vad_hits[k], level_hits[k]);
+        if (k == SYNTH_VOICE) {
+            vad_tp += vad_hits[k];
+            level_tp += level_hits[k];
+        } else {
+            vad_fp += vad_hits[k];
+            level_fp += level_hits[k];
+        }
+    }
+    int voice = clip_count[SYNTH_VOICE];
+    printf("VAD:           precision %.3f, recall %.3f\n", vad_tp + vad_fp ? (double)vad_tp / (vad_tp + vad_fp) : 0.0,
+           voice ? (double)vad_tp / voice : 0.0);
+    printf("Level trigger: precision %.3f, recall %.3f\n",
+           level_tp + level_fp ? (double)level_tp / (level_tp + level_fp) : 0.0, voice ? (double)level_tp / voice : 0.0);
+    double us_per_tick = 1e6 / SDL_GetPerformanceFrequency();
+    printf("Cost per hop: VAD %.2f us, FFT %.2f us (%llu hops)\n", ev.vad_ticks * us_per_tick / ev.hops,
+           ev.fft_ticks * us_per_tick / ev.hops, (unsigned long long)ev.hops);
+    fft_plan_free(&ev.plan);
+    return 0;
+}
+
+void handle_sigint(int sig) {
+    g_quit_requested = 1;
+}
 
-            if (g_is_recording && g_record_file) {
-                int16_t out = (int16_t)(normalized * 32767);
-                fwrite(&out, sizeof(int16_t), 1, g_record_file);
-                g_wav_data_size += sizeof(int16_t);
+// Analysis loop without a renderer: wakes for each published frame instead
+// of polling once per display frame.
+void run_headless_loop() {
+    signal(SIGINT, handle_sigint);
+    while (!g_quit_requested) {
+        if (g_latency_profiles[g_latency_profile].wake_ms >= 100) {
+            // Power-save: batch the queued frames on a timer instead of
+            // waking for each one.
+            SDL_Delay(analysis_wake_ms());
+            while (SDL_AtomicGet(&g_fft_ready)) {
+                fft_catch_up();
+                process_fft();
             }
-
-            g_audio_buffer[g_audio_buffer_pos++] = normalized;
+            while (SDL_SemTryWait(g_fft_sem) == 0) {}
+        } else if (SDL_SemWaitTimeout(g_fft_sem, 100) == 0 && SDL_AtomicGet(&g_fft_ready)) {
+            fft_catch_up();
+            process_fft();
         }
-        if (g_audio_buffer_pos >= FFT_SIZE) {
-            if (SDL_AtomicGet(&g_fft_ready) == 0) {
-                for (int j = 0; j < FFT_SIZE; j++) {
-                    float hann_multiplier = 0.5f * (1.0f - cos(2.0f * M_PI * j / (FFT_SIZE - 1)));
-                    g_fft_buffer[j * 2] = g_audio_buffer[j] * hann_multiplier;
-                    g_fft_buffer[j * 2 + 1] = 0.0;
-                }
-                SDL_AtomicSet(&g_fft_ready, 1);
-            }
-            int overlap = FFT_SIZE / 2;
-            memmove(g_audio_buffer, g_audio_buffer + overlap, (FFT_SIZE - overlap) * sizeof(float));
-            g_audio_buffer_pos = FFT_SIZE - overlap;
+        bus_drain();
+        poll_config_file();
+        poll_survey();
+        apply_fft_config();
+        if (g_synth_thread && SDL_AtomicGet(&g_synth_done) && !SDL_AtomicGet(&g_fft_ready)) break;
+    }
+    printf("hops: %d processed, %d dropped; cost p50 %.3f ms p99 %.3f ms; latency p50 %.3f ms p99 %.3f ms\n",
+           SDL_AtomicGet(&g_hops_total) - SDL_AtomicGet(&g_hops_dropped), SDL_AtomicGet(&g_hops_dropped),
+           perf_series_percentile(&g_hop_cost_ms, 50.0f), perf_series_percentile(&g_hop_cost_ms, 99.0f),
+           perf_series_percentile(&g_hop_latency_ms, 50.0f), perf_series_percentile(&g_hop_latency_ms, 99.0f));
+    if (g_hops_batched) printf("catch-up: %d hops transformed in batches\n", g_hops_batched);
+    printf("latency (%s, %d-sample buffer): capture p50 %.2f ms p99 %.2f ms; capture->detection p50 %.2f ms "
+           "p95 %.2f ms p99 %.2f ms\n",
+           g_latency_profiles[g_latency_profile].name, g_capture_samples,
+           perf_series_percentile(&g_capture_wait_ms, 50.0f), perf_series_percentile(&g_capture_wait_ms, 99.0f),
+           perf_series_percentile(&g_detect_latency_ms, 50.0f), perf_series_percentile(&g_detect_latency_ms, 95.0f),
+           perf_series_percentile(&g_detect_latency_ms, 99.0f));
+    if (SDL_AtomicGet(&g_monitor_mode) != MONITOR_OFF) {
+        printf("monitor: %s; latency %.1f ms mean, %.1f ms max; DSP %.1f ns/sample; %d underruns, %d skips, %d overruns\n",
+               monitor_mode_name((MonitorMode)SDL_AtomicGet(&g_monitor_mode)),
+               SDL_AtomicGet(&g_monitor_latency_us) / 1000.0, SDL_AtomicGet(&g_monitor_latency_max_us) / 1000.0,
+               SDL_AtomicGet(&g_monitor_ns_x100) / 100.0, SDL_AtomicGet(&g_monitor_underruns),
+               SDL_AtomicGet(&g_monitor_skips), SDL_AtomicGet(&g_monitor_overruns));
+    }
+    printf("vad: %u recording(s), %.1f%% of hops speech-like, floor %.1f dBFS; cost p50 %.1f us p99 %.1f us\n",
+           g_vad.recordings, g_vad.hops ? 100.0 * g_vad.speech_hops / g_vad.hops : 0.0, g_vad.floor_db,
+           perf_series_percentile(&g_vad_cost_ms, 50.0f) * 1000.0f, perf_series_percentile(&g_vad_cost_ms, 99.0f) * 1000.0f);
+    if (g_tdoa_enabled) {
+        printf("tdoa: %d of %d burst(s) located, %.2f m spacing; last %+.1f deg (%+.2f samples); cost p50 %.1f us "
+               "p99 %.1f us per hop\n",
+               g_tdoa_located, g_bands[0].bursts, g_tdoa_spacing_m, g_tdoa_last.bearing_deg, g_tdoa_last.delay_samples,
+               perf_series_percentile(&g_tdoa_cost_ms, 50.0f) * 1000.0f,
+               perf_series_percentile(&g_tdoa_cost_ms, 99.0f) * 1000.0f);
+    }
+    if (g_survey_enabled && g_survey.hops) {
+        printf("survey: %.0f s, %llu hops, %d bins of %.1f Hz, %d snapshot(s) to %s; cost p50 %.1f us p99 %.1f us per "
+               "hop, %.1f ms per snapshot\n",
+               (double)(g_survey.last_sample - g_survey.first_sample) / SAMPLE_RATE, (unsigned long long)g_survey.hops,
+               g_survey.bins, (double)SAMPLE_RATE * g_survey.group / g_survey.n, g_survey_snapshots, g_survey_path,
+               perf_series_percentile(&g_survey_cost_ms, 50.0f) * 1000.0f,
+               perf_series_percentile(&g_survey_cost_ms, 99.0f) * 1000.0f, g_survey_export_ms);
+    }
+    if (g_features_enabled) {
+        stop_feature_writer(); // Drain the ring so the counts are final
+        printf("features: %u hops, %d written, %d dropped; cost p50 %.1f us p99 %.1f us per hop\n",
+               (Uint32)SDL_AtomicGet(&g_hops_total), SDL_AtomicGet(&g_feature_written),
+               SDL_AtomicGet(&g_feature_dropped),
+               perf_series_percentile(&g_feature_cost_ms, 50.0f) * 1000.0f,
+               perf_series_percentile(&g_feature_cost_ms, 99.0f) * 1000.0f);
+    }
+    if (g_duration_events) {
+        char burst_cuts[32], silence_cuts[32];
+        format_duration_cuts(&g_bands[0].burst_durations, burst_cuts, sizeof(burst_cuts));
+        format_duration_cuts(&g_bands[0].silence_durations, silence_cuts, sizeof(silence_cuts));
+        printf("durations: %d classes, cuts burst %s, silence %s; %u events classified, %.0f ns per event\n",
+               g_duration_config.classes, burst_cuts, silence_cuts, g_duration_events,
+               g_duration_ticks * 1e9 / SDL_GetPerformanceFrequency() / g_duration_events);
+    }
+    if (g_band_count > 1) {
+        printf("bands:");
+        for (int b = 0; b < g_band_count; b++) {
+            printf("%s %s %d burst(s)", b ? "," : "", g_bands[b].spec.name, g_bands[b].bursts);
         }
+        printf("\n");
+    }
+    bus_drain();
+    if (g_sdft_enabled) {
+        printf("sdft: %d bins x %d samples; %.1f ns/sample, %.3f%% of real time, worst callback %.3f%%; %d events dropped\n",
+               g_sdft.num_bins, g_sdft.window, SDL_AtomicGet(&g_sdft_ns_x100) / 100.0,
+               SDL_AtomicGet(&g_sdft_load_ppm) / 10000.0, SDL_AtomicGet(&g_sdft_worst_ppm) / 10000.0,
+               SDL_AtomicGet(&g_sdft_events_dropped));
     }
 }
 
-void start_recording() {
-    time_t t = time(NULL);
-    struct tm* tm_info = localtime(&t);
-    strftime(g_current_filename, sizeof(g_current_filename), "evp_%Y%m%d_%H%M%S.wav", tm_info);
-    g_record_file = fopen(g_current_filename, "wb");
-    if (!g_record_file) {
-        return;
-    }
-    g_is_recording = 1;
-    g_wav_data_size = 0;
-    unsigned char header[44] = {0};
-    fwrite(header, sizeof(header), 1, g_record_file);
+void perf_series_add(PerfSeries* series, float value) {
+    series->values[series->pos] = value;
+    series->pos = (series->pos + 1) % PERF_SERIES_SIZE;
+    if (series->count < PERF_SERIES_SIZE) series->count++;
+}
 
-    char log[100];
-    snprintf(log, sizeof(log), "Recording EVP: %s", g_current_filename);
-    add_log_entry(log);
+int compare_floats(const void* a, const void* b) {
+    float fa = *(const float*)a, fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
 }
 
-void stop_recording() {
-    if (!g_is_recording || !g_record_file) {
-        return;
-    }
-    fseek(g_record_file, 0, SEEK_SET);
-    write_wav_header(g_record_file, g_wav_data_size);
-    fclose(g_record_file);
-    g_record_file = NULL;
-    g_is_recording = 0;
+float perf_series_percentile(const PerfSeries* series, float pct) {
+    static float sorted[PERF_SERIES_SIZE];
+    if (series->count == 0) return 0.0f;
+    memcpy(sorted, series->values, series->count * sizeof(float));
+    qsort(sorted, series->count, sizeof(float), compare_floats);
+    int index = (int)(pct / 100.0f * (series->count - 1) + 0.5f);
+    return sorted[index];
+}
 
-    char log[100];
-    snprintf(log, sizeof(log), "EVP saved: %s", g_current_filename);
-    add_log_entry(log);
+void reset_analysis_state() {
+    SDL_AtomicSet(&g_fft_ready, 0);
+    g_fft_frame_head = 0;
+    g_fft_frame_tail = 0;
+    for (int i = 0; i < FFT_PLAN_CACHE_SIZE; i++) {
+        memset(g_fft_plans[i].batched, 0, sizeof(g_fft_plans[i].batched));
+    }
+    g_hops_batched = 0;
+    while (SDL_SemTryWait(g_fft_sem) == 0) {}
+    g_hop_fill = 0;
+    g_samples_captured = 0;
+    g_analysis_time_ms = 0;
+    for (int b = 0; b < g_band_count; b++) {
+        reset_band(&g_bands[b]);
+    }
+    memset(g_peak_tracks, 0, sizeof(g_peak_tracks));
+    SDL_AtomicSet(&g_hops_total, 0);
+    SDL_AtomicSet(&g_hops_dropped, 0);
+    memset(&g_hop_cost_ms, 0, sizeof(g_hop_cost_ms));
+    memset(&g_hop_latency_ms, 0, sizeof(g_hop_latency_ms));
+    memset(&g_vad_cost_ms, 0, sizeof(g_vad_cost_ms));
+    memset(&g_capture_wait_ms, 0, sizeof(g_capture_wait_ms));
+    memset(&g_detect_latency_ms, 0, sizeof(g_detect_latency_ms));
+    memset(&g_tdoa_cost_ms, 0, sizeof(g_tdoa_cost_ms));
+    memset(&g_survey_cost_ms, 0, sizeof(g_survey_cost_ms));
+    g_survey.hops = 0;
+    memset(&g_feature_cost_ms, 0, sizeof(g_feature_cost_ms));
+    g_feature_file_end = 0; // The sample clock restarts, so does the file
+    tdoa_reset(&g_tdoa);
+    g_tdoa_located = 0;
+    vad_reset(&g_vad);
+    sdft_reset(&g_sdft);
+    BusMessage stale;
+    while (bus_take(&stale)) {}
 }
 
-void write_wav_header(FILE* file, unsigned int data_size) {
-    unsigned int sample_rate = SAMPLE_RATE;
-    unsigned short bits_per_sample = 16;
-    unsigned short channels = 1;
-    unsigned int byte_rate = sample_rate * channels * bits_per_sample / 8;
-    unsigned short block_align = channels * bits_per_sample / 8;
-    unsigned int chunk_size = 36 + data_size;
+typedef struct {
+    int hops;
+    int dropped;
+    float cost_p50, cost_p99;
+    float latency_p50, latency_p99;
+    int pass;
+} CapacityTrial;
 
-    fwrite("RIFF", 1, 4, file);
-    fwrite(&chunk_size, 4, 1, file);
-    fwrite("WAVE", 1, 4, file);
-    fwrite("fmt ", 1, 4, file);
-    unsigned int subchunk1_size = 16;
-    unsigned short audio_format = 1;
-    fwrite(&subchunk1_size, 4, 1, file);
-    fwrite(&audio_format, 2, 1, file);
-    fwrite(&channels, 2, 1, file);
-    fwrite(&sample_rate, 4, 1, file);
-    fwrite(&byte_rate, 4, 1, file);
-    fwrite(&block_align, 2, 1, file);
-    fwrite(&bits_per_sample, 2, 1, file);
-    fwrite("data", 1, 4, file);
-    fwrite(&data_size, 4, 1, file);
+CapacityTrial capacity_trial(float speed, int print, float trial_seconds, float latency_budget_ms) {
+    CapacityTrial t;
+    reset_analysis_state();
+    g_synth_config.speed = speed;
+    // trial_seconds of wall-clock time, whatever the speed, and at least
+    // CAPACITY_MIN_HOPS hops, so fast trials are not over in a few milliseconds.
+    const FftPlan* plan = (const FftPlan*)SDL_AtomicGetPtr(&g_pending_plan);
+    double samples = fmax((double)trial_seconds * speed * SAMPLE_RATE,
+                          (double)CAPACITY_MIN_HOPS * plan->hop + plan->config.size);
+    g_synth_config.duration_samples = (Uint32)fmin(samples, 4e9);
+    start_synth();
+    while (!g_quit_requested) {
+        if (SDL_SemWaitTimeout(g_fft_sem, 100) == 0 && SDL_AtomicGet(&g_fft_ready)) {
+            fft_catch_up();
+            process_fft();
+        }
+        bus_drain();
+        if (SDL_AtomicGet(&g_synth_done) && !SDL_AtomicGet(&g_fft_ready)) break;
+    }
+    stop_synth();
+    t.hops = SDL_AtomicGet(&g_hops_total);
+    t.dropped = SDL_AtomicGet(&g_hops_dropped);
+    t.cost_p50 = perf_series_percentile(&g_hop_cost_ms, 50.0f);
+    t.cost_p99 = perf_series_percentile(&g_hop_cost_ms, 99.0f);
+    t.latency_p50 = perf_series_percentile(&g_hop_latency_ms, 50.0f);
+    t.latency_p99 = perf_series_percentile(&g_hop_latency_ms, 99.0f);
+    t.pass = t.dropped == 0 && t.latency_p99 <= latency_budget_ms;
+    if (print) {
+        printf("  %7.1fx %6d %8d %9.3f %9.3f %9.3f %9.3f  %s\n", speed, t.hops, t.dropped, t.cost_p50, t.cost_p99,
+               t.latency_p50, t.latency_p99, t.pass ? "ok" : (t.dropped ? "DROPS" : "LATENCY"));
+        fflush(stdout);
+    }
+    return t;
 }
 
-void add_classified_event(EventType type, float duration) {
-    // Shift history
-    if (g_event_history_count >= EVENT_HISTORY_SIZE) {
-        memmove(g_event_history, g_event_history + 1, (EVENT_HISTORY_SIZE - 1) * sizeof(ClassifiedEvent));
+// Finds the highest multiple of real time the current settings sustain:
+// doubling up from start while trials pass, or halving down while they fail,
+// then bisecting. Each multiple of real time is one more capture channel the
+// box could keep up with. Returns 0 if even real time fails, and sets
+// *capped if CAPACITY_MAX_SPEED still passed.
+float capacity_search(float start, int bisect_steps, int print, float trial_seconds, float latency_budget_ms,
+                      int* capped) {
+    float good = 0.0f, bad = 0.0f;
+    float speed = fminf(fmaxf(start, 1.0f), CAPACITY_MAX_SPEED);
+    if (capacity_trial(speed, print, trial_seconds, latency_budget_ms).pass) {
+        good = speed;
+        while (good < CAPACITY_MAX_SPEED && !g_quit_requested) {
+            speed = fminf(good * 2.0f, CAPACITY_MAX_SPEED);
+            if (!capacity_trial(speed, print, trial_seconds, latency_budget_ms).pass) {
+                bad = speed;
+                break;
+            }
+            good = speed;
+        }
     } else {
-        g_event_history_count++;
+        bad = speed;
+        while (bad > 1.0f && !g_quit_requested) {
+            speed = fmaxf(bad * 0.5f, 1.0f);
+            if (capacity_trial(speed, print, trial_seconds, latency_budget_ms).pass) {
+                good = speed;
+                break;
+            }
+            bad = speed;
+        }
     }
+    for (int i = 0; i < bisect_steps && good > 0.0f && bad > 0.0f && !g_quit_requested; i++) {
+        float mid = 0.5f * (good + bad);
+        if (capacity_trial(mid, print, trial_seconds, latency_budget_ms).pass) {
+            good = mid;
+        } else {
+            bad = mid;
+        }
+    }
+    *capped = good > 0.0f && bad == 0.0f;
+    return good;
+}
 
-    // Add new event
-    ClassifiedEvent* new_event = &g_event_history[g_event_history_count - 1];
-    new_event->type = type;
-
-    // Classify duration and update average
-    if (type == EVENT_BURST) {
-        new_event->duration_class = (duration < g_avg_burst_duration) ? DURATION_SHORT : DURATION_LONG;
-        g_avg_burst_duration = (g_avg_burst_duration * g_burst_count + duration) / (g_burst_count + 1);
-        g_burst_count++;
-    } else { // EVENT_SILENCE
-        new_event->duration_class = (duration < g_avg_silence_duration) ? DURATION_SHORT : DURATION_LONG;
-        g_avg_silence_duration = (g_avg_silence_duration * g_silence_count + duration) / (g_silence_count + 1);
-        g_silence_count++;
+// Switches to config and searches from start, printing one sweep line.
+// Returns 0 if the plan could not be built.
+float capacity_sweep(const FftConfig* config, const char* label, float start, float trial_seconds,
+                     float latency_budget_ms) {
+    set_fft_config(config);
+    FftPlan* plan = (FftPlan*)SDL_AtomicGetPtr(&g_pending_plan);
+    if (g_fft_config_dirty || !plan || !fft_config_equal(&plan->config, config)) {
+        printf("  %-16s no plan (out of memory)\n", label);
+        return 0.0f;
     }
-    
-    analyze_patterns();
+    int capped;
+    float sustained =
+        capacity_search(start, CAPACITY_SWEEP_BISECT_STEPS, 0, trial_seconds, latency_budget_ms, &capped);
+    printf("  %-16s hop %5d  %7.1fx%s\n", label, plan->hop, sustained, capped ? " (ceiling)" : "");
+    fflush(stdout);
+    return sustained;
 }
 
-void analyze_patterns() {
-    if (g_event_history_count < PATTERN_LENGTH) {
-        g_pattern_reps = 0;
-        return;
+// Drives the full pipeline from the synthetic source to find how many
+// channels of the configured analysis the box sustains without dropping hops
+// or exceeding the p99 latency budget. Then it varies the FFT size, the
+// overlap and the band count in turn, the other settings as configured, and
+// reports the largest of each that still sustains the requested channels.
+int run_capacity(int channels, float trial_seconds, float latency_budget_ms) {
+    static const float overlaps[] = {0.0f, 0.5f, 0.75f, 0.875f, FFT_MAX_OVERLAP};
+    g_headless = 1;
+    g_synth_enabled = 1;
+    g_record_enabled = 0;
+    g_quiet = 1;
+    if (SDL_Init(0) < 0) return 1;
+    g_fft_sem = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&g_wake_on_frame, g_headless || g_latency_profiles[g_latency_profile].wake_ms == 0);
+    g_capture_samples = g_latency_profiles[g_latency_profile].device_samples;
+    if (!g_fft_sem || start_writer() != 0) return 1;
+    apply_fft_config();
+    FftPlan* plan = (FftPlan*)SDL_AtomicGetPtr(&g_pending_plan);
+    if (!plan) return 1;
+    signal(SIGINT, handle_sigint);
+    FftConfig base = plan->config;
+    int base_hop = plan->hop, base_bands = g_band_count;
+
+    printf("Capacity search: FFT %d %s, hop %d (%.1f%% overlap), %d band(s), %d input(s) per channel, %d Hz, p99 "
+           "latency budget %.1f ms%s\n",
+           base.size, window_name(base.window), base_hop, base.overlap * 100.0f, base_bands, g_capture_channels,
+           SAMPLE_RATE, latency_budget_ms, g_sdft_enabled ? ", sliding DFT on" : "");
+    printf("  %8s %6s %8s %9s %9s %9s %9s\n", "speed", "hops", "dropped", "cost p50", "cost p99", "lat p50",
+           "lat p99");
+    int capped;
+    float sustained = capacity_search(1.0f, CAPACITY_BISECT_STEPS, 1, trial_seconds, latency_budget_ms, &capped);
+    if (sustained == 0.0f) {
+        printf("Result: this machine cannot sustain even one real-time channel at FFT %d.\n", base.size);
+    } else {
+        printf("Result: sustained %.1fx real time at FFT %d / hop %d -> about %d concurrent channel(s)%s\n",
+               sustained, base.size, base_hop, (int)sustained, capped ? " (search ceiling reached)" : "");
     }
 
-    // Define the target pattern as the last N events
-    ClassifiedEvent target_pattern[PATTERN_LENGTH];
-    memcpy(target_pattern, &g_event_history[g_event_history_count - PATTERN_LENGTH], PATTERN_LENGTH * sizeof(ClassifiedEvent));
-    
-    int reps = 0;
-    // Scan the rest of the history for this pattern
-    for (int i = 0; i <= g_event_history_count - PATTERN_LENGTH; i++) {
-        if (memcmp(target_pattern, &g_event_history[i], PATTERN_LENGTH * sizeof(ClassifiedEvent)) == 0) {
-            reps++;
+    printf("Sweep: sustainable multiple of real time with one setting changed\n");
+    char label[32];
+    int max_size = 0;
+    float guess = sustained;
+    for (int size = FFT_MIN_SIZE; size <= FFT_MAX_SIZE && !g_quit_requested; size *= 2) {
+        FftConfig config = base;
+        config.size = size;
+        snprintf(label, sizeof(label), "FFT %d", size);
+        float x = capacity_sweep(&config, label, guess, trial_seconds, latency_budget_ms);
+        if (x >= channels) max_size = size;
+        if (x > 0.0f) guess = x;
+    }
+    float max_overlap = -1.0f;
+    guess = sustained;
+    for (int i = 0; i < (int)(sizeof(overlaps) / sizeof(overlaps[0])) && !g_quit_requested; i++) {
+        FftConfig config = base;
+        config.overlap = overlaps[i];
+        snprintf(label, sizeof(label), "overlap %.2f%%", overlaps[i] * 100.0f);
+        float x = capacity_sweep(&config, label, guess, trial_seconds, latency_budget_ms);
+        if (x >= channels) max_overlap = overlaps[i];
+        if (x > 0.0f) guess = x;
+    }
+    // Extra bands spread over 300 Hz..18 kHz, so they also widen the range
+    // of bins analysed, as an audible band beside the ultrasonic one would.
+    BandSpec configured[MAX_BANDS], sweep[MAX_BANDS];
+    for (int b = 1; b < base_bands; b++) configured[b - 1] = g_bands[b].spec;
+    int max_bands = 0;
+    guess = sustained;
+    for (int count = 1; count <= MAX_BANDS && !g_quit_requested; count++) {
+        for (int b = 0; b < count - 1; b++) {
+            float width = 17700.0f / (count - 1);
+            snprintf(sweep[b].name, sizeof(sweep[b].name), "Sweep %d", b + 1);
+            sweep[b].min_hz = 300.0f + b * width;
+            sweep[b].max_hz = 300.0f + (b + 1) * width;
+            sweep[b].threshold_db = g_bands[0].spec.threshold_db;
         }
+        set_extra_bands(sweep, count - 1);
+        snprintf(label, sizeof(label), "%d band(s)", count);
+        float x = capacity_sweep(&base, label, guess, trial_seconds, latency_budget_ms);
+        if (x >= channels) max_bands = count;
+        if (x > 0.0f) guess = x;
     }
+    set_extra_bands(configured, base_bands - 1);
+    set_fft_config(&base);
 
-    // If this pattern is found more than once, log it
-    if (reps > 1) {
-        memcpy(g_detected_pattern, target_pattern, PATTERN_LENGTH * sizeof(ClassifiedEvent));
-        g_pattern_reps = reps;
-    } else {
-        g_pattern_reps = 0;
+    if (!g_quit_requested) {
+        char size_text[16] = "none", overlap_text[16] = "none", bands_text[16] = "none";
+        if (max_size) snprintf(size_text, sizeof(size_text), "%d", max_size);
+        if (max_overlap >= 0.0f) snprintf(overlap_text, sizeof(overlap_text), "%.2f%%", max_overlap * 100.0f);
+        if (max_bands) snprintf(bands_text, sizeof(bands_text), "%d", max_bands);
+        printf("Limits for %d channel(s): FFT size %s, overlap %s, %s band(s); %d channel(s) as configured\n",
+               channels, size_text, overlap_text, bands_text, (int)sustained);
     }
+    stop_writer();
+    free_fft_plans();
+    SDL_DestroySemaphore(g_fft_sem);
+    g_fft_sem = NULL;
+    SDL_Quit();
+    return 0;
 }
 
+// Times the generated codelets against the generic cdft() path on the same
+// windowed noise. The first generic call includes the twiddle and
+// bit-reversal setup cdft() performs lazily; the codelets have none, so
+// their first call only pays for cold caches. cdft() works in place and
+// needs a fresh copy of the frame per call; the codelets read the frame.
+int run_fft_benchmark(int iterations) {
+    static double input[FFT_SIZE * 2];
+    static double generic[FFT_SIZE * 2];
+    static double codelet[FFT_SIZE * 2];
+    double ticks_per_us = SDL_GetPerformanceFrequency() / 1e6;
+    Uint32 rng = 1;
 
-void process_fft() {
-    cdft(FFT_SIZE * 2, -1, g_fft_buffer, g_fft_ip, g_fft_w);
+    if (iterations < 1) iterations = 1;
+    for (int j = 0; j < FFT_SIZE; j++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        input[j * 2] = ((double)rng / 4294967295.0 - 0.5) * 0.5 * (1.0 - cos(2.0 * M_PI * j / (FFT_SIZE - 1)));
+        input[j * 2 + 1] = 0.0;
+    }
 
-    float bin_size_hz = (float)SAMPLE_RATE / FFT_SIZE;
-    int min_bin = (int)(MIN_FREQ_TO_DISPLAY / bin_size_hz);
-    int max_bin = (int)(MAX_FREQ_TO_DISPLAY / bin_size_hz);
-    
-    float current_total_energy = 0.0f;
-    g_peak_mag = -200.0f;
+    g_fft_ip[0] = 0;
+    memcpy(generic, input, sizeof(input));
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    cdft(FFT_SIZE * 2, -1, generic, g_fft_ip, g_fft_w);
+    double generic_first_us = (SDL_GetPerformanceCounter() - t0) / ticks_per_us;
 
-    for (int i = min_bin; i <= max_bin; i++) {
-        double real = g_fft_buffer[i * 2];
-        double imag = g_fft_buffer[i * 2 + 1];
-        g_fft_magnitudes[i] = 10 * log10(fmax(1e-12, real * real + imag * imag));
-        current_total_energy += g_fft_magnitudes[i];
-        if (g_fft_magnitudes[i] > g_peak_mag) {
-            g_peak_mag = g_fft_magnitudes[i];
-            g_peak_freq = i * bin_size_hz;
-        }
+    t0 = SDL_GetPerformanceCounter();
+    fft_codelet_forward(codelet, input);
+    double codelet_first_us = (SDL_GetPerformanceCounter() - t0) / ticks_per_us;
+
+    double max_diff = 0.0;
+    for (int j = 0; j < FFT_SIZE * 2; j++) {
+        max_diff = fmax(max_diff, fabs(generic[j] - codelet[j]));
     }
-    
-    float avg_energy = current_total_energy / (max_bin - min_bin + 1);
-
-    Uint32 current_time = SDL_GetTicks();
-    if (g_burst_state == STATE_QUIET && avg_energy > g_burst_threshold_db) {
-        g_burst_state = STATE_BURST;
-        float quiet_duration = (current_time - g_quiet_start_time) / 1000.0f;
-        g_burst_start_time = current_time;
-        add_classified_event(EVENT_SILENCE, quiet_duration);
-        char log[100];
-        snprintf(log, sizeof(log), "Silence: %.2fs", quiet_duration);
-        add_log_entry(log);
-    } else if (g_burst_state == STATE_BURST && avg_energy <= g_burst_threshold_db) {
-        g_burst_state = STATE_QUIET;
-        float burst_duration = (current_time - g_burst_start_time) / 1000.0f;
-        g_quiet_start_time = current_time;
-        add_classified_event(EVENT_BURST, burst_duration);
-        char log[100];
-        snprintf(log, sizeof(log), ">> BURST: %.2fs @ %.0f Hz", burst_duration, g_peak_freq);
-        add_log_entry(log);
+
+    // Alternate the two paths and keep each one's best round, which is the
+    // least disturbed by the scheduler.
+    double generic_us = 1e30, codelet_us = 1e30;
+    for (int round = 0; round < FFT_BENCH_ROUNDS; round++) {
+        t0 = SDL_GetPerformanceCounter();
+        for (int i = 0; i < iterations; i++) {
+            memcpy(generic, input, sizeof(input));
+            cdft(FFT_SIZE * 2, -1, generic, g_fft_ip, g_fft_w);
+        }
+        generic_us = fmin(generic_us, (SDL_GetPerformanceCounter() - t0) / ticks_per_us / iterations);
+
+        t0 = SDL_GetPerformanceCounter();
+        for (int i = 0; i < iterations; i++) {
+            fft_codelet_forward(codelet, input);
+        }
+        codelet_us = fmin(codelet_us, (SDL_GetPerformanceCounter() - t0) / ticks_per_us / iterations);
     }
+
+    printf("FFT %d, %d transforms x %d rounds (best round)\n", FFT_SIZE, iterations, FFT_BENCH_ROUNDS);
+    printf("  %-18s %10s %12s\n", "path", "first us", "steady us");
+    printf("  %-18s %10.1f %12.2f\n", "generic cdft+copy", generic_first_us, generic_us);
+    printf("  %-18s %10.1f %12.2f\n", "codelets", codelet_first_us, codelet_us);
+    printf("  speedup %.2fx, max difference %.3g\n", generic_us / codelet_us, max_diff);
+    return max_diff < 1e-6 ? 0 : 1;
 }
 
 // --- Main Loop and Rendering ---
 
 void run_main_loop() {
+    if (g_headless) {
+        run_headless_loop();
+        return;
+    }
+
     int is_running = 1;
     SDL_Event e;
     int new_data_available = 0;
+    Uint32 last_render = 0;
 
     while (is_running) {
         while (SDL_PollEvent(&e) != 0) {
             handle_input(&e, &is_running);
         }
 
-        if (SDL_AtomicGet(&g_fft_ready)) {
+        while (SDL_AtomicGet(&g_fft_ready)) {
+            fft_catch_up();
             process_fft();
-            SDL_AtomicSet(&g_fft_ready, 0);
             new_data_available = 1;
         }
+        bus_drain();
+        poll_config_file();
+        poll_survey();
+        apply_fft_config(); // Also retries a switch deferred while the callback held every plan
 
-        render(new_data_available);
-        new_data_available = 0;
-
-        SDL_Delay(16);
+        // Display frames are paced by the latency profile; in between, the
+        // loop sleeps until the next frame arrives (low-latency) or for the
+        // profile's wake period.
+        const LatencyProfileSpec* profile = &g_latency_profiles[g_latency_profile];
+        Uint32 now = SDL_GetTicks();
+        if (now - last_render >= (Uint32)profile->render_ms) {
+            render(new_data_available);
+            new_data_available = 0;
+            last_render = now;
+        }
+        Uint32 until_render = (Uint32)profile->render_ms - (SDL_GetTicks() - last_render);
+        if (until_render > (Uint32)profile->render_ms) until_render = 0;
+        if (SDL_AtomicGet(&g_wake_on_frame)) {
+            SDL_SemWaitTimeout(g_fft_sem, until_render);
+        } else {
+            Uint32 wake = analysis_wake_ms();
+            SDL_Delay(wake < until_render ? wake : until_render);
+        }
     }
 }
 
@@ -491,17 +6787,17 @@ void handle_input(SDL_Event* e, int* is_running) {
                     }
                 }
                 break;
-            case SDLK_UP: g_input_gain_db = fminf(20.0f, g_input_gain_db + 1.0f); break;
-            case SDLK_DOWN: g_input_gain_db = fmaxf(-20.0f, g_input_gain_db - 1.0f); break;
-            case SDLK_RIGHT: g_burst_threshold_db = fminf(0.0f, g_burst_threshold_db + 1.0f); break;
-            case SDLK_LEFT: g_burst_threshold_db = fmaxf(-80.0f, g_burst_threshold_db - 1.0f); break;
+            case SDLK_UP: set_input_gain_db(fminf(20.0f, input_gain_db() + 1.0f)); break;
+            case SDLK_DOWN: set_input_gain_db(fmaxf(-20.0f, input_gain_db() - 1.0f)); break;
+            case SDLK_RIGHT: g_bands[0].spec.threshold_db = fminf(0.0f, g_bands[0].spec.threshold_db + 1.0f); break;
+            case SDLK_LEFT: g_bands[0].spec.threshold_db = fmaxf(-80.0f, g_bands[0].spec.threshold_db - 1.0f); break;
             case SDLK_SPACE:
                 if (g_is_paused) {
-                    SDL_PauseAudioDevice(g_audio_device_id, 0);
+                    set_capture_paused(0);
                     g_is_paused = 0;
                     add_log_entry("Monitoring resumed.");
                 } else {
-                    SDL_PauseAudioDevice(g_audio_device_id, 1);
+                    set_capture_paused(1);
                     g_is_paused = 1;
                     add_log_entry("Monitoring paused.");
                 }
@@ -510,11 +6806,58 @@ void handle_input(SDL_Event* e, int* is_running) {
                 g_event_log_pos = 0;
                 add_log_entry("Event log cleared.");
                 break;
+            case SDLK_LEFTBRACKET:
+            case SDLK_RIGHTBRACKET: {
+                FftConfig config = g_fft_config;
+                config.size = e->key.keysym.sym == SDLK_RIGHTBRACKET ? config.size * 2 : config.size / 2;
+                if (config.size >= FFT_MIN_SIZE && config.size <= FFT_MAX_SIZE) set_fft_config(&config);
+                break;
+            }
+            case SDLK_l:
+                set_latency_profile((LatencyProfile)((g_latency_profile + 1) % LATENCY_PROFILE_COUNT));
+                break;
+            case SDLK_h:
+                set_monitor_mode((MonitorMode)((SDL_AtomicGet(&g_monitor_mode) + 1) % MONITOR_MODE_COUNT));
+                break;
+            case SDLK_PAGEUP:
+            case SDLK_PAGEDOWN: {
+                int step = e->key.keysym.sym == SDLK_PAGEUP ? MONITOR_LO_STEP_HZ : -MONITOR_LO_STEP_HZ;
+                int lo_hz = SDL_AtomicGet(&g_monitor_lo_hz) + step;
+                if (lo_hz >= MONITOR_MIN_LO_HZ && lo_hz <= MONITOR_MAX_LO_HZ) {
+                    SDL_AtomicSet(&g_monitor_lo_hz, lo_hz);
+                    if (SDL_AtomicGet(&g_monitor_mode) != MONITOR_OFF) {
+                        set_monitor_mode((MonitorMode)SDL_AtomicGet(&g_monitor_mode));
+                    }
+                }
+                break;
+            }
+            case SDLK_w: {
+                FftConfig config = g_fft_config;
+                config.window = (WindowType)((config.window + 1) % WINDOW_COUNT);
+                set_fft_config(&config);
+                break;
+            }
+            case SDLK_o: {
+                static const float steps[] = {0.0f, 0.5f, 0.75f, 0.875f};
+                FftConfig config = g_fft_config;
+                int next = 0;
+                while (next < 4 && steps[next] <= config.overlap + 0.001f) next++;
+                config.overlap = next < 4 ? steps[next] : steps[0];
+                set_fft_config(&config);
+                break;
+            }
         }
     }
 }
 
+// UI thread only: wraps lines with the font. Other threads use the bus.
 void add_log_entry(const char* entry) {
+    if (entry && g_headless) {
+        if (g_quiet) return;
+        printf("[%9.3f] %s\n", SDL_GetTicks() / 1000.0, entry);
+        fflush(stdout);
+        return;
+    }
     if (!entry || !g_font_small) return;
 
     char text[256];
@@ -560,6 +6903,110 @@ void add_log_entry(const char* entry) {
     }
 }
 
+// --- Message Bus ---
+//
+// Bounded multi-producer, single-consumer queue (after Vyukov). A producer
+// claims a position with one CAS on g_bus_head, copies its message into the
+// slot and publishes it through the slot's sequence; the UI thread takes
+// published slots in order once per frame. Nothing blocks: a full bus drops
+// the message and counts it.
+
+void bus_init() {
+    for (int i = 0; i < BUS_SLOTS; i++) {
+        SDL_AtomicSet(&g_bus_slots[i].sequence, i);
+    }
+    SDL_AtomicSet(&g_bus_head, 0);
+    g_bus_tail = 0;
+}
+
+int bus_post(const BusMessage* message) {
+    for (;;) {
+        Uint32 pos = (Uint32)SDL_AtomicGet(&g_bus_head);
+        BusSlot* slot = &g_bus_slots[pos & (BUS_SLOTS - 1)];
+        Sint32 turn = (Sint32)((Uint32)SDL_AtomicGet(&slot->sequence) - pos);
+        if (turn == 0) {
+            if (SDL_AtomicCAS(&g_bus_head, (int)pos, (int)(pos + 1))) {
+                slot->message = *message;
+                SDL_AtomicSet(&slot->sequence, (int)(pos + 1));
+                return 1;
+            }
+        } else if (turn < 0) {
+            // The slot still holds a message from BUS_SLOTS positions ago.
+            SDL_AtomicAdd(&g_bus_dropped, 1);
+            return 0;
+        }
+        // Otherwise another producer claimed pos first; try the next one.
+    }
+}
+
+void bus_post_text(const char* text) {
+    BusMessage message;
+    message.type = BUS_TEXT;
+    strncpy(message.data.text, text, BUS_TEXT_SIZE - 1);
+    message.data.text[BUS_TEXT_SIZE - 1] = '\0';
+    bus_post(&message);
+}
+
+int bus_take(BusMessage* out) {
+    BusSlot* slot = &g_bus_slots[g_bus_tail & (BUS_SLOTS - 1)];
+    if ((Uint32)SDL_AtomicGet(&slot->sequence) != g_bus_tail + 1) return 0;
+    *out = slot->message;
+    SDL_AtomicSet(&slot->sequence, (int)(g_bus_tail + BUS_SLOTS));
+    g_bus_tail++;
+    return 1;
+}
+
+// UI thread, once per frame. Turns each message into log text; fast bursts
+// are logged once, at their offset, with the onset timing the FFT path
+// cannot resolve.
+void bus_drain() {
+    static Uint64 onset_sample = 0;
+    static Uint32 dropped_reported = 0;
+    BusMessage message;
+    char log[100];
+    while (bus_take(&message)) {
+        switch (message.type) {
+            case BUS_TEXT:
+                add_log_entry(message.data.text);
+                break;
+            case BUS_SDFT:
+                if (message.data.sdft.type == SDFT_ONSET) {
+                    onset_sample = message.data.sdft.sample;
+                    break;
+                }
+                snprintf(log, sizeof(log), "Fast burst: %.1f ms @ %.0f Hz, %.1f dBFS at %.4fs",
+                         message.data.sdft.duration * 1000.0f, message.data.sdft.freq_hz, message.data.sdft.level_db,
+                         (double)onset_sample / SAMPLE_RATE);
+                add_log_entry(log);
+                break;
+            case BUS_HOPS_DROPPED:
+                add_log_entry("Analysis fell behind; dropping frames.");
+                break;
+            case BUS_EXPORT_CONNECTED:
+                snprintf(log, sizeof(log), "Collector connected (%u frames spilled so far).", message.data.count);
+                add_log_entry(log);
+                break;
+            case BUS_EXPORT_LOST:
+                add_log_entry("Collector lost; spilling events to disk.");
+                break;
+        }
+    }
+    Uint32 dropped = (Uint32)SDL_AtomicGet(&g_bus_dropped);
+    if (dropped != dropped_reported) {
+        snprintf(log, sizeof(log), "Message bus full: %u message(s) lost.", dropped - dropped_reported);
+        add_log_entry(log);
+        dropped_reported = dropped;
+    }
+}
+
+float input_gain_db() {
+    return SDL_AtomicGet(&g_input_gain_cdb) / 100.0f;
+}
+
+void set_input_gain_db(float db) {
+    SDL_AtomicSet(&g_input_gain_cdb, (int)lroundf(db * 100.0f));
+}
+
 void render_text_clipped(const char* text, int x, int y, int max_width, TTF_Font* font, SDL_Color color) {
     if (!text || !font) return;
     SDL_Surface* surface = TTF_RenderText_Blended(font, text, color);
@@ -590,7 +7037,7 @@ void render(int has_new_data) {
     SDL_Color text_color = {100, 255, 100, 255};
     SDL_Color highlight_color = {255, 255, 100, 255};
 
-    if (has_new_data) {
+    if (has_new_data && g_display_plan) {
         if (SDL_SetRenderTarget(g_renderer, g_temp_texture) != 0) {
             SDL_Log("SDL_SetRenderTarget failed: %s", SDL_GetError());
         }
@@ -605,10 +7052,11 @@ void render(int has_new_data) {
             SDL_Log("SDL_RenderCopy failed: %s", SDL_GetError());
         }
 
+        float bin_size_hz = (float)SAMPLE_RATE / g_display_plan->config.size;
         for (int i = 0; i < SCREEN_WIDTH; i++) {
             float freq = MIN_FREQ_TO_DISPLAY + ((float)i / SCREEN_WIDTH) * (MAX_FREQ_TO_DISPLAY - MIN_FREQ_TO_DISPLAY);
-            int bin_index = (int)(freq / ((float)SAMPLE_RATE / FFT_SIZE));
-            float val = (g_fft_magnitudes[bin_index] + 80.0f) / 80.0f;
+            int bin_index = (int)(freq / bin_size_hz);
+            float val = (g_display_plan->magnitudes[bin_index] + 80.0f) / 80.0f;
             val = fmaxf(0.0f, fminf(1.0f, val));
             SDL_SetRenderDrawColor(g_renderer, (Uint8)(val * 100), (Uint8)(val * 255), (Uint8)(val * 100), 255);
             if (SDL_RenderDrawPoint(g_renderer, i, 0) != 0) {
@@ -670,17 +7118,75 @@ void render(int has_new_data) {
 
     // Left Column
     render_text_clipped("STATUS & CONTROLS", LEFT_COL_X - 5, PANEL_TOP, LEFT_COL_WIDTH + 10, g_font_medium, highlight_color);
-    snprintf(buffer, sizeof(buffer), "Input Gain: %+.1f dB (Up/Down)", g_input_gain_db);
+    snprintf(buffer, sizeof(buffer), "Input Gain: %+.1f dB (Up/Down)", input_gain_db());
     render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 30, LEFT_COL_WIDTH, g_font_small, text_color);
-    snprintf(buffer, sizeof(buffer), "Burst Threshold: %+.1f dB (Left/Right)", g_burst_threshold_db);
+    snprintf(buffer, sizeof(buffer), "Burst Threshold: %+.1f dB (Left/Right)", g_bands[0].spec.threshold_db);
     render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 50, LEFT_COL_WIDTH, g_font_small, text_color);
-    if (g_burst_state == STATE_BURST) {
+    if (g_bands[0].state == STATE_BURST) {
         render_text_clipped("STATE: BURST DETECTED", LEFT_COL_X, PANEL_TOP + 70, LEFT_COL_WIDTH, g_font_small, highlight_color);
     } else {
         render_text_clipped("STATE: Monitoring...", LEFT_COL_X, PANEL_TOP + 70, LEFT_COL_WIDTH, g_font_small, text_color);
     }
     render_text_clipped("Space: Pause/Resume", LEFT_COL_X, PANEL_TOP + 90, LEFT_COL_WIDTH, g_font_small, text_color);
     render_text_clipped("C: Clear Event Log", LEFT_COL_X, PANEL_TOP + 110, LEFT_COL_WIDTH, g_font_small, text_color);
+    snprintf(buffer, sizeof(buffer), "FFT: %d, %s, %.1f%% overlap", g_fft_config.size, window_name(g_fft_config.window),
+             g_fft_config.overlap * 100.0f);
+    render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 130, LEFT_COL_WIDTH, g_font_small,
+                        g_fft_config_dirty ? highlight_color : text_color);
+    render_text_clipped("[ ]: FFT Size  W: Window  O: Overlap", LEFT_COL_X, PANEL_TOP + 150, LEFT_COL_WIDTH,
+                        g_font_small, text_color);
+    MonitorMode monitor_mode = (MonitorMode)SDL_AtomicGet(&g_monitor_mode);
+    if (monitor_mode != MONITOR_OFF) {
+        snprintf(buffer, sizeof(buffer), "Listen: %s %.1f kHz, %.0f ms (H, PgUp/PgDn)",
+                 monitor_mode_name(monitor_mode), SDL_AtomicGet(&g_monitor_lo_hz) / 1000.0f,
+                 SDL_AtomicGet(&g_monitor_latency_us) / 1000.0f);
+        render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 190, LEFT_COL_WIDTH, g_font_small, highlight_color);
+    } else {
+        render_text_clipped("Listen: off (H)", LEFT_COL_X, PANEL_TOP + 190, LEFT_COL_WIDTH, g_font_small, text_color);
+    }
+    snprintf(buffer, sizeof(buffer), "Voice: %s %.0f dB (floor %.0f), flat %.2f, zcr %.3f",
+             g_is_recording ? "REC" : g_vad.speech ? "speech" : "quiet", g_vad.last.level_db, g_vad.floor_db,
+             g_vad.last.flatness, g_vad.last.zcr);
+    render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 210, LEFT_COL_WIDTH, g_font_small,
+                        g_is_recording ? highlight_color : text_color);
+    update_latency_stats();
+    snprintf(buffer, sizeof(buffer), "Latency %s: %.0f/%.0f/%.0f ms p50/95/99 (L)",
+             g_latency_profiles[g_latency_profile].name, g_latency_stats[0], g_latency_stats[1], g_latency_stats[2]);
+    render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 230, LEFT_COL_WIDTH, g_font_small, text_color);
+    if (g_tdoa_enabled) {
+        snprintf(buffer, sizeof(buffer), "Bearing: %+.0f deg, %+.1f us, coherence %.2f (%d located)",
+                 g_tdoa_last.bearing_deg, g_tdoa_last.delay_samples * 1e6f / SAMPLE_RATE, g_tdoa_last.coherence,
+                 g_tdoa_located);
+        render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 250, LEFT_COL_WIDTH, g_font_small, text_color);
+    }
+    if (g_survey_enabled) {
+        Uint64 surveyed = g_survey.hops ? (g_survey.last_sample - g_survey.first_sample) / SAMPLE_RATE : 0;
+        snprintf(buffer, sizeof(buffer), "Survey: %lluh%02llum, %llu hops, %d snapshot(s)",
+                 (unsigned long long)(surveyed / 3600), (unsigned long long)(surveyed / 60 % 60),
+                 (unsigned long long)g_survey.hops, g_survey_snapshots);
+        render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 270, LEFT_COL_WIDTH, g_font_small, text_color);
+    }
+    if (g_features_enabled) {
+        snprintf(buffer, sizeof(buffer), "Features: %d hops written, %d dropped", SDL_AtomicGet(&g_feature_written),
+                 SDL_AtomicGet(&g_feature_dropped));
+        render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 290, LEFT_COL_WIDTH, g_font_small,
+                            SDL_AtomicGet(&g_feature_dropped) ? highlight_color : text_color);
+    }
+    if (g_export_enabled && g_export_transport == TRANSPORT_TCP) {
+        snprintf(buffer, sizeof(buffer), "Net TCP: %s sent %d drop %d spill %d",
+                 SDL_AtomicGet(&g_export_connected) ? "UP" : "DOWN",
+                 SDL_AtomicGet(&g_export_frames_sent),
+                 SDL_AtomicGet(&g_export_dropped) + SDL_AtomicGet(&g_export_spill_dropped),
+                 SDL_AtomicGet(&g_export_frames_spilled));
+        render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 170, LEFT_COL_WIDTH, g_font_small,
+                            SDL_AtomicGet(&g_export_connected) ? text_color : highlight_color);
+    } else if (g_export_enabled) {
+        snprintf(buffer, sizeof(buffer), "Net UDP: sent %d drop %d lost %d",
+                 SDL_AtomicGet(&g_export_frames_sent), SDL_AtomicGet(&g_export_dropped),
+                 SDL_AtomicGet(&g_export_frames_lost));
+        render_text_clipped(buffer, LEFT_COL_X, PANEL_TOP + 170, LEFT_COL_WIDTH, g_font_small,
+                            SDL_AtomicGet(&g_export_frames_lost) ? highlight_color : text_color);
+    }
 
     // Middle Column
     current_y = PANEL_TOP;
@@ -691,26 +7197,61 @@ void render(int has_new_data) {
     current_y += 20;
     snprintf(buffer, sizeof(buffer), "Peak Magnitude: %.2f dB", g_peak_mag);
     render_text_clipped(buffer, MID_COL_X, current_y, MID_COL_WIDTH, g_font_small, text_color);
+    if (g_sdft_enabled) {
+        int fast_active = SDL_AtomicGet(&g_sdft_active);
+        current_y += 20;
+        snprintf(buffer, sizeof(buffer), "Fast Detector: %s, %d bins/%.2f ms, %.1f ns/smp (%.2f%% CPU)",
+                 fast_active ? "BURST" : "quiet", g_sdft.num_bins, g_sdft.window * 1000.0f / SAMPLE_RATE,
+                 SDL_AtomicGet(&g_sdft_ns_x100) / 100.0, SDL_AtomicGet(&g_sdft_load_ppm) / 10000.0);
+        render_text_clipped(buffer, MID_COL_X, current_y, MID_COL_WIDTH, g_font_small,
+                            fast_active ? highlight_color : text_color);
+    }
+    for (int t = 0; t < PEAK_TRACK_COUNT; t++) {
+        const PeakTrack* track = &g_peak_tracks[t];
+        current_y += 20;
+        if (!track->id) {
+            render_text_clipped("Track: --", MID_COL_X, current_y, MID_COL_WIDTH, g_font_small, text_color);
+            continue;
+        }
+        snprintf(buffer, sizeof(buffer), "Track %d: %.1f Hz  %.1f dB  %.1fs  %+.0f Hz/s", track->id, track->freq_hz,
+                 track->mag_db, (track->last_ms - track->start_ms) / 1000.0f, track->slope_hz_s);
+        render_text_clipped(buffer, MID_COL_X, current_y, MID_COL_WIDTH, g_font_small,
+                            track->missed ? text_color : highlight_color);
+    }
 
     current_y += 40;
     render_text_clipped("PATTERN ANALYSIS", MID_COL_X - 5, current_y, MID_COL_WIDTH + 10, g_font_medium, highlight_color);
     current_y += 30;
-    if (g_pattern_reps > 1) {
-        char pattern_str[50] = "PATTERN: [";
-        for (int i = 0; i < PATTERN_LENGTH; i++) {
-            char event_char[5];
-            snprintf(event_char, sizeof(event_char), "%c%c",
-                g_detected_pattern[i].type == EVENT_BURST ? 'B' : 'S',
-                g_detected_pattern[i].duration_class == DURATION_SHORT ? 's' : 'L');
-            strcat(pattern_str, event_char);
-            if (i < PATTERN_LENGTH - 1) strcat(pattern_str, " > ");
-        }
-        strcat(pattern_str, "]");
-        snprintf(buffer, sizeof(buffer), "%s (x%d)", pattern_str, g_pattern_reps);
+    if (g_bands[0].pattern_reps > 1) {
+        char pattern_str[50];
+        format_pattern(&g_bands[0], " > ", pattern_str, sizeof(pattern_str));
+        snprintf(buffer, sizeof(buffer), "PATTERN: [%s] (x%d)", pattern_str, g_bands[0].pattern_reps);
         render_text_clipped(buffer, MID_COL_X, current_y, MID_COL_WIDTH, g_font_small, highlight_color);
     } else {
         render_text_clipped("Searching for patterns...", MID_COL_X, current_y, MID_COL_WIDTH, g_font_small, text_color);
     }
+    // Durations at the class cut percentiles of the display band
+    char burst_cuts[32], silence_cuts[32];
+    format_duration_cuts(&g_bands[0].burst_durations, burst_cuts, sizeof(burst_cuts));
+    format_duration_cuts(&g_bands[0].silence_durations, silence_cuts, sizeof(silence_cuts));
+    current_y += 20;
+    snprintf(buffer, sizeof(buffer), "Cuts: burst %s, silence %s", burst_cuts, silence_cuts);
+    render_text_clipped(buffer, MID_COL_X, current_y, MID_COL_WIDTH, g_font_small, text_color);
+    // One line per configured band, as many as fit.
+    for (int b = 1; b < g_band_count && current_y + 40 <= SCREEN_HEIGHT; b++) {
+        const DetectionBand* band = &g_bands[b];
+        char pattern_str[32] = "--";
+        if (band->pattern_reps > 1) {
+            format_pattern(band, ">", pattern_str, sizeof(pattern_str));
+            snprintf(pattern_str + strlen(pattern_str), sizeof(pattern_str) - strlen(pattern_str), " x%d",
+                     band->pattern_reps);
+        }
+        current_y += 20;
+        snprintf(buffer, sizeof(buffer), "%s: %.0f/%.0f dB %s %d [%s]", band->spec.name, band->level_db,
+                 band->spec.threshold_db, band->state == STATE_BURST ? "BURST" : "quiet", band->bursts, pattern_str);
+        render_text_clipped(buffer, MID_COL_X, current_y, MID_COL_WIDTH, g_font_small,
+                            band->state == STATE_BURST ? highlight_color : text_color);
+    }
 
     // Right Column
     render_text_clipped("EVENT LOG", RIGHT_COL_X - 5, PANEL_TOP, RIGHT_COL_WIDTH + 10, g_font_medium, highlight_color);
@@ -722,6 +7263,12 @@ void render(int has_new_data) {
     }
 
     SDL_RenderPresent(g_renderer);
+    Uint64 presented = SDL_GetPerformanceCounter();
+    double ticks_per_ms = SDL_GetPerformanceFrequency() / 1000.0;
+    for (int i = 0; i < g_unshown_count; i++) {
+        perf_series_add(&g_display_latency_ms, (float)((Sint64)(presented - g_unshown_arrivals[i]) / ticks_per_ms));
+    }
+    g_unshown_count = 0;
 }
 
 
@@ -737,10 +7284,16 @@ void cdft(int n, int isgn, double *a, int *ip, double *w)
     if (n > (ip[0] << 2)) {
         makewt(n >> 2, ip, w);
     }
-    if (isgn >= 0) {
+    if (n > 4) {
+        if (isgn >= 0) {
+            bitrv2(n, ip + 2, a);
+            cftfsub(n, a, w);
+        } else {
+            bitrv2conj(n, ip + 2, a);
+            cftbsub(n, a, w);
+        }
+    } else if (n == 4) {
         cftfsub(n, a, w);
-    } else {
-        cftbsub(n, a, w);
     }
 }
 
@@ -774,45 +7327,204 @@ void makewt(int nw, int *ip, double *w)
 void bitrv2(int n, int *ip, double *a)
 {
     int j, j1, k, k1, l, m, m2;
-    double xr, xi;
+    double xr, xi, yr, yi;
     ip[0] = 0;
     l = n;
     m = 1;
     while ((m << 3) < l) {
         l >>= 1;
+        for (j = 0; j < m; j++) {
+            ip[m + j] = ip[j] + l;
+        }
         m <<= 1;
     }
-    m2 = m << 1;
+    m2 = 2 * m;
     if ((m << 3) == l) {
-        for (j = 0; j < m; j++) {
-            j1 = j << 2;
-            k = ip[j] << 1;
-            k1 = k + m2;
-            xr = a[j1];
-            xi = a[j1 + 1];
-            a[j1] = a[k];
-            a[j1 + 1] = a[k + 1];
-            a[k] = xr;
-            a[k + 1] = xi;
-            j1 += m2;
-            k1 += m2;
+        for (k = 0; k < m; k++) {
+            for (j = 0; j < k; j++) {
+                j1 = 2 * j + ip[k];
+                k1 = 2 * k + ip[j];
+                xr = a[j1];
+                xi = a[j1 + 1];
+                yr = a[k1];
+                yi = a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+                j1 += m2;
+                k1 += 2 * m2;
+                xr = a[j1];
+                xi = a[j1 + 1];
+                yr = a[k1];
+                yi = a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+                j1 += m2;
+                k1 -= m2;
+                xr = a[j1];
+                xi = a[j1 + 1];
+                yr = a[k1];
+                yi = a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+                j1 += m2;
+                k1 += 2 * m2;
+                xr = a[j1];
+                xi = a[j1 + 1];
+                yr = a[k1];
+                yi = a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+            }
+            j1 = 2 * k + m2 + ip[k];
+            k1 = j1 + m2;
             xr = a[j1];
             xi = a[j1 + 1];
-            a[j1] = a[k1];
-            a[j1 + 1] = a[k1 + 1];
+            yr = a[k1];
+            yi = a[k1 + 1];
+            a[j1] = yr;
+            a[j1 + 1] = yi;
             a[k1] = xr;
             a[k1 + 1] = xi;
         }
     } else {
+        for (k = 1; k < m; k++) {
+            for (j = 0; j < k; j++) {
+                j1 = 2 * j + ip[k];
+                k1 = 2 * k + ip[j];
+                xr = a[j1];
+                xi = a[j1 + 1];
+                yr = a[k1];
+                yi = a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+                j1 += m2;
+                k1 += m2;
+                xr = a[j1];
+                xi = a[j1 + 1];
+                yr = a[k1];
+                yi = a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+            }
+        }
+    }
+}
+
+void bitrv2conj(int n, int *ip, double *a)
+{
+    int j, j1, k, k1, l, m, m2;
+    double xr, xi, yr, yi;
+    ip[0] = 0;
+    l = n;
+    m = 1;
+    while ((m << 3) < l) {
+        l >>= 1;
         for (j = 0; j < m; j++) {
-            k = ip[j] << 1;
-            j1 = j << 1;
+            ip[m + j] = ip[j] + l;
+        }
+        m <<= 1;
+    }
+    m2 = 2 * m;
+    if ((m << 3) == l) {
+        for (k = 0; k < m; k++) {
+            for (j = 0; j < k; j++) {
+                j1 = 2 * j + ip[k];
+                k1 = 2 * k + ip[j];
+                xr = a[j1];
+                xi = -a[j1 + 1];
+                yr = a[k1];
+                yi = -a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+                j1 += m2;
+                k1 += 2 * m2;
+                xr = a[j1];
+                xi = -a[j1 + 1];
+                yr = a[k1];
+                yi = -a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+                j1 += m2;
+                k1 -= m2;
+                xr = a[j1];
+                xi = -a[j1 + 1];
+                yr = a[k1];
+                yi = -a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+                j1 += m2;
+                k1 += 2 * m2;
+                xr = a[j1];
+                xi = -a[j1 + 1];
+                yr = a[k1];
+                yi = -a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+            }
+            k1 = 2 * k + ip[k];
+            a[k1 + 1] = -a[k1 + 1];
+            j1 = k1 + m2;
+            k1 = j1 + m2;
             xr = a[j1];
-            xi = a[j1 + 1];
-            a[j1] = a[k];
-            a[j1 + 1] = a[k + 1];
-            a[k] = xr;
-            a[k + 1] = xi;
+            xi = -a[j1 + 1];
+            yr = a[k1];
+            yi = -a[k1 + 1];
+            a[j1] = yr;
+            a[j1 + 1] = yi;
+            a[k1] = xr;
+            a[k1 + 1] = xi;
+            k1 += m2;
+            a[k1 + 1] = -a[k1 + 1];
+        }
+    } else {
+        a[1] = -a[1];
+        a[m2 + 1] = -a[m2 + 1];
+        for (k = 1; k < m; k++) {
+            for (j = 0; j < k; j++) {
+                j1 = 2 * j + ip[k];
+                k1 = 2 * k + ip[j];
+                xr = a[j1];
+                xi = -a[j1 + 1];
+                yr = a[k1];
+                yi = -a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+                j1 += m2;
+                k1 += m2;
+                xr = a[j1];
+                xi = -a[j1 + 1];
+                yr = a[k1];
+                yi = -a[k1 + 1];
+                a[j1] = yr;
+                a[j1 + 1] = yi;
+                a[k1] = xr;
+                a[k1 + 1] = xi;
+            }
+            k1 = 2 * k + ip[k];
+            a[k1 + 1] = -a[k1 + 1];
+            a[k1 + m2 + 1] = -a[k1 + m2 + 1];
         }
     }
 }
@@ -883,34 +7595,30 @@ void cftbsub(int n, double *a, double *w)
             j1 = j + l;
             j2 = j1 + l;
             j3 = j2 + l;
-            x0r = a[j] + a[j2];
-            x0i = a[j + 1] + a[j2 + 1];
-            x1r = a[j] - a[j2];
-            x1i = a[j + 1] - a[j2 + 1];
-            x2r = a[j1] + a[j3];
-            x2i = a[j1 + 1] + a[j3 + 1];
-            x3r = a[j1] - a[j3];
-            x3i = a[j1 + 1] - a[j3 + 1];
+            x0r = a[j] + a[j1];
+            x0i = -a[j + 1] - a[j1 + 1];
+            x1r = a[j] - a[j1];
+            x1i = -a[j + 1] + a[j1 + 1];
+            x2r = a[j2] + a[j3];
+            x2i = a[j2 + 1] + a[j3 + 1];
+            x3r = a[j2] - a[j3];
+            x3i = a[j2 + 1] - a[j3 + 1];
             a[j] = x0r + x2r;
-            a[j + 1] = x0i + x2i;
-            a[j1] = x1r + x3i;
+            a[j + 1] = x0i - x2i;
+            a[j2] = x0r - x2r;
+            a[j2 + 1] = x0i + x2i;
+            a[j1] = x1r - x3i;
             a[j1 + 1] = x1i - x3r;
-            x0r = x0r - x2r;
-            x0i = x0i - x2i;
-            x1r = x1r - x3i;
-            x1i = x1i + x3r;
-            a[j2] = x0r;
-            a[j2 + 1] = x0i;
-            a[j3] = x1r;
-            a[j3 + 1] = x1i;
+            a[j3] = x1r + x3i;
+            a[j3 + 1] = x1i + x3r;
         }
     } else {
         for (j = 0; j < l; j += 2) {
             j1 = j + l;
             x0r = a[j] - a[j1];
-            x0i = a[j + 1] - a[j1 + 1];
+            x0i = -a[j + 1] + a[j1 + 1];
             a[j] += a[j1];
-            a[j + 1] += a[j1 + 1];
+            a[j + 1] = -a[j + 1] - a[j1 + 1];
             a[j1] = x0r;
             a[j1 + 1] = x0i;
         }
@@ -949,16 +7657,20 @@ void cft1st(int n, double *a, double *w)
     x3i = a[13] - a[15];
     a[8] = x0r + x2r;
     a[9] = x0i + x2i;
-    a[12] = x0r - x2r;
-    a[13] = x0i - x2i;
-    a[10] = x1r - x3i;
-    a[11] = x1i + x3r;
-    a[14] = x1r + x3i;
-    a[15] = x1i - x3r;
+    a[12] = x2i - x0i;
+    a[13] = x0r - x2r;
+    x0r = x1r - x3i;
+    x0i = x1i + x3r;
+    a[10] = wk1r * (x0r - x0i);
+    a[11] = wk1r * (x0r + x0i);
+    x0r = x3i + x1r;
+    x0i = x3r - x1i;
+    a[14] = wk1r * (x0i - x0r);
+    a[15] = wk1r * (x0i + x0r);
     k1 = 0;
     for (j = 16; j < n; j += 16) {
-        k1 += 4;
-        k2 = k1 << 1;
+        k1 += 2;
+        k2 = 2 * k1;
         wk2r = w[k1];
         wk2i = w[k1 + 1];
         wk1r = w[k2];
@@ -975,12 +7687,22 @@ void cft1st(int n, double *a, double *w)
         x3i = a[j + 5] - a[j + 7];
         a[j] = x0r + x2r;
         a[j + 1] = x0i + x2i;
-        a[j + 4] = x0r - x2r;
-        a[j + 5] = x0i - x2i;
-        a[j + 2] = x1r - x3i;
-        a[j + 3] = x1i + x3r;
-        a[j + 6] = x1r + x3i;
-        a[j + 7] = x1i - x3r;
+        x0r -= x2r;
+        x0i -= x2i;
+        a[j + 4] = wk2r * x0r - wk2i * x0i;
+        a[j + 5] = wk2r * x0i + wk2i * x0r;
+        x0r = x1r - x3i;
+        x0i = x1i + x3r;
+        a[j + 2] = wk1r * x0r - wk1i * x0i;
+        a[j + 3] = wk1r * x0i + wk1i * x0r;
+        x0r = x1r + x3i;
+        x0i = x1i - x3r;
+        a[j + 6] = wk3r * x0r - wk3i * x0i;
+        a[j + 7] = wk3r * x0i + wk3i * x0r;
+        wk1r = w[k2 + 2];
+        wk1i = w[k2 + 3];
+        wk3r = wk1r - 2 * wk2r * wk1i;
+        wk3i = 2 * wk2r * wk1r - wk1i;
         x0r = a[j + 8] + a[j + 10];
         x0i = a[j + 9] + a[j + 11];
         x1r = a[j + 8] - a[j + 10];
@@ -991,63 +7713,79 @@ void cft1st(int n, double *a, double *w)
         x3i = a[j + 13] - a[j + 15];
         a[j + 8] = x0r + x2r;
         a[j + 9] = x0i + x2i;
-        a[j + 12] = x0r - x2r;
-        a[j + 13] = x0i - x2i;
-        a[j + 10] = x1r - x3i;
-        a[j + 11] = x1i + x3r;
-        a[j + 14] = x1r + x3i;
-        a[j + 15] = x1i - x3r;
-        x0r = a[j + 8];
-        x0i = a[j + 9];
-        x1r = a[j + 10];
-        x1i = a[j + 11];
-        x2r = a[j + 12];
-        x2i = a[j + 13];
-        x3r = a[j + 14];
-        x3i = a[j + 15];
-        a[j + 8] = x0r * wk2r - x0i * wk2i;
-        a[j + 9] = x0r * wk2i + x0i * wk2r;
-        a[j + 10] = x1r * wk1r - x1i * wk1i;
-        a[j + 11] = x1r * wk1i + x1i * wk1r;
-        a[j + 12] = x2r * wk2r + x2i * wk2i;
-        a[j + 13] = x2r * wk2i - x2i * wk2r;
-        a[j + 14] = x3r * wk3r - x3i * wk3i;
-        a[j + 15] = x3r * wk3i + x3i * wk3r;
+        x0r -= x2r;
+        x0i -= x2i;
+        a[j + 12] = -wk2i * x0r - wk2r * x0i;
+        a[j + 13] = -wk2i * x0i + wk2r * x0r;
+        x0r = x1r - x3i;
+        x0i = x1i + x3r;
+        a[j + 10] = wk1r * x0r - wk1i * x0i;
+        a[j + 11] = wk1r * x0i + wk1i * x0r;
+        x0r = x1r + x3i;
+        x0i = x1i - x3r;
+        a[j + 14] = wk3r * x0r - wk3i * x0i;
+        a[j + 15] = wk3r * x0i + wk3i * x0r;
     }
 }
 
 void cftmdl(int n, int l, double *a, double *w)
 {
-    int j, j1, j2, k, k1, k2, m, m2;
+    int j, j1, j2, j3, k, k1, k2, m, m2;
     double wk1r, wk1i, wk2r, wk2i, wk3r, wk3i;
     double x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
     m = l << 2;
     for (j = 0; j < l; j += 2) {
         j1 = j + l;
         j2 = j1 + l;
-        k = j + m;
+        j3 = j2 + l;
         x0r = a[j] + a[j1];
         x0i = a[j + 1] + a[j1 + 1];
         x1r = a[j] - a[j1];
         x1i = a[j + 1] - a[j1 + 1];
-        x2r = a[j2] + a[k];
-        x2i = a[j2 + 1] + a[k + 1];
-        x3r = a[j2] - a[k];
-        x3i = a[j2 + 1] - a[k + 1];
+        x2r = a[j2] + a[j3];
+        x2i = a[j2 + 1] + a[j3 + 1];
+        x3r = a[j2] - a[j3];
+        x3i = a[j2 + 1] - a[j3 + 1];
         a[j] = x0r + x2r;
         a[j + 1] = x0i + x2i;
         a[j2] = x0r - x2r;
         a[j2 + 1] = x0i - x2i;
         a[j1] = x1r - x3i;
         a[j1 + 1] = x1i + x3r;
-        a[k] = x1r + x3i;
-        a[k + 1] = x1i - x3r;
-    }
-    k1 = 1;
-    m2 = l;
-    for (k = m; k < n; k += m) {
-        k1++;
-        k2 = k1 << 1;
+        a[j3] = x1r + x3i;
+        a[j3 + 1] = x1i - x3r;
+    }
+    wk1r = w[2];
+    for (j = m; j < l + m; j += 2) {
+        j1 = j + l;
+        j2 = j1 + l;
+        j3 = j2 + l;
+        x0r = a[j] + a[j1];
+        x0i = a[j + 1] + a[j1 + 1];
+        x1r = a[j] - a[j1];
+        x1i = a[j + 1] - a[j1 + 1];
+        x2r = a[j2] + a[j3];
+        x2i = a[j2 + 1] + a[j3 + 1];
+        x3r = a[j2] - a[j3];
+        x3i = a[j2 + 1] - a[j3 + 1];
+        a[j] = x0r + x2r;
+        a[j + 1] = x0i + x2i;
+        a[j2] = x2i - x0i;
+        a[j2 + 1] = x0r - x2r;
+        x0r = x1r - x3i;
+        x0i = x1i + x3r;
+        a[j1] = wk1r * (x0r - x0i);
+        a[j1 + 1] = wk1r * (x0r + x0i);
+        x0r = x3i + x1r;
+        x0i = x3r - x1i;
+        a[j3] = wk1r * (x0i - x0r);
+        a[j3 + 1] = wk1r * (x0i + x0r);
+    }
+    k1 = 0;
+    m2 = 2 * m;
+    for (k = m2; k < n; k += m2) {
+        k1 += 2;
+        k2 = 2 * k1;
         wk2r = w[k1];
         wk2i = w[k1 + 1];
         wk1r = w[k2];
@@ -1057,39 +7795,60 @@ void cftmdl(int n, int l, double *a, double *w)
         for (j = k; j < l + k; j += 2) {
             j1 = j + l;
             j2 = j1 + l;
-            m2 = j2 + l;
+            j3 = j2 + l;
             x0r = a[j] + a[j1];
             x0i = a[j + 1] + a[j1 + 1];
             x1r = a[j] - a[j1];
             x1i = a[j + 1] - a[j1 + 1];
-            x2r = a[j2] + a[m2];
-            x2i = a[j2 + 1] + a[m2 + 1];
-            x3r = a[j2] - a[m2];
-            x3i = a[j2 + 1] - a[m2 + 1];
+            x2r = a[j2] + a[j3];
+            x2i = a[j2 + 1] + a[j3 + 1];
+            x3r = a[j2] - a[j3];
+            x3i = a[j2 + 1] - a[j3 + 1];
             a[j] = x0r + x2r;
             a[j + 1] = x0i + x2i;
-            a[j2] = x0r - x2r;
-            a[j2 + 1] = x0i - x2i;
-            a[j1] = x1r - x3i;
-            a[j1 + 1] = x1i + x3r;
-            a[m2] = x1r + x3i;
-            a[m2 + 1] = x1i - x3r;
-            x0r = a[j];
-            x0i = a[j + 1];
-            x1r = a[j1];
-            x1i = a[j1 + 1];
-            x2r = a[j2];
-            x2i = a[j2 + 1];
-            x3r = a[m2];
-            x3i = a[m2 + 1];
-            a[j] = x0r * wk2r - x0i * wk2i;
-            a[j + 1] = x0r * wk2i + x0i * wk2r;
-            a[j1] = x1r * wk1r - x1i * wk1i;
-            a[j1 + 1] = x1r * wk1i + x1i * wk1r;
-            a[j2] = x2r * wk2r + x2i * wk2i;
-            a[j2 + 1] = x2r * wk2i - x2i * wk2r;
-            a[m2] = x3r * wk3r - x3i * wk3i;
-            a[m2 + 1] = x3r * wk3i + x3i * wk3r;
+            x0r -= x2r;
+            x0i -= x2i;
+            a[j2] = wk2r * x0r - wk2i * x0i;
+            a[j2 + 1] = wk2r * x0i + wk2i * x0r;
+            x0r = x1r - x3i;
+            x0i = x1i + x3r;
+            a[j1] = wk1r * x0r - wk1i * x0i;
+            a[j1 + 1] = wk1r * x0i + wk1i * x0r;
+            x0r = x1r + x3i;
+            x0i = x1i - x3r;
+            a[j3] = wk3r * x0r - wk3i * x0i;
+            a[j3 + 1] = wk3r * x0i + wk3i * x0r;
+        }
+        wk1r = w[k2 + 2];
+        wk1i = w[k2 + 3];
+        wk3r = wk1r - 2 * wk2r * wk1i;
+        wk3i = 2 * wk2r * wk1r - wk1i;
+        for (j = k + m; j < l + (k + m); j += 2) {
+            j1 = j + l;
+            j2 = j1 + l;
+            j3 = j2 + l;
+            x0r = a[j] + a[j1];
+            x0i = a[j + 1] + a[j1 + 1];
+            x1r = a[j] - a[j1];
+            x1i = a[j + 1] - a[j1 + 1];
+            x2r = a[j2] + a[j3];
+            x2i = a[j2 + 1] + a[j3 + 1];
+            x3r = a[j2] - a[j3];
+            x3i = a[j2 + 1] - a[j3 + 1];
+            a[j] = x0r + x2r;
+            a[j + 1] = x0i + x2i;
+            x0r -= x2r;
+            x0i -= x2i;
+            a[j2] = -wk2i * x0r - wk2r * x0i;
+            a[j2 + 1] = -wk2i * x0i + wk2r * x0r;
+            x0r = x1r - x3i;
+            x0i = x1i + x3r;
+            a[j1] = wk1r * x0r - wk1i * x0i;
+            a[j1 + 1] = wk1r * x0i + wk1i * x0r;
+            x0r = x1r + x3i;
+            x0i = x1i - x3r;
+            a[j3] = wk3r * x0r - wk3i * x0i;
+            a[j3 + 1] = wk3r * x0i + wk3i * x0r;
         }
     }
 }
@@ -0,0 +1,108 @@
+/*
+ * parc_features.h - PARC per-hop feature stream format and reader
+ *
+ * With --features, every analysed hop is appended as one FeatureRecord to a
+ * feat_YYYYMMDD_HHMMSS.pfs file. A file is a FeatureHeader followed by
+ * records back to back. Everything is little-endian with natural alignment
+ * and no padding the compiler could choose differently, so a mapped file can
+ * be used in place:
+ *
+ *     FeatureView view;
+ *     if (features_view(data, size, &view) == 0) {
+ *         for (uint64_t i = 0; i < view.count; i++) use(&view.records[i]);
+ *     }
+ *
+ * This header needs only the C standard library and is shared with main.c,
+ * so other tools can include it as is.
+ */
+
+#ifndef PARC_FEATURES_H
+#define PARC_FEATURES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FEATURE_MAGIC 0x54534650u // "PFST"
+#define FEATURE_VERSION 1
+#define FEATURE_BANDS 8           // Band slots per record
+#define FEATURE_PEAKS 4           // Peak slots per record
+#define FEATURE_BAND_NAME_SIZE 16
+
+#define FEATURE_FLAG_SPEECH 1     // The voice detector found the hop speech-like
+#define FEATURE_FLAG_VOICE 2      // Inside a voice detection, which records unless --no-record
+
+// A detection band as configured when the file was started. The file is
+// rotated when names or ranges change, so band b of every record is
+// bands[b] of its header; thresholds set from the keyboard may have moved.
+typedef struct {
+    char name[FEATURE_BAND_NAME_SIZE];
+    float min_hz;
+    float max_hz;
+    float threshold_db;
+    uint32_t reserved;
+} FeatureBand;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;  // Offset of the first record
+    uint16_t record_size;
+    uint8_t max_bands;     // FEATURE_BANDS
+    uint8_t max_peaks;     // FEATURE_PEAKS
+    uint32_t sample_rate;
+    uint32_t band_count;
+    uint32_t first_sequence;
+    int64_t start_time;    // Unix time the file was started
+    FeatureBand bands[FEATURE_BANDS];
+} FeatureHeader;
+
+typedef struct {
+    float freq_hz;         // Interpolated between bins
+    float mag_db;
+} FeaturePeak;
+
+typedef struct {
+    uint64_t end_sample;   // Capture samples up to the end of the hop's frame
+    uint32_t sequence;     // Hop number since start; a gap means dropped records
+    uint32_t fft_size;
+    float level_dbfs;      // Whole-spectrum level
+    float centroid_hz;     // Power-weighted mean frequency
+    float flatness;        // Geometric over arithmetic mean power, 0 tonal .. 1 white
+    uint8_t band_count;
+    uint8_t peak_count;
+    uint8_t burst_mask;    // Bit b set while band b is in a burst
+    uint8_t flags;         // FEATURE_FLAG_*
+    float band_db[FEATURE_BANDS];      // Mean level over each band, as displayed
+    FeaturePeak peaks[FEATURE_PEAKS];  // Strongest first, within band 0
+} FeatureRecord;
+
+// The layout is part of the format; these fail to compile if it drifts.
+typedef char feature_header_size_check[sizeof(FeatureHeader) == 288 ? 1 : -1];
+typedef char feature_record_size_check[sizeof(FeatureRecord) == 96 ? 1 : -1];
+
+typedef struct {
+    const FeatureHeader* header;
+    const FeatureRecord* records;
+    uint64_t count;
+} FeatureView;
+
+// Points view at the header and records of a feature file held in memory,
+// mapped or read whole. data must be 8-byte aligned, as mappings and
+// malloc() blocks are. A partial record at the end, left by a writer that was
+// cut off, is not counted. Returns -1 if data is not a feature file this
+// header can read in place, including one written on a big-endian host.
+static inline int features_view(const void* data, size_t size, FeatureView* view) {
+    const FeatureHeader* header = (const FeatureHeader*)data;
+    if (((uintptr_t)data & 7) != 0 || size < sizeof(FeatureHeader) || header->magic != FEATURE_MAGIC ||
+        header->version != FEATURE_VERSION || header->header_size != sizeof(FeatureHeader) ||
+        header->record_size != sizeof(FeatureRecord) || header->max_bands != FEATURE_BANDS ||
+        header->max_peaks != FEATURE_PEAKS || header->band_count > FEATURE_BANDS) {
+        return -1;
+    }
+    view->header = header;
+    view->records = (const FeatureRecord*)((const char*)data + header->header_size);
+    view->count = (size - header->header_size) / header->record_size;
+    return 0;
+}
+
+#endif